@@ -0,0 +1,431 @@
+// Microbenchmarks of the pseudoalignment hot path and of the EM. An index is
+// built from a FASTA file, or from a synthetic transcriptome of genes whose
+// isoforms share exons, reads are sampled from its targets, and every kernel
+// is run over all reads a few times, reporting the fastest run.
+//
+//   make bench                       # the defaults
+//   bench/kallisto_bench -n 1000000 -f transcripts.fasta.gz --json
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "common.h"
+#include "EMAlgorithm.h"
+#include "KmerIndex.h"
+#include "KmerIterator.hpp"
+#include "MinCollector.h"
+#include "ProcessReads.h"
+
+struct BenchOptions {
+  std::string fasta; // synthetic transcriptome if empty
+  std::string write_fasta; // only write the synthetic transcriptome
+  int genes;
+  int num_reads;
+  int read_length;
+  double error_rate;
+  int repeats;
+  size_t seed;
+  bool json;
+
+  BenchOptions() : genes(2000), num_reads(200000), read_length(100),
+    error_rate(0.005), repeats(3), seed(42), json(false) {}
+};
+
+struct Result {
+  std::string kernel;
+  double ops; // calls of the kernel over all reads
+  double seconds; // fastest of the repeats
+};
+
+static void usage() {
+  std::cout << "Usage: kallisto_bench [arguments]" << std::endl << std::endl
+            << "Optional arguments:" << std::endl
+            << "-f, --fasta=STRING            Build the index from this FASTA file instead" << std::endl
+            << "                              of a synthetic transcriptome" << std::endl
+            << "-g, --genes=INT               Genes in the synthetic transcriptome (default: 2000)" << std::endl
+            << "-w, --write-fasta=STRING      Only write the synthetic transcriptome to this file" << std::endl
+            << "-n, --reads=INT               Number of reads to simulate (default: 200000)" << std::endl
+            << "-l, --read-length=INT         Length of the reads (default: 100)" << std::endl
+            << "-e, --error-rate=DOUBLE       Substitution errors per base (default: 0.005)" << std::endl
+            << "-r, --repeats=INT             Runs of each kernel, the fastest counts (default: 3)" << std::endl
+            << "    --seed=INT                Seed for the simulation (default: 42)" << std::endl
+            << "    --json                    Write the results as JSON" << std::endl;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions& opt) {
+  int json_flag = 0;
+  const char *opt_string = "f:g:w:n:l:e:r:h";
+  static struct option long_options[] = {
+    {"json", no_argument, &json_flag, 1},
+    {"fasta", required_argument, 0, 'f'},
+    {"genes", required_argument, 0, 'g'},
+    {"write-fasta", required_argument, 0, 'w'},
+    {"reads", required_argument, 0, 'n'},
+    {"read-length", required_argument, 0, 'l'},
+    {"error-rate", required_argument, 0, 'e'},
+    {"repeats", required_argument, 0, 'r'},
+    {"seed", required_argument, 0, 's'},
+    {"help", no_argument, 0, 'h'},
+    {0,0,0,0}
+  };
+  int c;
+  int option_index = 0;
+  while (true) {
+    c = getopt_long(argc, argv, opt_string, long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 0:
+      break;
+    case 'f':
+      opt.fasta = optarg;
+      break;
+    case 'g':
+      opt.genes = atoi(optarg);
+      break;
+    case 'w':
+      opt.write_fasta = optarg;
+      break;
+    case 'n':
+      opt.num_reads = atoi(optarg);
+      break;
+    case 'l':
+      opt.read_length = atoi(optarg);
+      break;
+    case 'e':
+      opt.error_rate = atof(optarg);
+      break;
+    case 'r':
+      opt.repeats = atoi(optarg);
+      break;
+    case 's':
+      opt.seed = atol(optarg);
+      break;
+    default:
+      return false;
+    }
+  }
+  opt.json = json_flag;
+
+  bool ret = true;
+  if (opt.genes <= 0 || opt.num_reads <= 0 || opt.repeats <= 0) {
+    std::cerr << "Error: number of genes, reads and repeats must be positive" << std::endl;
+    ret = false;
+  }
+  if (opt.read_length < 31) {
+    std::cerr << "Error: reads must be at least 31 bases long" << std::endl;
+    ret = false;
+  }
+  if (opt.error_rate < 0.0 || opt.error_rate >= 1.0) {
+    std::cerr << "Error: error rate must be between 0 and 1" << std::endl;
+    ret = false;
+  }
+  return ret;
+}
+
+static std::string randomSequence(std::mt19937& gen, int len) {
+  static const char bases[] = "ACGT";
+  std::uniform_int_distribution<int> base(0, 3);
+  std::string s(len, 'A');
+  for (auto& c : s) {
+    c = bases[base(gen)];
+  }
+  return s;
+}
+
+// genes of 3 to 8 exons with up to 4 isoforms each, skipping some of the
+// inner exons, so that k-mers are shared between targets as in a real
+// transcriptome. make perf uses the same one through --write-fasta
+static bool writeTranscriptome(const std::string& fn, int genes, std::mt19937& gen) {
+  std::ofstream out(fn);
+  if (!out.is_open()) {
+    std::cerr << "Error: could not open file " << fn << " for writing" << std::endl;
+    return false;
+  }
+  std::uniform_int_distribution<int> num_exons(3, 8), exon_len(100, 400), num_isoforms(1, 4);
+  std::bernoulli_distribution keep(0.7);
+  for (int g = 0; g < genes; g++) {
+    std::vector<std::string> exons(num_exons(gen));
+    for (auto& e : exons) {
+      e = randomSequence(gen, exon_len(gen));
+    }
+    int n = num_isoforms(gen);
+    for (int i = 0; i < n; i++) {
+      std::string seq;
+      for (size_t e = 0; e < exons.size(); e++) {
+        // the first isoform has every exon, the others at least the first
+        // and the last
+        if (i == 0 || e == 0 || e + 1 == exons.size() || keep(gen)) {
+          seq += exons[e];
+        }
+      }
+      out << ">G" << g << ".T" << i << "\n" << seq << "\n";
+    }
+  }
+  out.close();
+  return out.good();
+}
+
+static std::string reverseComplement(const std::string& s) {
+  std::string r(s.rbegin(), s.rend());
+  for (auto& c : r) {
+    switch (c) {
+    case 'A': c = 'T'; break;
+    case 'C': c = 'G'; break;
+    case 'G': c = 'C'; break;
+    case 'T': c = 'A'; break;
+    default: c = 'N';
+    }
+  }
+  return r;
+}
+
+// reads from uniformly chosen targets, positions and strands with
+// substitution errors
+static std::vector<std::string> simulateReads(const KmerIndex& index, const BenchOptions& opt, std::mt19937& gen) {
+  std::vector<int> targets;
+  for (int i = 0; i < index.num_trans; i++) {
+    if (index.target_lens_[i] >= opt.read_length) {
+      targets.push_back(i);
+    }
+  }
+  std::vector<std::string> reads;
+  if (targets.empty()) {
+    return reads;
+  }
+  std::uniform_int_distribution<int> target(0, targets.size() - 1);
+  std::bernoulli_distribution reverse(0.5), error(opt.error_rate);
+  std::uniform_int_distribution<int> base(0, 2);
+  static const char bases[] = "ACGT";
+
+  reads.reserve(opt.num_reads);
+  for (int r = 0; r < opt.num_reads; r++) {
+    const std::string& seq = index.target_seqs_[targets[target(gen)]];
+    std::uniform_int_distribution<int> pos(0, seq.size() - opt.read_length);
+    std::string read = seq.substr(pos(gen), opt.read_length);
+    if (reverse(gen)) {
+      read = reverseComplement(read);
+    }
+    for (auto& c : read) {
+      if (error(gen)) {
+        // one of the other three bases
+        int b = std::find(bases, bases + 4, c) - bases;
+        c = bases[(b + 1 + base(gen)) % 4];
+      }
+    }
+    reads.push_back(read);
+  }
+  return reads;
+}
+
+// the fastest of the runs, in seconds
+template <typename F>
+static double timeBest(int repeats, F f) {
+  double best = 0.0;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (i == 0 || s < best) {
+      best = s;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions bopt;
+  if (!parseOptions(argc, argv, bopt)) {
+    usage();
+    return 1;
+  }
+  std::mt19937 gen(bopt.seed);
+  if (!bopt.write_fasta.empty()) {
+    return writeTranscriptome(bopt.write_fasta, bopt.genes, gen) ? 0 : 1;
+  }
+
+  ProgramOptions opt;
+  std::string fasta = bopt.fasta;
+  if (fasta.empty()) {
+    fasta = "kallisto_bench." + std::to_string(getpid()) + ".fasta";
+    if (!writeTranscriptome(fasta, bopt.genes, gen)) {
+      return 1;
+    }
+  }
+  opt.transfasta.push_back(fasta);
+  Kmer::set_k(opt.k);
+
+  KmerIndex index(opt);
+  auto start = std::chrono::steady_clock::now();
+  index.BuildTranscripts(opt);
+  double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (bopt.fasta.empty()) {
+    std::remove(fasta.c_str());
+  }
+  index.loadTranscriptSequences();
+
+  std::vector<std::string> reads = simulateReads(index, bopt, gen);
+  if (reads.empty()) {
+    std::cerr << "Error: no target is as long as the reads" << std::endl;
+    return 1;
+  }
+  MinCollector tc(index, opt);
+
+  std::vector<Result> results;
+  // keeps the compiler from dropping the work
+  size_t sink = 0;
+
+  // every k-mer of the reads, and the representatives of up to 4M of them
+  // for the table lookups
+  size_t num_kmers = 0;
+  std::vector<Kmer> lookups;
+  for (auto& r : reads) {
+    KmerIterator kit(r.c_str()), kit_end;
+    for (; kit != kit_end; ++kit) {
+      ++num_kmers;
+      if (lookups.size() < 4000000) {
+        lookups.push_back(kit->first.rep());
+      }
+    }
+  }
+
+  double s = timeBest(bopt.repeats, [&]() {
+    for (auto& r : reads) {
+      KmerIterator kit(r.c_str()), kit_end;
+      for (; kit != kit_end; ++kit) {
+        sink += kit->second;
+      }
+    }
+  });
+  results.push_back({"KmerIterator", (double) num_kmers, s});
+
+  s = timeBest(bopt.repeats, [&]() {
+    for (auto& km : lookups) {
+      auto search = index.kmap.find(km);
+      if (search != index.kmap.end()) {
+        sink += search->second.contig;
+      }
+    }
+  });
+  // scaled to all k-mers of the reads, to compare per read
+  results.push_back({"KmerHashTable::find", (double) num_kmers, s * num_kmers / lookups.size()});
+
+  std::vector<std::vector<std::pair<KmerEntry,int>>> hits(reads.size());
+  s = timeBest(bopt.repeats, [&]() {
+    for (size_t i = 0; i < reads.size(); i++) {
+      hits[i].clear();
+      index.match(reads[i].c_str(), reads[i].size(), hits[i]);
+      sink += hits[i].size();
+    }
+  });
+  results.push_back({"KmerIndex::match", (double) reads.size(), s});
+
+  // intersectECs sorts the hits, it gets a fresh copy every time
+  std::vector<std::vector<int>> ecs(reads.size());
+  std::vector<std::pair<KmerEntry,int>> v;
+  s = timeBest(bopt.repeats, [&]() {
+    for (size_t i = 0; i < reads.size(); i++) {
+      v = hits[i];
+      ecs[i] = tc.intersectECs(v);
+      sink += ecs[i].size();
+    }
+  });
+  results.push_back({"intersectECs", (double) reads.size(), s});
+
+  size_t num_mapped = 0;
+  s = timeBest(bopt.repeats, [&]() {
+    num_mapped = 0;
+    for (auto& u : ecs) {
+      if (!u.empty()) {
+        sink += tc.findEC(u);
+        ++num_mapped;
+      }
+    }
+  });
+  results.push_back({"findEC", (double) num_mapped, s});
+
+  // the whole of it, as the workers of quant do for single-end reads
+  std::vector<std::pair<KmerEntry,int>> v1, v2;
+  std::vector<int> u, vtmp;
+  s = timeBest(bopt.repeats, [&]() {
+    for (auto& r : reads) {
+      v1.clear();
+      u.clear();
+      pseudoalignFragment(index, tc, opt, r.c_str(), r.size(), nullptr, 0, false, v1, v2, u, vtmp);
+      if (!u.empty()) {
+        sink += tc.findEC(u);
+      }
+    }
+  });
+  results.push_back({"pseudoalignFragment", (double) reads.size(), s});
+
+  // the E-step of the EM in double and single precision (--single-precision),
+  // on the same ECs and counts from the reads. ops are the ECs with reads
+  // visited by one E-step of each round
+  for (auto& u : ecs) {
+    tc.increaseCount(u);
+  }
+  size_t num_ecs = 0;
+  for (size_t ec = index.num_trans; ec < tc.counts.size(); ec++) {
+    num_ecs += (tc.counts[ec] > 0);
+  }
+  const int em_rounds = 20;
+  std::vector<double> fl_means(index.target_lens_.size(), 2.0 * bopt.read_length);
+  for (bool single : {false, true}) {
+    ProgramOptions em_opt = opt;
+    em_opt.single_precision = single;
+    EMAlgorithm em(tc.counts, index, tc, fl_means, em_opt);
+    std::vector<double> next_alpha(index.num_trans, 0.0);
+    std::vector<float> alpha_float(index.num_trans);
+    s = timeBest(bopt.repeats, [&]() {
+      for (int i = 0; i < em_rounds; i++) {
+        em.e_step(alpha_float, next_alpha);
+      }
+    });
+    sink += (size_t) std::accumulate(next_alpha.begin(), next_alpha.end(), 0.0);
+    results.push_back({single ? "e_step single" : "e_step double", (double) em_rounds * num_ecs, s});
+  }
+
+  double n = reads.size();
+  if (bopt.json) {
+    std::cout << "{" << std::endl
+              << "\t\"targets\": " << index.num_trans << "," << std::endl
+              << "\t\"reads\": " << reads.size() << "," << std::endl
+              << "\t\"read_length\": " << bopt.read_length << "," << std::endl
+              << "\t\"pseudoaligned\": " << num_mapped << "," << std::endl
+              << "\t\"index_build_seconds\": " << build_seconds << "," << std::endl
+              << "\t\"kernels\": {" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& r = results[i];
+      std::cout << "\t\t\"" << r.kernel << "\": {\"ns_per_op\": " << r.seconds * 1e9 / r.ops
+                << ", \"ns_per_read\": " << r.seconds * 1e9 / n << "}"
+                << ((i + 1 < results.size()) ? "," : "") << std::endl;
+    }
+    std::cout << "\t}" << std::endl << "}" << std::endl;
+  } else {
+    char buf[128];
+    std::cout << "[bench] " << pretty_num(index.num_trans) << " targets, index built in "
+              << build_seconds << " s" << std::endl
+              << "[bench] " << pretty_num(reads.size()) << " reads of " << bopt.read_length
+              << " bases, " << pretty_num(num_mapped) << " pseudoaligned" << std::endl;
+    snprintf(buf, sizeof(buf), "%-22s %10s %10s %10s", "kernel", "ops/read", "ns/op", "ns/read");
+    std::cout << buf << std::endl;
+    for (auto& r : results) {
+      snprintf(buf, sizeof(buf), "%-22s %10.1f %10.1f %10.1f", r.kernel.c_str(), r.ops / n,
+        r.seconds * 1e9 / r.ops, r.seconds * 1e9 / n);
+      std::cout << buf << std::endl;
+    }
+  }
+  std::cerr << "[bench] checksum " << sink << std::endl;
+  return 0;
+}
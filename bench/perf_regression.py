@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+"""Performance regression check for kallisto.
+
+Runs a fixed benchmark matrix on simulated data: building and loading the
+index, pseudoalignment at several thread counts and the EM algorithm, timed
+over the estimate and its bootstraps. The timings come from the run_info.json of quant. The results are
+written as JSON and compared to a baseline, failing when a stage got slower,
+or the throughput dropped, by more than the tolerance.
+
+    make perf                                  # from the build directory
+    bench/perf_regression.py --kallisto src/kallisto \
+        --bench bench/kallisto_bench --update-baseline
+
+Timings only compare on the same machine, the check fails against a baseline
+from another one. Record a baseline for every machine that runs the check. Thread counts above the number of cores are left out of
+a baseline, they say nothing about scaling.
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import time
+
+# the benchmark matrix, changing any of it needs a new baseline
+GENES = 4000
+READS = 1000000
+BOOTSTRAPS = 10
+SEED = 42
+
+
+def run(cmd):
+    """runs a kallisto command, returning its wall time"""
+    start = time.monotonic()
+    p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    if p.returncode != 0:
+        sys.stderr.write(p.stderr)
+        sys.exit("Error: %s failed" % " ".join(cmd))
+    return time.monotonic() - start
+
+
+def machine():
+    model = platform.processor()
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    model = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {"cpu": model, "cores": os.cpu_count()}
+
+
+def benchmark(args):
+    work = args.work_dir
+    os.makedirs(work, exist_ok=True)
+    fasta = os.path.join(work, "transcripts.fasta")
+    index = os.path.join(work, "transcripts.idx")
+    reads = os.path.join(work, "reads")
+    if not os.path.exists(fasta):
+        # the synthetic transcriptome of the microbenchmarks
+        run([args.bench, "--write-fasta", fasta, "-g", str(GENES), "--seed", str(SEED)])
+
+    # the best of the repeats counts, timings only get worse from noise
+    results = {}
+    def record(name, value, higher_is_better=False):
+        best = results.get(name)
+        if best is None or (value > best if higher_is_better else value < best):
+            results[name] = value
+
+    for _ in range(args.repeats):
+        record("index_build_seconds", round(run([args.kallisto, "index", "-i", index, fasta]), 3))
+    if not os.path.exists(os.path.join(reads, "reads_1.fastq.gz")):
+        run([args.kallisto, "simulate", "-i", index, "-o", reads, "-n", str(READS),
+             "--seed", str(SEED), "-t", str(max(args.threads))])
+
+    for t in args.threads:
+        for _ in range(args.repeats):
+            out = os.path.join(work, "quant_t%d" % t)
+            shutil.rmtree(out, ignore_errors=True)
+            # the em is timed with the first thread count
+            bootstraps = BOOTSTRAPS if t == args.threads[0] else 0
+            run([args.kallisto, "quant", "-i", index, "-o", out, "-t", str(t),
+                 "-b", str(bootstraps), "--seed", str(SEED), "--plaintext",
+                 os.path.join(reads, "reads_1.fastq.gz"), os.path.join(reads, "reads_2.fastq.gz")])
+            with open(os.path.join(out, "run_info.json")) as f:
+                info = json.load(f)
+            stages = info["stages"]
+            record("reads_per_second_t%d" % t, info["reads_per_second"], True)
+            if t == args.threads[0]:
+                record("index_load_seconds", stages["index_load"]["wall_seconds"])
+                # a single EM of the estimate is too short to time, the
+                # bootstraps run it again on resampled counts of the same ECs
+                record("em_seconds", round(stages["em"]["wall_seconds"]
+                                           + stages["bootstrap"]["wall_seconds"], 3))
+    return results
+
+
+def compare(results, baseline, tolerance, min_seconds):
+    """prints the change of every metric, returning the regressions"""
+    regressions = []
+    print("%-26s %12s %12s %8s" % ("metric", "baseline", "result", "change"))
+    for name in sorted(results):
+        value = results[name]
+        base = baseline.get(name)
+        if base is None:
+            print("%-26s %12s %12.3f %8s" % (name, "-", value, "new"))
+            continue
+        higher_is_better = name.startswith("reads_per_second")
+        change = (value - base) / base if base > 0 else 0.0
+        worse = -change if higher_is_better else change
+        status = ""
+        if not higher_is_better and base < min_seconds:
+            # too short to time reliably
+            status = "  (ignored)"
+        elif worse > tolerance:
+            status = "  REGRESSION"
+            regressions.append(name)
+        print("%-26s %12.3f %12.3f %+7.1f%%%s" % (name, base, value, 100 * change, status))
+    return regressions
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    p = argparse.ArgumentParser(description="kallisto performance regression check")
+    p.add_argument("--kallisto", default="kallisto", help="the kallisto binary to benchmark")
+    p.add_argument("--bench", default="kallisto_bench",
+                   help="the kallisto_bench binary, which writes the transcriptome")
+    p.add_argument("--baseline", default=os.path.join(here, "perf_baseline.json"),
+                   help="baseline to compare to (default: %(default)s)")
+    p.add_argument("--output", default="perf_results.json", help="where to write the results")
+    p.add_argument("--work-dir", default="perf_data",
+                   help="directory for the index and reads, kept between runs")
+    p.add_argument("--threads", default="1,2,4", help="thread counts to pseudoalign with")
+    p.add_argument("--repeats", type=int, default=3, help="runs of every benchmark, the best counts")
+    p.add_argument("--tolerance", type=float, default=0.2,
+                   help="fraction a metric may get worse before it fails (default: %(default)s)")
+    p.add_argument("--min-seconds", type=float, default=0.1,
+                   help="stages shorter than this in the baseline are not compared")
+    p.add_argument("--update-baseline", action="store_true",
+                   help="write the results to the baseline instead of comparing")
+    args = p.parse_args()
+    args.threads = [int(t) for t in args.threads.split(",")]
+    if args.repeats < 1 or min(args.threads) < 1:
+        sys.exit("Error: repeats and thread counts must be positive")
+
+    baseline = None
+    if not args.update_baseline:
+        if not os.path.exists(args.baseline):
+            sys.exit("Error: no baseline %s, create one with --update-baseline" % args.baseline)
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get("machine") != machine():
+            # timings from another machine say nothing about a regression
+            sys.exit("Error: the baseline was recorded on %s, this is %s; record one for this"
+                     " machine with make perf-baseline or --update-baseline"
+                     % (json.dumps(baseline.get("machine")), json.dumps(machine())))
+
+    results = benchmark(args)
+    report = {"machine": machine(), "results": results}
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    if args.update_baseline:
+        cores = report["machine"]["cores"] or 1
+        baseline = {"machine": report["machine"], "results": dict(results)}
+        for t in args.threads:
+            if t > cores:
+                del baseline["results"]["reads_per_second_t%d" % t]
+                print("[~warn] %d threads on %d cores are left out of the baseline" % (t, cores))
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("[ perf] wrote baseline %s" % args.baseline)
+        return 0
+
+    regressions = compare(results, baseline["results"], args.tolerance, args.min_seconds)
+    if regressions:
+        print("[ perf] %d of %d metrics regressed by more than %.0f%%"
+              % (len(regressions), len(results), 100 * args.tolerance))
+        return 1
+    print("[ perf] no regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,191 @@
+#include "BGZFWriter.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <zlib.h>
+
+// empty block marking the end of a BGZF file
+static const char BGZF_EOF[28] = {
+  '\x1f', '\x8b', '\x08', '\x04', '\x00', '\x00', '\x00', '\x00',
+  '\x00', '\xff', '\x06', '\x00', '\x42', '\x43', '\x02', '\x00',
+  '\x1b', '\x00', '\x03', '\x00', '\x00', '\x00', '\x00', '\x00',
+  '\x00', '\x00', '\x00', '\x00'
+};
+
+const size_t BGZFWriter::BGZF_BLOCK_SIZE;
+
+static const size_t BGZF_HEADER_SIZE = 18;
+static const size_t BGZF_FOOTER_SIZE = 8;
+
+static void put_u16(char* p, uint16_t x) {
+  p[0] = x & 0xff;
+  p[1] = (x >> 8) & 0xff;
+}
+
+static void put_u32(char* p, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (x >> (8*i)) & 0xff;
+  }
+}
+
+BGZFWriter::~BGZFWriter() {
+  if (primed_) {
+    close();
+  }
+}
+
+bool BGZFWriter::open(const std::string& fname, int num_threads, int level) {
+  out_.open(fname, std::ios::out | std::ios::binary);
+  if (!out_.is_open()) {
+    return false;
+  }
+  level_ = level;
+  done_ = false;
+  failed_ = false;
+  next_job_ = 0;
+  num_blocks_ = 0;
+  coffset_ = 0;
+  block_offsets_.clear();
+  num_threads = (num_threads > 0) ? num_threads : 1;
+  max_queued_ = 4 * num_threads;
+  current_.reserve(BGZF_BLOCK_SIZE);
+  for (int i = 0; i < num_threads; i++) {
+    workers_.emplace_back(&BGZFWriter::worker, this);
+  }
+  primed_ = true;
+  return true;
+}
+
+void BGZFWriter::write(const char* data, size_t len) {
+  assert(primed_);
+  while (len > 0) {
+    size_t n = std::min(len, BGZF_BLOCK_SIZE - current_.size());
+    current_.append(data, n);
+    data += n;
+    len -= n;
+    if (current_.size() == BGZF_BLOCK_SIZE) {
+      submit();
+    }
+  }
+}
+
+void BGZFWriter::submit() {
+  if (current_.empty()) {
+    return;
+  }
+  auto b = std::make_shared<Block>();
+  b->in.swap(current_);
+  current_.reserve(BGZF_BLOCK_SIZE);
+  ++num_blocks_;
+
+  std::unique_lock<std::mutex> lock(lock_);
+  // don't let the readers run too far ahead of the compression
+  space_cv_.wait(lock, [this] { return queue_.size() < max_queued_; });
+  queue_.push_back(b);
+  work_cv_.notify_one();
+}
+
+void BGZFWriter::worker() {
+  while (true) {
+    std::shared_ptr<Block> b;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      work_cv_.wait(lock, [this] { return done_ || next_job_ < queue_.size(); });
+      if (next_job_ >= queue_.size()) {
+        return; // done_ and nothing left
+      }
+      b = queue_[next_job_++];
+    }
+
+    bool ok = compress(*b);
+
+    std::lock_guard<std::mutex> lock(lock_);
+    b->compressed = true;
+    if (!ok) {
+      failed_ = true;
+    }
+    // write out every finished block at the front, in order. After an
+    // error the blocks are still taken off the queue so that close returns
+    while (!queue_.empty() && queue_.front()->compressed) {
+      auto& out = queue_.front()->out;
+      block_offsets_.push_back(coffset_);
+      coffset_ += out.size();
+      if (!failed_ && !out_.write(out.data(), out.size())) {
+        failed_ = true;
+      }
+      queue_.pop_front();
+      --next_job_;
+    }
+    space_cv_.notify_all();
+  }
+}
+
+bool BGZFWriter::compress(Block& b) const {
+  z_stream zs;
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  // raw deflate, the gzip header is written by hand to carry the block size
+  if (deflateInit2(&zs, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  size_t bound = deflateBound(&zs, b.in.size());
+  b.out.resize(BGZF_HEADER_SIZE + bound + BGZF_FOOTER_SIZE);
+  zs.next_in = (Bytef*) b.in.data();
+  zs.avail_in = b.in.size();
+  zs.next_out = (Bytef*) &b.out[BGZF_HEADER_SIZE];
+  zs.avail_out = bound;
+  int ret = deflate(&zs, Z_FINISH);
+  size_t clen = zs.total_out;
+  deflateEnd(&zs);
+
+  size_t total = BGZF_HEADER_SIZE + clen + BGZF_FOOTER_SIZE;
+  if (ret != Z_STREAM_END || total > 65536) {
+    return false;
+  }
+  char* p = &b.out[0];
+  std::copy(BGZF_EOF, BGZF_EOF + 16, p); // same fixed header fields
+  put_u16(p + 16, total - 1);
+
+  uint32_t crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*) b.in.data(), b.in.size());
+  put_u32(p + BGZF_HEADER_SIZE + clen, crc);
+  put_u32(p + BGZF_HEADER_SIZE + clen + 4, b.in.size());
+  b.out.resize(total);
+  std::string().swap(b.in);
+  return true;
+}
+
+bool BGZFWriter::close() {
+  if (!primed_) {
+    return !failed_;
+  }
+  submit();
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    done_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& t : workers_) {
+    t.join();
+  }
+  workers_.clear();
+  assert(queue_.empty());
+
+  block_offsets_.push_back(coffset_);
+  out_.write(BGZF_EOF, sizeof(BGZF_EOF));
+  coffset_ += sizeof(BGZF_EOF);
+  out_.close();
+  primed_ = false;
+  // closing flushes the stream, which is where a full disk shows up
+  if (!out_.good()) {
+    failed_ = true;
+  }
+  return !failed_;
+}
+
+uint64_t BGZFWriter::virtualOffset(uint64_t pos) const {
+  assert(!primed_);
+  assert((pos >> 16) < block_offsets_.size());
+  return (block_offsets_[pos >> 16] << 16) | (pos & 0xffff);
+}
@@ -0,0 +1,70 @@
+#ifndef KALLISTO_BGZFWRITER_H
+#define KALLISTO_BGZFWRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes a BGZF file (the blocked gzip format used by BAM). Data is cut
+// into blocks of at most BGZF_BLOCK_SIZE bytes which are deflated on a pool
+// of threads and written to disk in order.
+class BGZFWriter {
+  public:
+    BGZFWriter() : primed_(false), done_(false), failed_(false), num_blocks_(0), coffset_(0) {}
+    ~BGZFWriter();
+
+    bool open(const std::string& fname, int num_threads, int level = 6);
+    void write(const char* data, size_t len);
+    // flushes all pending blocks and appends the BGZF EOF marker, returns
+    // false if compressing or writing any of the file failed
+    bool close();
+
+    // position of the next byte written, as block number << 16 | offset
+    // within the block. The compressed offset of a block is only known once
+    // it has been written, so use virtualOffset() after close() to turn it
+    // into a BGZF virtual file offset
+    uint64_t tell() const { return (num_blocks_ << 16) | current_.size(); }
+    uint64_t virtualOffset(uint64_t pos) const;
+
+    static const size_t BGZF_BLOCK_SIZE = 0xff00;
+
+  private:
+    struct Block {
+      std::string in;
+      std::string out;
+      bool compressed = false;
+    };
+
+    void submit();
+    void worker();
+    bool compress(Block& b) const;
+
+    bool primed_;
+    bool done_;
+    bool failed_; // a block could not be compressed or written
+    int level_;
+    size_t max_queued_;
+
+    std::ofstream out_;
+    std::string current_;
+    uint64_t num_blocks_;
+    uint64_t coffset_;
+    // compressed offset of every block written, including the EOF block
+    std::vector<uint64_t> block_offsets_;
+
+    // blocks in file order, the front is written as soon as it is compressed
+    std::deque<std::shared_ptr<Block>> queue_;
+    size_t next_job_;
+    std::mutex lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+    std::vector<std::thread> workers_;
+};
+
+#endif // KALLISTO_BGZFWRITER_H
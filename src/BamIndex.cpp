@@ -0,0 +1,183 @@
+#include "BamIndex.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <fstream>
+
+#include "BGZFWriter.h"
+
+const uint64_t BamIndex::UNSET;
+
+static void put_u32(std::string& out, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back((char) ((x >> (8*i)) & 0xff));
+  }
+}
+
+static void put_u64(std::string& out, uint64_t x) {
+  for (int i = 0; i < 8; i++) {
+    out.push_back((char) ((x >> (8*i)) & 0xff));
+  }
+}
+
+BamIndex::BamIndex(const std::vector<int>& ref_lens) :
+  csi_(false), min_shift_(14), depth_(5), refs_(ref_lens.size()), n_no_coor_(0) {
+  int64_t max_len = 0;
+  for (auto l : ref_lens) {
+    max_len = std::max(max_len, (int64_t) l);
+  }
+  // BAI addresses at most 2^29 bases, go to CSI with a deeper binning
+  // scheme for anything longer
+  if (max_len >= (1LL << 29)) {
+    csi_ = true;
+    while ((1LL << (min_shift_ + 3*depth_)) <= max_len) {
+      ++depth_;
+    }
+  }
+}
+
+int BamIndex::reg2bin(int beg, int end) const {
+  int l, s = min_shift_, t = ((1 << depth_*3) - 1) / 7;
+  for (--end, l = depth_; l > 0; --l, s += 3, t -= 1 << l*3) {
+    if (beg >> s == end >> s) {
+      return t + (beg >> s);
+    }
+  }
+  return 0;
+}
+
+int BamIndex::binFirstPos(uint32_t bin) const {
+  int l = 0;
+  uint32_t t = 0;
+  // find the level of the bin, level l starts at bin ((1<<3l)-1)/7
+  while (l < depth_ && bin >= (uint32_t) (((1 << 3*(l+1)) - 1) / 7)) {
+    ++l;
+  }
+  t = ((1 << 3*l) - 1) / 7;
+  return (bin - t) << (min_shift_ + 3*(depth_ - l));
+}
+
+void BamIndex::add(int ref, int beg, int end, bool mapped, uint64_t voff_beg, uint64_t voff_end) {
+  if (ref < 0) {
+    ++n_no_coor_;
+    return;
+  }
+  assert(ref < refs_.size());
+  if (end <= beg) {
+    end = beg + 1;
+  }
+
+  auto& r = refs_[ref];
+  if (!r.used) {
+    r.used = true;
+    r.off_beg = voff_beg;
+  }
+  r.off_end = voff_end;
+  if (mapped) {
+    ++r.n_mapped;
+  } else {
+    ++r.n_unmapped;
+  }
+
+  auto& chunks = r.bins[reg2bin(beg, end)];
+  // records in the same block are read together anyway, extend the chunk
+  if (!chunks.empty() && (chunks.back().second >> 16) == (voff_beg >> 16)) {
+    chunks.back().second = voff_end;
+  } else {
+    chunks.push_back({voff_beg, voff_end});
+  }
+
+  int w_beg = beg >> min_shift_;
+  int w_end = (end - 1) >> min_shift_;
+  if (r.linear.size() <= w_end) {
+    r.linear.resize(w_end + 1, UNSET);
+  }
+  for (int w = w_beg; w <= w_end; w++) {
+    if (r.linear[w] == UNSET) {
+      r.linear[w] = voff_beg;
+    }
+  }
+}
+
+std::string BamIndex::write(const std::string& bamfn) const {
+  std::string out;
+  if (csi_) {
+    out.append("CSI\1", 4);
+    put_u32(out, min_shift_);
+    put_u32(out, depth_);
+    put_u32(out, 0); // no auxiliary data
+  } else {
+    out.append("BAI\1", 4);
+  }
+  put_u32(out, refs_.size());
+
+  uint32_t pseudo_bin = ((1 << (3*depth_ + 3)) - 1) / 7 + 1;
+  for (auto& r : refs_) {
+    // the linear index covers gaps with the previous offset
+    std::vector<uint64_t> linear = r.linear;
+    uint64_t prev = 0;
+    for (auto& x : linear) {
+      if (x == UNSET) {
+        x = prev;
+      }
+      prev = x;
+    }
+
+    put_u32(out, r.bins.size() + (r.used ? 1 : 0));
+    for (auto& b : r.bins) {
+      put_u32(out, b.first);
+      if (csi_) {
+        size_t w = binFirstPos(b.first) >> min_shift_;
+        put_u64(out, (w < linear.size()) ? linear[w] : r.off_end);
+      }
+      put_u32(out, b.second.size());
+      for (auto& c : b.second) {
+        put_u64(out, c.first);
+        put_u64(out, c.second);
+      }
+    }
+    if (r.used) {
+      put_u32(out, pseudo_bin);
+      if (csi_) {
+        put_u64(out, 0);
+      }
+      put_u32(out, 2);
+      put_u64(out, r.off_beg);
+      put_u64(out, r.off_end);
+      put_u64(out, r.n_mapped);
+      put_u64(out, r.n_unmapped);
+    }
+
+    if (!csi_) {
+      put_u32(out, linear.size());
+      for (auto x : linear) {
+        put_u64(out, x);
+      }
+    }
+  }
+  put_u64(out, n_no_coor_);
+
+  // BAI is stored as is, CSI is BGZF compressed
+  std::string fn = bamfn + (csi_ ? ".csi" : ".bai");
+  if (csi_) {
+    BGZFWriter bgzf;
+    if (!bgzf.open(fn, 1)) {
+      return "";
+    }
+    bgzf.write(out.data(), out.size());
+    if (!bgzf.close()) {
+      return "";
+    }
+  } else {
+    std::ofstream of(fn, std::ios::out | std::ios::binary);
+    if (!of.is_open()) {
+      return "";
+    }
+    of.write(out.data(), out.size());
+    of.close();
+    if (!of.good()) {
+      return "";
+    }
+  }
+  return fn;
+}
@@ -0,0 +1,68 @@
+#ifndef KALLISTO_BAMINDEX_H
+#define KALLISTO_BAMINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Builds a BAI index, or a CSI index when a reference is too long for BAI,
+// from the records of a coordinate sorted BAM file as they are written.
+class BamIndex {
+  public:
+    BamIndex(const std::vector<int>& ref_lens);
+
+    // beg and end are 0-based, end exclusive. voff_beg and voff_end are the
+    // virtual offsets of the start and end of the record
+    void add(int ref, int beg, int end, bool mapped, uint64_t voff_beg, uint64_t voff_end);
+    // rewrites every stored offset with f, e.g. BGZFWriter::virtualOffset
+    template <typename F>
+    void remap(F f);
+
+    bool isCSI() const { return csi_; }
+    // writes <bamfn>.bai or <bamfn>.csi, returns the name of the file
+    std::string write(const std::string& bamfn) const;
+
+    // linear index entries not covered by any record
+    static const uint64_t UNSET = UINT64_MAX;
+
+  private:
+    struct RefIndex {
+      std::map<uint32_t, std::vector<std::pair<uint64_t, uint64_t>>> bins;
+      std::vector<uint64_t> linear;
+      uint64_t off_beg = 0, off_end = 0;
+      uint64_t n_mapped = 0, n_unmapped = 0;
+      bool used = false;
+    };
+
+    int reg2bin(int beg, int end) const;
+    int binFirstPos(uint32_t bin) const;
+
+    bool csi_;
+    int min_shift_;
+    int depth_;
+    std::vector<RefIndex> refs_;
+    uint64_t n_no_coor_;
+};
+
+template <typename F>
+void BamIndex::remap(F f) {
+  for (auto& r : refs_) {
+    for (auto& b : r.bins) {
+      for (auto& c : b.second) {
+        c.first = f(c.first);
+        c.second = f(c.second);
+      }
+    }
+    for (auto& x : r.linear) {
+      if (x != UNSET) {
+        x = f(x);
+      }
+    }
+    r.off_beg = f(r.off_beg);
+    r.off_end = f(r.off_end);
+  }
+}
+
+#endif // KALLISTO_BAMINDEX_H
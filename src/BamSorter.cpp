@@ -0,0 +1,338 @@
+#include "BamSorter.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <queue>
+
+#include <zlib.h>
+
+#include "BGZFWriter.h"
+#include "BamIndex.h"
+
+static int32_t get_i32(const char* p) {
+  uint32_t x = 0;
+  for (int i = 0; i < 4; i++) {
+    x |= ((uint32_t) (unsigned char) p[i]) << (8*i);
+  }
+  return (int32_t) x;
+}
+
+static uint16_t get_u16(const char* p) {
+  return (uint16_t) ((unsigned char) p[0] | ((unsigned char) p[1] << 8));
+}
+
+// records without a target (refID -1) sort last, as in samtools
+static uint64_t sortKey(const char* rec) {
+  uint32_t ref = (uint32_t) get_i32(rec + 4);
+  uint32_t pos = (uint32_t) (get_i32(rec + 8) + 1);
+  return ((uint64_t) ref << 32) | pos;
+}
+
+static size_t recordSize(const char* rec) {
+  return 4 + get_i32(rec);
+}
+
+// write one record to the output and add it to the index
+static void writeRecord(BGZFWriter& out, BamIndex& index, const char* rec) {
+  int32_t ref = get_i32(rec + 4);
+  int32_t beg = get_i32(rec + 8);
+  int l_name = (unsigned char) rec[12];
+  int ncig = get_u16(rec + 16);
+  uint16_t flag = get_u16(rec + 18);
+
+  int span = 0;
+  const char* cig = rec + 36 + l_name;
+  for (int i = 0; i < ncig; i++) {
+    uint32_t c = (uint32_t) get_i32(cig + 4*i);
+    int op = c & 0xf;
+    if (op == 0 || op == 2 || op == 3 || op == 7 || op == 8) {
+      span += c >> 4;
+    }
+  }
+
+  uint64_t voff_beg = out.tell();
+  out.write(rec, recordSize(rec));
+  index.add(ref, beg, beg + ((span > 0) ? span : 1), (flag & 0x4) == 0, voff_beg, out.tell());
+}
+
+static void sortRun(const std::string& run, std::vector<size_t>& offsets) {
+  const char* base = run.data();
+  std::stable_sort(offsets.begin(), offsets.end(), [base](size_t a, size_t b) {
+    return sortKey(base + a) < sortKey(base + b);
+  });
+}
+
+BamSorter::~BamSorter() {
+  if (primed_) {
+    close();
+  }
+}
+
+bool BamSorter::open(const std::string& fname, const std::string& header,
+    const std::vector<int>& ref_lens, int num_threads, size_t max_run_bytes) {
+  fname_ = fname;
+  header_ = header;
+  ref_lens_ = ref_lens;
+  num_threads_ = num_threads;
+  max_run_bytes_ = max_run_bytes;
+  run_.clear();
+  offsets_.clear();
+  spill_ok_ = true;
+  run_files_.clear();
+  num_runs_ = 0;
+  num_tmp_ = 0;
+  index_fname_.clear();
+
+  // fail early rather than after sorting everything
+  FILE* f = fopen(fname_.c_str(), "wb");
+  if (f == nullptr) {
+    return false;
+  }
+  fclose(f);
+  primed_ = true;
+  return true;
+}
+
+void BamSorter::add(const char* data, size_t len) {
+  assert(primed_);
+  size_t pos = 0;
+  while (pos < len) {
+    offsets_.push_back(run_.size() + pos);
+    pos += recordSize(data + pos);
+  }
+  assert(pos == len);
+  run_.append(data, len);
+
+  // two runs are in memory at a time, the one filling and the one spilling
+  if (run_.size() + offsets_.size() * sizeof(size_t) >= max_run_bytes_ / 2) {
+    startSpill();
+  }
+}
+
+// sorts run and writes it to fn, clears run and offsets for reuse
+bool BamSorter::spillRun(std::string& run, std::vector<size_t>& offsets, const std::string& fn) {
+  sortRun(run, offsets);
+
+  BGZFWriter tmp;
+  // the runs are read back once, favor speed over size
+  bool ok = tmp.open(fn, num_threads_, 1);
+  if (ok) {
+    for (auto off : offsets) {
+      const char* rec = run.data() + off;
+      tmp.write(rec, recordSize(rec));
+    }
+    ok = tmp.close();
+  }
+  if (!ok) {
+    std::remove(fn.c_str());
+  }
+  run.clear();
+  offsets.clear();
+  return ok;
+}
+
+void BamSorter::startSpill() {
+  if (!waitSpill()) {
+    std::cerr << "Error: could not write temporary file for sorting " << fname_ << std::endl;
+    exit(1);
+  }
+  run_.swap(spill_run_);
+  offsets_.swap(spill_offsets_);
+  // the file name is taken here, so the runs stay in the order they filled
+  std::string fn = tmpName();
+  run_files_.push_back(fn);
+  ++num_runs_;
+  spill_thread_ = std::thread([this, fn]() {
+    spill_ok_ = spillRun(spill_run_, spill_offsets_, fn);
+  });
+}
+
+// false if the last spill failed
+bool BamSorter::waitSpill() {
+  if (spill_thread_.joinable()) {
+    spill_thread_.join();
+  }
+  return spill_ok_;
+}
+
+namespace {
+
+struct RunReader {
+  gzFile fp = nullptr;
+  std::string rec;
+  bool error = false; // the run ended in the middle of a record or is corrupt
+
+  // false at the end of the run, or on an error
+  bool next() {
+    char len[4];
+    int r = gzread(fp, len, 4);
+    if (r == 0) {
+      int err;
+      gzerror(fp, &err);
+      error = (err != Z_OK);
+      return false;
+    }
+    if (r != 4) {
+      error = true;
+      return false;
+    }
+    size_t n = get_i32(len);
+    rec.resize(4 + n);
+    std::copy(len, len + 4, &rec[0]);
+    if (gzread(fp, &rec[4], n) != (int) n) {
+      error = true;
+      return false;
+    }
+    return true;
+  }
+};
+
+// k-way merge of the runs in files, ties go to the earlier run to keep the
+// input order. Every record is handed to emit, false if a run could not be
+// read to its end
+bool mergeRuns(const std::vector<std::string>& files,
+    const std::function<void(const char*)>& emit) {
+  std::vector<RunReader> runs(files.size());
+  typedef std::pair<uint64_t, int> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  bool ok = true;
+  for (int i = 0; ok && i < runs.size(); i++) {
+    runs[i].fp = gzopen(files[i].c_str(), "rb");
+    if (runs[i].fp == nullptr) {
+      std::cerr << "Error: could not open temporary file " << files[i] << std::endl;
+      ok = false;
+      break;
+    }
+    gzbuffer(runs[i].fp, 1 << 17);
+    if (runs[i].next()) {
+      heap.push({sortKey(runs[i].rec.data()), i});
+    }
+    ok = !runs[i].error;
+  }
+  while (ok && !heap.empty()) {
+    int i = heap.top().second;
+    heap.pop();
+    emit(runs[i].rec.data());
+    if (runs[i].next()) {
+      heap.push({sortKey(runs[i].rec.data()), i});
+    }
+    ok = !runs[i].error;
+  }
+  for (int i = 0; i < runs.size(); i++) {
+    if (runs[i].fp != nullptr) {
+      gzclose(runs[i].fp);
+    }
+    if (runs[i].error) {
+      std::cerr << "Error: temporary file " << files[i] << " is truncated or corrupt" << std::endl;
+    }
+  }
+  return ok;
+}
+
+}
+
+std::string BamSorter::tmpName() {
+  return fname_ + ".tmp." + std::to_string(num_tmp_++);
+}
+
+bool BamSorter::reduceRuns() {
+  // merge consecutive runs, so that ties still go to the earlier records
+  while (run_files_.size() > BAM_SORT_MAX_FANIN) {
+    std::vector<std::string> merged;
+    for (size_t i = 0; i < run_files_.size(); i += BAM_SORT_MAX_FANIN) {
+      std::vector<std::string> group(run_files_.begin() + i,
+        run_files_.begin() + std::min(i + BAM_SORT_MAX_FANIN, run_files_.size()));
+      if (group.size() == 1) {
+        merged.push_back(group[0]);
+        continue;
+      }
+      std::string fn = tmpName();
+      BGZFWriter tmp;
+      bool ok = tmp.open(fn, num_threads_, 1);
+      if (ok) {
+        ok = mergeRuns(group, [&tmp](const char* rec) { tmp.write(rec, recordSize(rec)); });
+        ok = tmp.close() && ok;
+      }
+      if (!ok) {
+        std::remove(fn.c_str());
+        // what is left on disk, for removeRuns
+        merged.insert(merged.end(), run_files_.begin() + i, run_files_.end());
+        run_files_.swap(merged);
+        return false;
+      }
+      for (auto& f : group) {
+        std::remove(f.c_str());
+      }
+      merged.push_back(fn);
+    }
+    run_files_.swap(merged);
+  }
+  return true;
+}
+
+void BamSorter::removeRuns() {
+  for (auto& fn : run_files_) {
+    std::remove(fn.c_str());
+  }
+}
+
+bool BamSorter::close() {
+  if (!primed_) {
+    return true;
+  }
+  primed_ = false;
+
+  bool in_memory = run_files_.empty();
+  if (!in_memory) {
+    bool ok = waitSpill();
+    if (ok && !offsets_.empty()) {
+      std::string fn = tmpName();
+      run_files_.push_back(fn);
+      ++num_runs_;
+      ok = spillRun(run_, offsets_, fn);
+    }
+    std::string().swap(run_);
+    std::vector<size_t>().swap(offsets_);
+    std::string().swap(spill_run_);
+    std::vector<size_t>().swap(spill_offsets_);
+    if (!ok || !reduceRuns()) {
+      removeRuns();
+      return false;
+    }
+  }
+
+  BGZFWriter out;
+  if (!out.open(fname_, num_threads_)) {
+    removeRuns();
+    return false;
+  }
+  out.write(header_.data(), header_.size());
+  BamIndex index(ref_lens_);
+
+  if (in_memory) {
+    sortRun(run_, offsets_);
+    for (auto off : offsets_) {
+      writeRecord(out, index, run_.data() + off);
+    }
+  } else {
+    bool ok = mergeRuns(run_files_, [&out, &index](const char* rec) { writeRecord(out, index, rec); });
+    removeRuns();
+    if (!ok) {
+      // don't leave a sorted file behind that looks complete
+      out.close();
+      std::remove(fname_.c_str());
+      return false;
+    }
+  }
+  if (!out.close()) {
+    return false;
+  }
+
+  index.remap([&out](uint64_t v) { return out.virtualOffset(v); });
+  index_fname_ = index.write(fname_);
+  return !index_fname_.empty();
+}
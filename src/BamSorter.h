@@ -0,0 +1,71 @@
+#ifndef KALLISTO_BAMSORTER_H
+#define KALLISTO_BAMSORTER_H
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// default memory for the records kept in memory, shared by the run being
+// filled and the run being spilled
+const size_t BAM_SORT_RUN_BYTES = 1ULL << 28;
+// runs merged at once, every one holds a file descriptor and a buffer
+const size_t BAM_SORT_MAX_FANIN = 64;
+
+// Coordinate sorts BAM records into an indexed BAM file. Records are kept
+// in memory until half of max_run_bytes, each full run is sorted and spilled
+// to a temporary BGZF file next to the output by a background thread while
+// the next run fills, and the runs are merged when the sorter is closed. More than BAM_SORT_MAX_FANIN runs are first merged in
+// groups into longer runs. Records with equal coordinates keep the order
+// they were added in.
+class BamSorter {
+  public:
+    BamSorter() : primed_(false), num_runs_(0), num_tmp_(0), spill_ok_(true) {}
+    ~BamSorter();
+
+    // header is the binary BAM header, ref_lens the target lengths
+    bool open(const std::string& fname, const std::string& header,
+        const std::vector<int>& ref_lens, int num_threads,
+        size_t max_run_bytes = BAM_SORT_RUN_BYTES);
+
+    // data holds one or more complete BAM records, only waits for a spill
+    // when the previous run is still being written
+    void add(const char* data, size_t len);
+
+    // writes the sorted BAM file and its index, returns false on I/O errors
+    bool close();
+
+    // the runs spilled while adding records
+    int numRuns() const { return num_runs_; }
+    const std::string& indexFile() const { return index_fname_; }
+
+  private:
+    bool spillRun(std::string& run, std::vector<size_t>& offsets, const std::string& fn);
+    void startSpill();
+    bool waitSpill();
+    bool reduceRuns();
+    void removeRuns();
+    std::string tmpName();
+
+    bool primed_;
+    std::string fname_;
+    std::string header_;
+    std::vector<int> ref_lens_;
+    int num_threads_;
+    size_t max_run_bytes_;
+
+    std::string run_;
+    std::vector<size_t> offsets_;
+    // the full run handed to spill_thread_
+    std::string spill_run_;
+    std::vector<size_t> spill_offsets_;
+    std::thread spill_thread_;
+    bool spill_ok_;
+    // the runs on disk, in the order their records were added
+    std::vector<std::string> run_files_;
+    int num_runs_;
+    int num_tmp_;
+    std::string index_fname_;
+};
+
+#endif // KALLISTO_BAMSORTER_H
@@ -0,0 +1,151 @@
+#include "BatchMatrixWriter.h"
+
+#include <cstdio>
+#include <iostream>
+
+// entries of the HDF5 matrix buffered before they are appended
+static const size_t H5_BUFFER_SIZE = 1 << 20;
+static const hsize_t H5_CHUNK_SIZE = 1 << 16;
+// room for three 64 bit numbers and the spaces between them
+static const size_t MTX_SIZE_LINE_WIDTH = 3 * 20 + 2;
+
+BatchMatrixWriter::~BatchMatrixWriter() {
+  if (primed_) {
+    // never closed, don't leave a matrix without its size behind
+    body_.close();
+    std::remove((prefix_ + ".mtx").c_str());
+    if (h5_) {
+      H5Dclose(indptr_id_);
+      H5Dclose(indices_id_);
+      H5Dclose(data_id_);
+      H5Gclose(group_id_);
+      H5Fclose(file_id_);
+    }
+  }
+}
+
+bool BatchMatrixWriter::open(const std::string& prefix, const std::vector<std::string>& ids,
+    bool h5, uint compression) {
+  prefix_ = prefix;
+  num_cells_ = ids.size();
+  cell_ = 0;
+  nnz_ = 0;
+
+  // write cell ids, one line per id
+  std::ofstream cellsof((prefix + ".cells").c_str(), std::ios::out);
+  if (!cellsof.is_open()) {
+    return false;
+  }
+  for (const auto& id : ids) {
+    cellsof << id << "\n";
+  }
+  cellsof.close();
+
+  body_.open((prefix + ".mtx").c_str(), std::ios::out | std::ios::binary);
+  if (!body_.is_open()) {
+    return false;
+  }
+  body_ << "%%MatrixMarket matrix coordinate integer general\n"
+        << "%\n";
+  size_line_ = body_.tellp();
+  body_ << std::string(MTX_SIZE_LINE_WIDTH, ' ') << "\n";
+
+  h5_ = h5;
+  if (h5_) {
+    file_id_ = H5Fcreate((prefix + ".h5").c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file_id_ < 0) {
+      body_.close();
+      std::remove((prefix + ".mtx").c_str());
+      return false;
+    }
+    group_id_ = H5Gcreate(file_id_, "/matrix", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    vector_to_h5(ids, group_id_, "cells", true, compression);
+    // row j holds indices[indptr[j]] .. indices[indptr[j+1]-1]
+    indptr_id_ = create_extendable_h5<int64_t>(group_id_, "indptr", H5_CHUNK_SIZE, compression);
+    indices_id_ = create_extendable_h5<int>(group_id_, "indices", H5_CHUNK_SIZE, compression);
+    data_id_ = create_extendable_h5<int>(group_id_, "data", H5_CHUNK_SIZE, compression);
+    indptr_.assign(1, 0);
+  }
+
+  primed_ = true;
+  return true;
+}
+
+void BatchMatrixWriter::write(const std::vector<std::pair<int, int>>& counts) {
+  assert(primed_);
+  assert(cell_ < num_cells_);
+  ++cell_;
+  for (const auto& x : counts) {
+    body_ << cell_ << " " << (x.first+1) << " " << x.second << "\n";
+  }
+  nnz_ += counts.size();
+
+  if (h5_) {
+    for (const auto& x : counts) {
+      indices_.push_back(x.first);
+      data_.push_back(x.second);
+    }
+    indptr_.push_back(nnz_);
+    if (indices_.size() >= H5_BUFFER_SIZE || indptr_.size() >= H5_BUFFER_SIZE) {
+      flushH5();
+    }
+  }
+}
+
+void BatchMatrixWriter::flushH5() {
+  append_to_h5(indptr_id_, indptr_);
+  append_to_h5(indices_id_, indices_);
+  append_to_h5(data_id_, data_);
+  indptr_.clear();
+  indices_.clear();
+  data_.clear();
+}
+
+bool BatchMatrixWriter::close(const KmerIndex& index) {
+  if (!primed_) {
+    return false;
+  }
+  primed_ = false;
+  assert(cell_ == num_cells_);
+
+  std::ofstream ecof((prefix_ + ".ec").c_str(), std::ios::out);
+  // output equivalence classes in the form "EC TXLIST";
+  for (int i = 0; i < index.ecmap.size(); i++) {
+    ecof << i << "\t";
+    // output the rest of the class
+    const auto &v = index.ecmap[i];
+    bool first = true;
+    for (auto x : v) {
+      if (!first) {
+        ecof << ",";
+      } else {
+        first = false;
+      }
+      ecof << x;
+    }
+    ecof << "\n";
+  }
+  ecof.close();
+
+  // fill in the size line, the rest of it stays blank
+  std::string size = std::to_string(num_cells_) + " " + std::to_string(index.ecmap.size())
+    + " " + std::to_string(nnz_);
+  body_.seekp(size_line_);
+  body_ << size;
+  // a full disk while the entries were streamed shows up here, or when
+  // closing flushes the rest
+  body_.close();
+  bool ok = body_.good() && ecof.good();
+
+  if (h5_) {
+    flushH5();
+    std::vector<int64_t> shape {(int64_t) num_cells_, (int64_t) index.ecmap.size()};
+    vector_to_h5(shape, group_id_, "shape", false);
+    H5Dclose(indptr_id_);
+    H5Dclose(indices_id_);
+    H5Dclose(data_id_);
+    H5Gclose(group_id_);
+    H5Fclose(file_id_);
+  }
+  return ok;
+}
@@ -0,0 +1,59 @@
+#ifndef KALLISTO_BATCHMATRIXWRITER_H
+#define KALLISTO_BATCHMATRIXWRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "h5utils.h"
+#include "KmerIndex.h"
+
+// Writes the cells x ECs counts of batch mode one cell at a time, so only
+// the cell being written is held in memory. Produces prefix.cells,
+// prefix.mtx (Matrix Market, both indices 1-based, the size line padded
+// with spaces as it is only filled in at close) and, at close, prefix.ec. With h5 the counts also go to prefix.h5 as a compressed CSR
+// matrix under /matrix (shape, indptr, indices, data, cells)
+class BatchMatrixWriter {
+  public:
+    BatchMatrixWriter() : primed_(false), h5_(false) {}
+    ~BatchMatrixWriter();
+
+    bool open(const std::string& prefix, const std::vector<std::string>& ids,
+        bool h5, uint compression = 6);
+
+    // counts of the next cell as (ec, count) pairs sorted by ec, cells have
+    // to be written in the order of ids
+    void write(const std::vector<std::pair<int, int>>& counts);
+
+    // writes the equivalence classes, which may have grown while the cells
+    // were written, and finishes the matrix
+    bool close(const KmerIndex& index);
+
+  private:
+    void flushH5();
+
+    bool primed_;
+    bool h5_;
+    std::string prefix_;
+    size_t num_cells_;
+    size_t cell_;
+    size_t nnz_;
+
+    // the entries are written behind a blank size line, which is filled in
+    // once the number of ECs and entries are known
+    std::ofstream body_;
+    std::streampos size_line_;
+
+    hid_t file_id_;
+    hid_t group_id_;
+    hid_t indptr_id_;
+    hid_t indices_id_;
+    hid_t data_id_;
+    std::vector<int64_t> indptr_;
+    std::vector<int> indices_;
+    std::vector<int> data_;
+};
+
+#endif // KALLISTO_BATCHMATRIXWRITER_H
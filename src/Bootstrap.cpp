@@ -20,17 +20,20 @@ BootstrapThreadPool::BootstrapThreadPool(
     const std::vector<double>& eff_lens,
     const ProgramOptions& p_opts,
     H5Writer& h5writer,
+    BootstrapSummary& summary,
     const std::vector<double>& mean_fls
     ) :
   n_threads_(n_threads),
   seeds_(seeds),
   n_complete_(0),
+  next_id_(0),
   true_counts_(true_counts),
   index_(index),
   tc_(tc),
   eff_lens_(eff_lens),
   opt_(p_opts),
   writer_(h5writer),
+  summary_(summary),
   mean_fls_(mean_fls)
 {
   for (size_t i = 0; i < n_threads_; ++i) {
@@ -53,14 +56,15 @@ void BootstrapWorker::operator() (){
     {
       std::unique_lock<std::mutex> lock(pool_.seeds_mutex_);
 
-      if (pool_.seeds_.empty()) {
+      if (pool_.next_id_ >= pool_.seeds_.size()) {
         // no more bootstraps to perform, this thread is done
         return;
       }
 
-      cur_id = pool_.seeds_.size() - 1;
-      cur_seed = pool_.seeds_.back();
-      pool_.seeds_.pop_back();
+      // hand out in increasing order so a BootstrapSummary has to buffer
+      // at most a few replicates
+      cur_id = pool_.next_id_++;
+      cur_seed = pool_.seeds_[cur_id];
       // std::cout << "cur seed from thread (" << thread_id_ << "): " <<
       //   cur_seed <<  " id: " << cur_id << std::endl;
     } // release lock
@@ -74,7 +78,12 @@ void BootstrapWorker::operator() (){
 
     auto res = bs.run_em();
 
-    if (!pool_.opt_.plaintext) {
+    if (pool_.opt_.bootstrap_summary) {
+      std::unique_lock<std::mutex> lock(pool_.write_lock_);
+      ++pool_.n_complete_;
+      std::cerr << "[bstrp] number of EM bootstraps complete: " << pool_.n_complete_ << "\r";
+      pool_.summary_.add(cur_id, res.alpha_);
+    } else if (!pool_.opt_.plaintext) {
       std::unique_lock<std::mutex> lock(pool_.write_lock_);
       ++pool_.n_complete_;
       std::cerr << "[bstrp] number of EM bootstraps complete: " << pool_.n_complete_ << "\r";
@@ -10,6 +10,7 @@
 #include "EMAlgorithm.h"
 #include "Multinomial.hpp"
 #include "H5Writer.h"
+#include "BootstrapSummary.h"
 
 class Bootstrap {
     // needs:
@@ -62,6 +63,7 @@ class BootstrapThreadPool {
         const std::vector<double>& eff_lens,
         const ProgramOptions& p_opts,
         H5Writer& h5writer,
+        BootstrapSummary& summary,
         const std::vector<double>& mean_fls
         );
 
@@ -77,6 +79,7 @@ class BootstrapThreadPool {
     std::mutex write_lock_;
 
     size_t n_complete_;
+    size_t next_id_;
 
     // things to run bootstrap
     const std::vector<int> true_counts_;
@@ -85,6 +88,7 @@ class BootstrapThreadPool {
     const std::vector<double>& eff_lens_;
     const ProgramOptions& opt_;
     H5Writer& writer_;
+    BootstrapSummary& summary_;
     const std::vector<double>& mean_fls_;
 };
 
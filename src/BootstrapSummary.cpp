@@ -0,0 +1,166 @@
+#include "BootstrapSummary.h"
+
+#include <algorithm>
+#include <assert.h>
+
+const std::vector<double> BootstrapSummary::quantile_probs {0.025, 0.5, 0.975};
+const std::vector<std::string> BootstrapSummary::quantile_names {"q025", "q500", "q975"};
+
+void P2Quantile::add(double x) {
+  if (count_ < 5) {
+    q_[count_++] = x;
+    if (count_ == 5) {
+      std::sort(q_, q_ + 5);
+      for (int i = 0; i < 5; i++) {
+        n_[i] = i + 1;
+      }
+    }
+    return;
+  }
+
+  // find the cell containing x, extending the extremes if needed
+  int k;
+  if (x < q_[0]) {
+    q_[0] = x;
+    k = 0;
+  } else if (x >= q_[4]) {
+    q_[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while (x >= q_[k+1]) {
+      k++;
+    }
+  }
+
+  for (int i = k + 1; i < 5; i++) {
+    n_[i]++;
+  }
+  count_++;
+
+  // desired marker positions after count_ observations
+  double c = count_ - 1;
+  double np[5] = {1.0, 1.0 + c*p_/2.0, 1.0 + c*p_, 1.0 + c*(1.0+p_)/2.0,
+    static_cast<double>(count_)};
+
+  for (int i = 1; i < 4; i++) {
+    double d = np[i] - n_[i];
+    if ((d >= 1.0 && n_[i+1] - n_[i] > 1) || (d <= -1.0 && n_[i-1] - n_[i] < -1)) {
+      int s = (d >= 0.0) ? 1 : -1;
+      double qp = parabolic(i, s);
+      if (q_[i-1] < qp && qp < q_[i+1]) {
+        q_[i] = qp;
+      } else {
+        q_[i] = linear(i, s);
+      }
+      n_[i] += s;
+    }
+  }
+}
+
+double P2Quantile::parabolic(int i, int d) const {
+  return q_[i] + static_cast<double>(d) / (n_[i+1] - n_[i-1]) *
+    ((n_[i] - n_[i-1] + d) * (q_[i+1] - q_[i]) / (n_[i+1] - n_[i]) +
+     (n_[i+1] - n_[i] - d) * (q_[i] - q_[i-1]) / (n_[i] - n_[i-1]));
+}
+
+double P2Quantile::linear(int i, int d) const {
+  return q_[i] + d * (q_[i+d] - q_[i]) / (n_[i+d] - n_[i]);
+}
+
+double P2Quantile::get() const {
+  if (count_ >= 5) {
+    return q_[2];
+  }
+  if (count_ == 0) {
+    return 0.0;
+  }
+
+  // too few observations for the markers, interpolate exactly
+  double tmp[5];
+  std::copy(q_, q_ + count_, tmp);
+  std::sort(tmp, tmp + count_);
+  double pos = p_ * (count_ - 1);
+  int lo = static_cast<int>(pos);
+  if (lo + 1 >= count_) {
+    return tmp[count_ - 1];
+  }
+  return tmp[lo] + (pos - lo) * (tmp[lo+1] - tmp[lo]);
+}
+
+/**********************************************************************/
+
+void BootstrapSummary::init(size_t num_targets) {
+  primed_ = true;
+  n_ = 0;
+  next_id_ = 0;
+  mean_.assign(num_targets, 0.0);
+  m2_.assign(num_targets, 0.0);
+  sketch_.clear();
+  for (auto p : quantile_probs) {
+    sketch_.emplace_back(num_targets, P2Quantile(p));
+  }
+  pending_.clear();
+}
+
+void BootstrapSummary::add(int bs_id, const std::vector<double>& alpha) {
+  assert(primed_);
+  assert(alpha.size() == mean_.size());
+
+  if (bs_id != next_id_) {
+    pending_.insert({bs_id, alpha});
+    return;
+  }
+
+  fold(alpha);
+  ++next_id_;
+
+  // drain anything that was waiting on this replicate
+  auto it = pending_.begin();
+  while (it != pending_.end() && it->first == next_id_) {
+    fold(it->second);
+    ++next_id_;
+    it = pending_.erase(it);
+  }
+}
+
+void BootstrapSummary::fold(const std::vector<double>& alpha) {
+  ++n_;
+  for (size_t i = 0; i < alpha.size(); ++i) {
+    double x = alpha[i];
+    double delta = x - mean_[i];
+    mean_[i] += delta / n_;
+    m2_[i] += delta * (x - mean_[i]);
+  }
+
+  for (auto& sk : sketch_) {
+    for (size_t i = 0; i < alpha.size(); ++i) {
+      sk[i].add(alpha[i]);
+    }
+  }
+}
+
+std::vector<double> BootstrapSummary::variance() const {
+  assert(pending_.empty());
+  std::vector<double> var(m2_.size(), 0.0);
+  if (n_ > 1) {
+    for (size_t i = 0; i < m2_.size(); ++i) {
+      var[i] = m2_[i] / (n_ - 1);
+    }
+  }
+  return var;
+}
+
+std::vector<std::vector<double>> BootstrapSummary::quantiles() const {
+  assert(pending_.empty());
+  std::vector<std::vector<double>> res;
+  for (auto& sk : sketch_) {
+    std::vector<double> q;
+    q.reserve(sk.size());
+    for (auto& x : sk) {
+      q.push_back(x.get());
+    }
+    res.push_back(std::move(q));
+  }
+  return res;
+}
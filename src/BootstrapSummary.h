@@ -0,0 +1,64 @@
+#ifndef KALLISTO_BOOTSTRAPSUMMARY_H
+#define KALLISTO_BOOTSTRAPSUMMARY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// P^2 estimator (Jain & Chlamtac, 1985) for a single quantile. Keeps five
+// markers instead of every observation, so memory is constant in the number
+// of bootstraps.
+class P2Quantile {
+  public:
+    P2Quantile(double p = 0.5) : p_(p), count_(0) {}
+
+    void add(double x);
+    double get() const;
+
+  private:
+    double parabolic(int i, int d) const;
+    double linear(int i, int d) const;
+
+    double p_;
+    int count_;
+    double q_[5]; // marker heights
+    int n_[5]; // marker positions (1-based)
+};
+
+// Per-target streaming statistics of the bootstrap estimated counts:
+// Welford mean/variance and a P^2 sketch for a fixed set of quantiles.
+//
+// Replicates may finish out of order when bootstrapping on several threads,
+// they are buffered and folded in by id so the summary does not depend on
+// scheduling.
+class BootstrapSummary {
+  public:
+    BootstrapSummary() : primed_(false), n_(0), next_id_(0) {}
+
+    void init(size_t num_targets);
+
+    // bs_id must be 0, 1, 2, ... though not necessarily in that order
+    void add(int bs_id, const std::vector<double>& alpha);
+
+    int num_bootstrap() const { return n_; }
+    std::vector<double> variance() const;
+    std::vector<std::vector<double>> quantiles() const;
+
+    std::vector<double> mean_;
+
+    static const std::vector<double> quantile_probs;
+    static const std::vector<std::string> quantile_names;
+
+  private:
+    void fold(const std::vector<double>& alpha);
+
+    bool primed_;
+    int n_;
+    int next_id_;
+    std::vector<double> m2_;
+    // one sketch per target for each of quantile_probs
+    std::vector<std::vector<P2Quantile>> sketch_;
+    std::map<int, std::vector<double>> pending_;
+};
+
+#endif // KALLISTO_BOOTSTRAPSUMMARY_H
@@ -5,11 +5,14 @@
 #include "KmerIndex.h"
 #include "MinCollector.h"
 #include "weights.h"
+#include "RunStats.h"
 
 #include <algorithm>
 #include <numeric>
+#include <tuple>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <vector>
 
 // smallest weight we expect is ~10^-4
@@ -28,22 +31,36 @@ struct EMAlgorithm {
               const MinCollector& tc,
               const std::vector<double>& all_means,
               const ProgramOptions& opt) :
+    EMAlgorithm(counts, index, index.ecmap, tc, all_means, opt) {}
+
+  // uses ecmap instead of the ecmap of index, it has to start with the
+  // same single target classes
+  EMAlgorithm(const std::vector<int>& counts,
+              const KmerIndex& index,
+              const EcMap& ecmap,
+              const MinCollector& tc,
+              const std::vector<double>& all_means,
+              const ProgramOptions& opt) :
     index_(index),
     tc_(tc),
     num_trans_(index.target_names_.size()),
-    ecmap_(index.ecmap),
+    ecmap_(ecmap),
     counts_(counts),
     target_names_(index.target_names_),
     post_bias_(4096,1.0),
     alpha_(num_trans_, 1.0/num_trans_), // uniform distribution over targets
     rho_(num_trans_, 0.0),
     rho_set_(false),
+    bias_wall_(0.0),
+    bias_cpu_(0.0),
+    bias_updates_(0),
+    num_rounds_(0),
     all_fl_means(all_means),
     opt(opt)
   {
     assert(all_fl_means.size() == index_.target_lens_.size());
     eff_lens_ = calc_eff_lens(index_.target_lens_, all_fl_means);
-    weight_map_ = calc_weights (tc_.counts, ecmap_, eff_lens_);
+    compute_weights();
     for (size_t i = 0; i < alpha_.size(); i++) {
       if (counts_[i] > 0) {
         alpha_[i] = counts_[i];
@@ -59,10 +76,13 @@ struct EMAlgorithm {
 
   void run(size_t n_iter = 10000, size_t min_rounds=50, bool verbose = true, bool recomputeEffLen = true) {
     std::vector<double> next_alpha(alpha_.size(), 0.0);
+    std::vector<float> alpha_float;
+    if (opt.single_precision) {
+      alpha_float.resize(alpha_.size());
+    }
 
     assert(weight_map_.size() <= counts_.size());
 
-    double denom;
     const double alpha_limit = 1e-7;
     const double alpha_change_limit = 1e-2;
     const double alpha_change = 1e-2;
@@ -72,11 +92,31 @@ struct EMAlgorithm {
       std::cerr << "[   em] quantifying the abundances ..."; std::cerr.flush();
     }
 
+    // built on first use, the bias windows don't change during the run
+    HexamerTable hexamers;
+
     int i;
     for (i = 0; i < n_iter; ++i) {
       if (recomputeEffLen && (i == min_rounds || i == min_rounds + 500)) {
-        eff_lens_ = update_eff_lens(all_fl_means, tc_, index_, alpha_, eff_lens_, post_bias_, opt);
-        weight_map_ = calc_weights (tc_.counts, ecmap_, eff_lens_);
+        double wall = wall_seconds();
+        double cpu = process_cpu_seconds();
+        if (opt.profile && !bias_perf_) {
+          bias_perf_ = std::make_shared<PerfCounters>();
+        }
+        if (bias_perf_) {
+          bias_perf_->start();
+        }
+        if (!hexamers.built) {
+          hexamers = build_hexamer_table(all_fl_means, index_, opt);
+        }
+        eff_lens_ = update_eff_lens(all_fl_means, tc_, index_, hexamers, alpha_, eff_lens_, post_bias_, opt);
+        compute_weights();
+        if (bias_perf_) {
+          bias_perf_->stop();
+        }
+        bias_wall_ += wall_seconds() - wall;
+        bias_cpu_ += process_cpu_seconds() - cpu;
+        ++bias_updates_;
       }
 
 
@@ -85,43 +125,7 @@ struct EMAlgorithm {
         next_alpha[ec] = counts_[ec];
       }
 
-
-      for (int ec = num_trans_; ec < ecmap_.size();  ec++) {
-        denom = 0.0;
-
-        if (counts_[ec] == 0) {
-          continue;
-        }
-
-        // first, compute the denominator: a normalizer
-        // iterate over targets in EC map
-        auto& wv = weight_map_[ec];
-
-        // everything in ecmap should be in weight_map
-        //assert( w_search != weight_map_.end() );
-        //assert( w_search->second.size() == ec_kv.second.size() );
-
-        // wv is weights vector
-        // v is ec vector
-
-        auto& v = ecmap_[ec]; //ecmap_.find(ec)->second;
-        auto numEC = v.size();
-
-        for (auto t_it = 0; t_it < numEC; ++t_it) {
-          denom += alpha_[v[t_it]] * wv[t_it];
-        }
-
-        if (denom < TOLERANCE) {
-          continue;
-        }
-
-        // compute the update step
-        auto countNorm = counts_[ec] / denom;
-        for (auto t_it = 0; t_it < numEC; ++t_it) {
-          next_alpha[v[t_it]] +=  (wv[t_it] * alpha_[v[t_it]]) * countNorm;
-        }
-
-      }
+      e_step(alpha_float, next_alpha);
 
       // TODO: check for relative difference for convergence in EM
 
@@ -185,6 +189,8 @@ struct EMAlgorithm {
       }
     }
 
+    num_rounds_ = i;
+
     if (verbose) {
       std::cerr << " done" << std::endl;
       std::cerr << "[   em] the Expectation-Maximization algorithm ran for "
@@ -195,6 +201,75 @@ struct EMAlgorithm {
 
   }
 
+  // add the expected counts from all multi-target ECs to next_alpha, in
+  // the precision of the weights. alpha_float holds the single precision
+  // copy of alpha_, it is only used with --single-precision
+  void e_step(std::vector<float>& alpha_float, std::vector<double>& next_alpha) const {
+    if (opt.single_precision) {
+      for (int ec = 0; ec < num_trans_; ec++) {
+        alpha_float[ec] = static_cast<float>(alpha_[ec]);
+      }
+      const auto& wm = weight_map_float_;
+      e_step([&wm](int ec) {
+          auto off = wm.offsets[ec];
+          return std::make_tuple(wm.ids.data() + off, wm.weights.data() + off,
+            wm.offsets[ec+1] - off);
+        }, alpha_float, next_alpha);
+    } else {
+      e_step([this](int ec) {
+          return std::make_tuple(ecmap_[ec].data(), weight_map_[ec].data(),
+            ecmap_[ec].size());
+        }, alpha_, next_alpha);
+    }
+  }
+
+  // members(ec) returns {targets, weights, size} for ec. alpha may be
+  // stored in single precision but products and sums are done in double
+  template <typename T, typename M>
+  void e_step(M members, const std::vector<T>& alpha,
+      std::vector<double>& next_alpha) const {
+    double denom;
+
+    for (int ec = num_trans_; ec < ecmap_.size();  ec++) {
+      denom = 0.0;
+
+      if (counts_[ec] == 0) {
+        continue;
+      }
+
+      // first, compute the denominator: a normalizer
+      // iterate over targets in EC map
+      // v is ec vector, wv is weights vector
+      auto m = members(ec);
+      auto v = std::get<0>(m);
+      auto wv = std::get<1>(m);
+      auto numEC = std::get<2>(m);
+
+      for (auto t_it = 0; t_it < numEC; ++t_it) {
+        denom += static_cast<double>(alpha[v[t_it]]) * wv[t_it];
+      }
+
+      if (denom < TOLERANCE) {
+        continue;
+      }
+
+      // compute the update step
+      auto countNorm = counts_[ec] / denom;
+      for (auto t_it = 0; t_it < numEC; ++t_it) {
+        next_alpha[v[t_it]] += (static_cast<double>(wv[t_it]) * alpha[v[t_it]]) * countNorm;
+      }
+    }
+  }
+
+  // only the weights for the selected precision are kept
+  void compute_weights() {
+    if (opt.single_precision) {
+      weight_map_float_ = calc_weights_float(tc_.counts, ecmap_, eff_lens_);
+    } else {
+      weight_map_ = calc_weights(tc_.counts, ecmap_, eff_lens_);
+    }
+  }
+
   void compute_rho() {
     if (rho_set_) {
       // rho has already been set, let's clear it
@@ -294,10 +369,18 @@ struct EMAlgorithm {
   std::vector<double> eff_lens_;
   std::vector<double> post_bias_;
   WeightMap weight_map_;
+  WeightMapFloat weight_map_float_;
   std::vector<double> alpha_;
   std::vector<double> alpha_before_zeroes_;
   std::vector<double> rho_;
   bool rho_set_;
+  // time spent on bias correction during run
+  double bias_wall_;
+  double bias_cpu_;
+  int bias_updates_;
+  // hardware counters of the bias correction with --profile
+  std::shared_ptr<PerfCounters> bias_perf_;
+  int num_rounds_;
   const ProgramOptions& opt;
 };
 
@@ -0,0 +1,249 @@
+#include "GeneModel.h"
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <zlib.h>
+
+#include "PseudoBam.h"
+
+// value of key in the attribute column of a GTF line, e.g. transcript_id "x";
+static std::string gtf_attribute(const std::string& attr, const std::string& key) {
+  size_t p = 0;
+  while ((p = attr.find(key, p)) != std::string::npos) {
+    if ((p == 0 || attr[p-1] == ' ' || attr[p-1] == ';') && p + key.size() < attr.size() && attr[p + key.size()] == ' ') {
+      size_t b = p + key.size() + 1;
+      if (b < attr.size() && attr[b] == '"') {
+        size_t e = attr.find('"', b+1);
+        return attr.substr(b+1, e - b - 1);
+      }
+      size_t e = attr.find(';', b);
+      return attr.substr(b, e - b);
+    }
+    p += key.size();
+  }
+  return "";
+}
+
+// reads the name and length of every chromosome, the first two columns of a
+// samtools .fai or a UCSC chrom.sizes file
+static bool readChromSizes(const std::string& fn, std::vector<std::string>& names,
+    std::vector<int>& lens) {
+  std::ifstream in(fn);
+  if (!in.is_open()) {
+    std::cerr << "Error: could not open chromosome sizes file " << fn << std::endl;
+    return false;
+  }
+  std::string line, name;
+  int lineno = 0;
+  while (std::getline(in, line)) {
+    ++lineno;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::stringstream ss(line);
+    long long len = 0;
+    if (!std::getline(ss, name, '\t') || !(ss >> len) || len <= 0 || len > INT_MAX) {
+      std::cerr << "Error: malformed line " << lineno << " in chromosome sizes file " << fn << std::endl;
+      return false;
+    }
+    names.push_back(name);
+    lens.push_back((int) len);
+  }
+  if (names.empty()) {
+    std::cerr << "Error: no chromosomes in chromosome sizes file " << fn << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Transcriptome::parseGTF(const std::string& gtf, const KmerIndex& index,
+    const std::string& chrom_sizes) {
+  chr_names.clear();
+  chr_lens.clear();
+  bool fixed_chrs = !chrom_sizes.empty();
+  if (fixed_chrs && !readChromSizes(chrom_sizes, chr_names, chr_lens)) {
+    return false;
+  }
+
+  gzFile fp = gzopen(gtf.c_str(), "r");
+  if (fp == nullptr) {
+    std::cerr << "Error: could not open GTF file " << gtf << std::endl;
+    return false;
+  }
+
+  // targets by name, also without anything after the first '|'
+  std::unordered_map<std::string, int> target_ids;
+  for (int i = 0; i < index.num_trans; i++) {
+    const auto& name = index.target_names_[i];
+    target_ids.insert({name, i});
+    target_ids.insert({name.substr(0, name.find('|')), i});
+  }
+
+  std::unordered_map<std::string, int> chr_ids;
+  for (size_t i = 0; i < chr_names.size(); i++) {
+    chr_ids.insert({chr_names[i], (int) i});
+  }
+  transcripts.assign(index.num_trans, TranscriptModel());
+
+  std::string line;
+  char buf[65536];
+  int lineno = 0;
+  while (true) {
+    line.clear();
+    bool eof = true;
+    while (gzgets(fp, buf, sizeof(buf)) != nullptr) {
+      eof = false;
+      line.append(buf);
+      if (!line.empty() && line.back() == '\n') {
+        line.pop_back();
+        break;
+      }
+    }
+    if (eof) {
+      break;
+    }
+    ++lineno;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    std::vector<std::string> f;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, '\t')) {
+      f.push_back(field);
+    }
+    if (f.size() < 9) {
+      std::cerr << "Error: malformed GTF line " << lineno << " in " << gtf << std::endl;
+      gzclose(fp);
+      return false;
+    }
+    if (f[2] != "exon") {
+      continue;
+    }
+
+    std::string tid = gtf_attribute(f[8], "transcript_id");
+    std::string version = gtf_attribute(f[8], "transcript_version");
+    auto it = target_ids.end();
+    if (!version.empty()) {
+      it = target_ids.find(tid + "." + version);
+    }
+    if (it == target_ids.end()) {
+      it = target_ids.find(tid);
+    }
+    if (it == target_ids.end()) {
+      continue; // not in the index
+    }
+
+    int start = std::stoi(f[3]) - 1;
+    int stop = std::stoi(f[4]);
+    auto c = chr_ids.find(f[0]);
+    if (c == chr_ids.end()) {
+      if (fixed_chrs) {
+        continue; // not in the assembly, the target does not add up below
+      }
+      c = chr_ids.insert({f[0], (int) chr_names.size()}).first;
+      chr_names.push_back(f[0]);
+      chr_lens.push_back(0);
+    }
+    if (!fixed_chrs) {
+      chr_lens[c->second] = std::max(chr_lens[c->second], stop);
+    } else if (stop > chr_lens[c->second]) {
+      std::cerr << "Error: GTF line " << lineno << " in " << gtf << " ends past chromosome "
+                << f[0] << " of length " << chr_lens[c->second] << " in " << chrom_sizes << std::endl;
+      gzclose(fp);
+      return false;
+    }
+
+    auto& tr = transcripts[it->second];
+    tr.chr = c->second;
+    tr.strand = (f[6] != "-");
+    tr.exons.push_back({start, stop});
+  }
+  gzclose(fp);
+
+  // only keep targets whose exons add up to the sequence in the index
+  num_missing = 0;
+  for (int i = 0; i < index.num_trans; i++) {
+    auto& tr = transcripts[i];
+    std::sort(tr.exons.begin(), tr.exons.end());
+    tr.len = 0;
+    for (auto& e : tr.exons) {
+      tr.len += e.second - e.first;
+    }
+    if (tr.chr == -1 || tr.len != index.target_lens_[i]) {
+      tr = TranscriptModel();
+      ++num_missing;
+    }
+  }
+
+  if (num_missing == index.num_trans) {
+    std::cerr << "Error: no targets of the index were found in GTF file " << gtf << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Transcriptome::project(int tr, int tpos, int mlen, int lclip, int rclip,
+    int& chr, int& gpos, bool& flip, std::vector<uint32_t>& cigar) const {
+  const auto& model = transcripts[tr];
+  if (model.chr == -1) {
+    return false;
+  }
+
+  // the alignment in increasing genomic order
+  int len = model.len;
+  if (tpos < 0 || mlen <= 0 || tpos + mlen > len) {
+    return false;
+  }
+  flip = !model.strand;
+  int q = flip ? len - (tpos + mlen) : tpos;
+  if (flip) {
+    std::swap(lclip, rclip);
+  }
+
+  cigar.clear();
+  if (lclip > 0) {
+    cigar.push_back((lclip << 4) | BAM_CSOFT_CLIP);
+  }
+
+  // walk the exons, gaps between them become N operations
+  int offset = 0;
+  int left = mlen;
+  int last_end = -1;
+  gpos = -1;
+  for (auto& e : model.exons) {
+    int elen = e.second - e.first;
+    if (q >= offset + elen) {
+      offset += elen;
+      continue;
+    }
+    int b = e.first + std::max(0, q - offset);
+    int n = std::min(left, e.second - b);
+    if (gpos == -1) {
+      gpos = b;
+      cigar.push_back((n << 4) | BAM_CMATCH);
+    } else if (b == last_end) {
+      cigar.back() += (n << 4); // abutting exons
+    } else {
+      cigar.push_back(((b - last_end) << 4) | BAM_CREF_SKIP);
+      cigar.push_back((n << 4) | BAM_CMATCH);
+    }
+    last_end = b + n;
+    left -= n;
+    offset += elen;
+    if (left == 0) {
+      break;
+    }
+  }
+
+  if (rclip > 0) {
+    cigar.push_back((rclip << 4) | BAM_CSOFT_CLIP);
+  }
+  chr = model.chr;
+  return true;
+}
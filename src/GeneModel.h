@@ -0,0 +1,46 @@
+#ifndef KALLISTO_GENEMODEL_H
+#define KALLISTO_GENEMODEL_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "KmerIndex.h"
+
+// exons of one target on the genome, 0-based half open intervals sorted by
+// genomic position
+struct TranscriptModel {
+  int chr = -1; // -1 if the target is not in the annotation
+  bool strand = true; // true for the forward strand
+  int len = 0; // the sum of the exon lengths
+  std::vector<std::pair<int,int>> exons;
+};
+
+// Maps target coordinates to the genome using a GTF annotation
+class Transcriptome {
+  public:
+    // reads the exons of every target in index from a (gzipped) GTF file.
+    // The chromosomes and their lengths come from chrom_sizes, a samtools
+    // .fai or UCSC chrom.sizes file of the genome assembly, and targets on
+    // other chromosomes are left out. Without it the lengths are taken from
+    // the furthest exon on each chromosome, which do not match other BAM
+    // files of the assembly
+    bool parseGTF(const std::string& gtf, const KmerIndex& index,
+        const std::string& chrom_sizes = "");
+
+    // projects an alignment of mlen bases starting at 0-based position tpos
+    // on target tr onto the genome. lclip and rclip are the soft clips as
+    // seen on the target. On success chr, gpos (0-based) and cigar are set
+    // and flip says whether the target lies on the reverse strand
+    bool project(int tr, int tpos, int mlen, int lclip, int rclip,
+        int& chr, int& gpos, bool& flip, std::vector<uint32_t>& cigar) const;
+
+    std::vector<std::string> chr_names;
+    std::vector<int> chr_lens;
+    std::vector<TranscriptModel> transcripts; // indexed by target id
+
+    int num_missing = 0; // targets with no (consistent) annotation
+};
+
+#endif // KALLISTO_GENEMODEL_H
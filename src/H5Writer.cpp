@@ -3,11 +3,13 @@
 void H5Writer::init(const std::string& fname, int num_bootstrap, int num_processed,
   const std::vector<int>& fld,const std::vector<int>& preBias, const std::vector<double>& postBias,
   uint compression, size_t index_version,
-  const std::string& shell_call, const std::string& start_time)
+  const std::string& shell_call, const std::string& start_time,
+  bool sparse_bootstrap)
 {
   primed_ = true;
   num_bootstrap_ = num_bootstrap;
   compression_ = compression;
+  sparse_bootstrap_ = sparse_bootstrap && num_bootstrap > 0;
   file_id_ = H5Fcreate(fname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
   root_ = H5Gopen(file_id_, "/", H5P_DEFAULT);
   aux_ = H5Gcreate(file_id_, "/aux", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
@@ -60,11 +62,65 @@ void H5Writer::write_main(const EMAlgorithm& em,
   vector_to_h5(targ_ids, aux_, "ids", true, compression_);
   vector_to_h5(em.eff_lens_, aux_, "eff_lengths", false, compression_);
   vector_to_h5(lengths, aux_, "lengths", false, compression_);
+
+  if (sparse_bootstrap_) {
+    // a bootstrap sample only redistributes the observed counts, so the
+    // only targets that can ever be nonzero are those in an EC with reads
+    std::vector<bool> support(em.num_trans_, false);
+    for (size_t ec = 0; ec < em.counts_.size(); ++ec) {
+      if (em.counts_[ec] > 0) {
+        for (auto t : em.ecmap_[ec]) {
+          support[t] = true;
+        }
+      }
+    }
+    bs_index_.clear();
+    for (int t = 0; t < em.num_trans_; ++t) {
+      if (support[t]) {
+        bs_index_.push_back(t);
+      }
+    }
+
+    if (bs_index_.empty()) {
+      // nothing to index, fall back to dense bootstraps
+      sparse_bootstrap_ = false;
+    } else {
+      vector_to_h5(bs_index_, bs_, "sparse_index", false, compression_);
+    }
+  }
 }
 
 void H5Writer::write_bootstrap(const EMAlgorithm& em, int bs_id) {
   std::string bs_id_str("bs" + std::to_string( bs_id ));
-  vector_to_h5(em.alpha_, bs_, bs_id_str.c_str(), false, compression_);
+  if (!sparse_bootstrap_) {
+    vector_to_h5(em.alpha_, bs_, bs_id_str.c_str(), false, compression_);
+    return;
+  }
+
+  std::vector<float> vals;
+  vals.reserve(bs_index_.size());
+  for (auto t : bs_index_) {
+    vals.push_back(static_cast<float>(em.alpha_[t]));
+  }
+  vector_to_h5(vals, bs_, bs_id_str.c_str(), false, compression_);
+}
+
+void H5Writer::write_bootstrap_summary(const BootstrapSummary& summary) {
+  hid_t group_id = H5Gcreate(file_id_, "/bootstrap_summary", H5P_DEFAULT,
+      H5P_DEFAULT, H5P_DEFAULT);
+
+  std::vector<int> n_bs {summary.num_bootstrap()};
+  vector_to_h5(n_bs, group_id, "num_bootstrap", false, compression_);
+  vector_to_h5(summary.mean_, group_id, "mean", false, compression_);
+  vector_to_h5(summary.variance(), group_id, "variance", false, compression_);
+
+  auto quantiles = summary.quantiles();
+  for (size_t i = 0; i < quantiles.size(); ++i) {
+    vector_to_h5(quantiles[i], group_id, BootstrapSummary::quantile_names[i],
+        false, compression_);
+  }
+
+  H5Gclose(group_id);
 }
 
 /**********************************************************************/
@@ -105,6 +161,11 @@ H5Converter::H5Converter(const std::string& h5_fname, const std::string& out_dir
   // </aux info>
   if (n_bs_ > 0) {
     bs_ = H5Gopen(file_id_, "/bootstrap", H5P_DEFAULT);
+    if (H5Lexists(bs_, "sparse_index", H5P_DEFAULT) > 0) {
+      read_dataset(bs_, "sparse_index", bs_index_);
+      std::cerr << "[h5dump] bootstraps are sparse over " << bs_index_.size()
+        << " targets" << std::endl;
+    }
   }
 
   std::vector<std::string> tmp;
@@ -133,6 +194,8 @@ H5Converter::H5Converter(const std::string& h5_fname, const std::string& out_dir
 
   tpm_buf_.resize( n_targs_, 0.0 );
   assert( n_targs_ == tpm_buf_.size() );
+
+  has_bs_summary_ = H5Lexists(file_id_, "bootstrap_summary", H5P_DEFAULT) > 0;
 }
 
 H5Converter::~H5Converter() {
@@ -176,12 +239,21 @@ void H5Converter::convert() {
     std::cerr.flush();
     std::string bs_out_fname( out_dir_ + "/bs_abundance_" + std::to_string(i) +
         ".tsv" );
-    rw_from_counts(bs_, "bs" + std::to_string(i), bs_out_fname);
+    if (bs_index_.empty()) {
+      rw_from_counts(bs_, "bs" + std::to_string(i), bs_out_fname);
+    } else {
+      rw_from_sparse_counts(bs_, "bs" + std::to_string(i), bs_out_fname);
+    }
   }
 
   if (i-1 % 50 != 0 && i > 0) {
     std::cerr << std::endl;
   }
+
+  if (has_bs_summary_) {
+    std::cerr << "[h5dump] writing bootstrap summary file: " << out_dir_ << "/bootstrap_summary.tsv" << std::endl;
+    rw_bootstrap_summary(out_dir_ + "/bootstrap_summary.tsv");
+  }
 }
 
 void H5Converter::rw_from_counts(hid_t group_id, const std::string& count_name, const std::string& out_fname) {
@@ -190,3 +262,35 @@ void H5Converter::rw_from_counts(hid_t group_id, const std::string& count_name,
 
   plaintext_writer(out_fname, targ_ids_, alpha, eff_lengths_, lengths_);
 }
+
+void H5Converter::rw_from_sparse_counts(hid_t group_id, const std::string& count_name, const std::string& out_fname) {
+  std::vector<float> vals;
+  read_dataset(group_id, count_name.c_str(), vals);
+  assert( vals.size() == bs_index_.size() );
+
+  std::fill(alpha_buf_.begin(), alpha_buf_.end(), 0.0);
+  for (size_t i = 0; i < bs_index_.size(); ++i) {
+    alpha_buf_[bs_index_[i]] = vals[i];
+  }
+
+  plaintext_writer(out_fname, targ_ids_, alpha_buf_, eff_lengths_, lengths_);
+}
+
+void H5Converter::rw_bootstrap_summary(const std::string& out_fname) {
+  hid_t group_id = H5Gopen(file_id_, "/bootstrap_summary", H5P_DEFAULT);
+
+  std::vector<double> mean;
+  std::vector<double> var;
+  read_dataset(group_id, "mean", mean);
+  read_dataset(group_id, "variance", var);
+
+  std::vector<std::vector<double>> quantiles(BootstrapSummary::quantile_names.size());
+  for (size_t i = 0; i < quantiles.size(); ++i) {
+    read_dataset(group_id, BootstrapSummary::quantile_names[i], quantiles[i]);
+  }
+
+  H5Gclose(group_id);
+
+  plaintext_bootstrap_summary(out_fname, targ_ids_, mean, var,
+      BootstrapSummary::quantile_names, quantiles);
+}
@@ -2,18 +2,20 @@
 #define KALLISTO_H5WRITER_H
 
 #include "EMAlgorithm.h"
+#include "BootstrapSummary.h"
 
 #include "h5utils.h"
 #include "PlaintextWriter.h"
 
 class H5Writer {
   public:
-    H5Writer() : primed_(false) {}
+    H5Writer() : primed_(false), sparse_bootstrap_(false) {}
     ~H5Writer();
 
     void init(const std::string& fname, int num_bootstrap, int num_processed,
       const std::vector<int>& fld, const std::vector<int>& preBias, const std::vector<double>& postBias, uint compression, size_t index_version,
-      const std::string& shell_call, const std::string& start_time);
+      const std::string& shell_call, const std::string& start_time,
+      bool sparse_bootstrap = false);
 
     void write_main(const EMAlgorithm& em,
         const std::vector<std::string>& targ_ids,
@@ -21,12 +23,19 @@ class H5Writer {
 
     void write_bootstrap(const EMAlgorithm& em, int bs_id);
 
+    void write_bootstrap_summary(const BootstrapSummary& summary);
+
   private:
     bool primed_;
 
     int num_bootstrap_;
     uint compression_;
 
+    // sparse bootstraps share a single index of the targets which can be
+    // nonzero in any replicate, and store float values for those only
+    bool sparse_bootstrap_;
+    std::vector<int> bs_index_;
+
     hid_t file_id_;
     hid_t root_;
     hid_t aux_;
@@ -45,6 +54,9 @@ class H5Converter {
   private:
     void rw_from_counts(hid_t group_id, const std::string& count_name,
         const std::string& out_fname);
+    void rw_from_sparse_counts(hid_t group_id, const std::string& count_name,
+        const std::string& out_fname);
+    void rw_bootstrap_summary(const std::string& out_fname);
 
     std::string out_dir_;
 
@@ -64,10 +76,14 @@ class H5Converter {
     std::vector<double> alpha_buf_;
     std::vector<double> tpm_buf_;
 
+    // non-empty if the bootstraps were written sparsely
+    std::vector<int> bs_index_;
+
     hid_t file_id_;
     hid_t root_;
     hid_t aux_;
     hid_t bs_;
+    bool has_bs_summary_;
 
     int n_bs_;
     int n_proc_;
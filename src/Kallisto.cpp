@@ -0,0 +1,299 @@
+#include "Kallisto.h"
+
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+#include "EMAlgorithm.h"
+#include "KmerIndex.h"
+#include "MinCollector.h"
+#include "PlaintextWriter.h"
+#include "ProcessReads.h"
+#include "weights.h"
+
+namespace kallisto {
+
+// the same limits as the command line
+static const int MAX_TLEN_COUNT = 10000;
+static const int MAX_BIAS_COUNT = 1000000;
+
+// Kmer::k is global, indices are loaded one at a time
+static std::mutex load_lock;
+
+struct Index::Impl {
+  explicit Impl(const ProgramOptions& opt) : index(opt) {}
+
+  // the index is never modified once loaded, except for the transcript
+  // sequences, which are only needed with bias correction
+  void loadTranscriptSequences() const {
+    std::call_once(seqs_once, [this]() { index.loadTranscriptSequences(); });
+  }
+
+  KmerIndex index;
+  mutable std::once_flag seqs_once;
+};
+
+Index::Index() {}
+
+Index::~Index() {}
+
+std::shared_ptr<const Index> Index::load(const std::string& filename, bool shared_memory) {
+  std::lock_guard<std::mutex> lock(load_lock);
+
+  ProgramOptions opt;
+  opt.index = filename;
+  opt.shared_index = shared_memory;
+  std::shared_ptr<Index> ret(new Index());
+  ret->impl_.reset(new Impl(opt));
+  KmerIndex& index = ret->impl_->index;
+
+  // KmerIndex::load exits on these, check them first
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw Error("could not open index " + filename);
+  }
+  size_t header_version = 0;
+  int k = 0;
+  in.read((char *)&header_version, sizeof(header_version));
+  in.read((char *)&k, sizeof(k));
+  if (!in.good() || header_version != index.INDEX_VERSION) {
+    throw Error("incompatible index " + filename + ", expected version "
+        + std::to_string(index.INDEX_VERSION));
+  }
+  if (Kmer::k != 0 && Kmer::k != k) {
+    throw Error("index " + filename + " has k-mer length " + std::to_string(k)
+        + ", but an index with length " + std::to_string(Kmer::k) + " is already loaded");
+  }
+  in.close();
+
+  index.load(opt);
+  return ret;
+}
+
+int Index::k() const {
+  return impl_->index.k;
+}
+
+const std::vector<std::string>& Index::targetNames() const {
+  return impl_->index.target_names_;
+}
+
+const std::vector<int>& Index::targetLengths() const {
+  return impl_->index.target_lens_;
+}
+
+int Index::numECs() const {
+  return impl_->index.ecmap.size();
+}
+
+const std::vector<int>& Index::ec(int id) const {
+  if (id < 0 || id >= numECs()) {
+    throw Error("no equivalence class " + std::to_string(id) + " in the index");
+  }
+  return impl_->index.ecmap[id];
+}
+
+struct Session::Impl {
+  Impl(std::shared_ptr<const Index> idx, const ProgramOptions& o)
+    : index_handle(idx), index(idx->impl_->index), opt(o),
+      // only the const members of the collector are used with the index,
+      // new classes are kept in the session
+      tc(const_cast<KmerIndex&>(index), opt),
+      num_processed(0), num_pseudoaligned(0), tlencount(0), bias_count(0) {}
+
+  std::shared_ptr<const Index> index_handle;
+  const KmerIndex& index;
+  ProgramOptions opt;
+
+  // counts of the classes of the index, fragment lengths and bias
+  MinCollector tc;
+  // classes not in the index, numbered from the size of its ecmap
+  EcMap new_ecs;
+  std::unordered_map<std::vector<int>, int, SortedVectorHasher> new_ec_ids;
+  std::vector<int> new_counts;
+
+  size_t num_processed;
+  size_t num_pseudoaligned;
+  int tlencount;
+  int bias_count;
+
+  // scratch space
+  std::vector<std::pair<KmerEntry,int>> v1, v2;
+  std::vector<int> u, vtmp;
+};
+
+Session::Session(std::shared_ptr<const Index> index, const SessionOptions& options) {
+  if (!index) {
+    throw Error("session needs an index");
+  }
+
+  ProgramOptions opt;
+  opt.k = index->k();
+  opt.single_end = !options.paired;
+  opt.fld = options.fragment_length;
+  opt.sd = options.fragment_sd;
+  opt.bias = options.bias;
+  if (options.strand != Strand::None) {
+    opt.strand_specific = true;
+    opt.strand = (options.strand == Strand::FR) ? ProgramOptions::StrandType::FR
+      : ProgramOptions::StrandType::RF;
+  }
+
+  if (opt.fld < 0.0 || opt.sd < 0.0) {
+    throw Error("fragment length and standard deviation can't be negative");
+  }
+  if ((opt.fld != 0.0) != (opt.sd != 0.0)) {
+    throw Error("fragment length and standard deviation have to be given together");
+  }
+  if (opt.single_end && opt.fld == 0.0) {
+    throw Error("single-end reads need the fragment length and its standard deviation");
+  }
+
+  impl_.reset(new Impl(index, opt));
+}
+
+Session::~Session() {}
+
+std::vector<int> Session::pseudoalign(const std::vector<std::string>& reads) {
+  auto& im = *impl_;
+  const KmerIndex& index = im.index;
+  bool paired = !im.opt.single_end;
+  if (paired && reads.size() % 2 != 0) {
+    throw Error("paired-end session needs both mates of every pair");
+  }
+
+  std::vector<int> ecs;
+  ecs.reserve((paired) ? reads.size() / 2 : reads.size());
+  for (size_t i = 0; i < reads.size(); i += (paired) ? 2 : 1) {
+    const char* s1 = reads[i].c_str();
+    int l1 = reads[i].size();
+    const char* s2 = nullptr;
+    int l2 = 0;
+    if (paired) {
+      s2 = reads[i+1].c_str();
+      l2 = reads[i+1].size();
+    }
+
+    im.v1.clear();
+    im.v2.clear();
+    im.u.clear();
+    pseudoalignFragment(index, im.tc, im.opt, s1, l1, s2, l2, paired, im.v1, im.v2, im.u, im.vtmp);
+    ++im.num_processed;
+
+    int ec = -1;
+    if (!im.u.empty()) {
+      ec = im.tc.findEC(im.u);
+      if (ec != -1) {
+        ++im.tc.counts[ec];
+      } else {
+        auto it = im.new_ec_ids.find(im.u);
+        if (it != im.new_ec_ids.end()) {
+          ec = it->second;
+        } else {
+          ec = index.ecmap.size() + im.new_ecs.size();
+          im.new_ecs.push_back(im.u);
+          im.new_ec_ids.insert({im.u, ec});
+          im.new_counts.push_back(0);
+        }
+        ++im.new_counts[ec - index.ecmap.size()];
+      }
+      ++im.num_pseudoaligned;
+
+      if (im.opt.bias && im.bias_count < MAX_BIAS_COUNT) {
+        if (im.tc.countBias(s1, s2, im.v1, im.v2, paired)) {
+          ++im.bias_count;
+        }
+      }
+
+      if (paired && im.opt.fld == 0.0 && im.tlencount < MAX_TLEN_COUNT
+          && ec < index.num_trans && !im.v1.empty() && !im.v2.empty()) {
+        int tl = index.mapPair(s1, l1, s2, l2, ec);
+        if (0 < tl && tl < im.tc.flens.size()) {
+          ++im.tc.flens[tl];
+          ++im.tlencount;
+        }
+      }
+    }
+    ecs.push_back(ec);
+  }
+  return ecs;
+}
+
+const std::vector<int>& Session::ec(int id) const {
+  const auto& im = *impl_;
+  int num_ecs = im.index.ecmap.size();
+  if (id >= num_ecs && id < num_ecs + (int) im.new_ecs.size()) {
+    return im.new_ecs[id - num_ecs];
+  }
+  return im.index_handle->ec(id);
+}
+
+std::vector<int> Session::counts() const {
+  const auto& im = *impl_;
+  std::vector<int> counts(im.tc.counts);
+  counts.insert(counts.end(), im.new_counts.begin(), im.new_counts.end());
+  return counts;
+}
+
+size_t Session::numProcessed() const {
+  return impl_->num_processed;
+}
+
+size_t Session::numPseudoaligned() const {
+  return impl_->num_pseudoaligned;
+}
+
+Estimates Session::quantify() const {
+  const auto& im = *impl_;
+  const KmerIndex& index = im.index;
+  if (im.num_pseudoaligned == 0) {
+    throw Error("no reads pseudoaligned, nothing to quantify");
+  }
+
+  // the session keeps counting, work on a copy
+  MinCollector tc(im.tc);
+  if (im.opt.fld == 0.0) {
+    if (im.tlencount == 0) {
+      throw Error("could not determine the fragment length, no pairs mapped to a unique target");
+    }
+    tc.compute_mean_frag_lens_trunc();
+  } else {
+    tc.init_mean_fl_trunc(im.opt.fld, im.opt.sd);
+  }
+  auto fl_means = get_frag_len_means(index.target_lens_, tc.mean_fl_trunc);
+
+  // only the classes with reads matter to the EM, the single target
+  // classes have to stay in front
+  EcMap ecmap(index.ecmap.begin(), index.ecmap.begin() + index.num_trans);
+  std::vector<int> counts(im.tc.counts.begin(), im.tc.counts.begin() + index.num_trans);
+  for (size_t ec = index.num_trans; ec < im.tc.counts.size(); ec++) {
+    if (im.tc.counts[ec] > 0) {
+      ecmap.push_back(index.ecmap[ec]);
+      counts.push_back(im.tc.counts[ec]);
+    }
+  }
+  for (size_t i = 0; i < im.new_ecs.size(); i++) {
+    ecmap.push_back(im.new_ecs[i]);
+    counts.push_back(im.new_counts[i]);
+  }
+  tc.counts = counts;
+
+  if (im.opt.bias) {
+    im.index_handle->impl_->loadTranscriptSequences();
+  }
+
+  EMAlgorithm em(tc.counts, index, ecmap, tc, fl_means, im.opt);
+  em.run(10000, 50, false, im.opt.bias);
+
+  Estimates est;
+  est.target_names = em.target_names_;
+  est.est_counts = em.alpha_;
+  est.eff_lengths = em.eff_lens_;
+  est.tpm = counts_to_tpm(em.alpha_, em.eff_lens_);
+  est.num_processed = im.num_processed;
+  est.num_pseudoaligned = im.num_pseudoaligned;
+  return est;
+}
+
+} // namespace kallisto
@@ -0,0 +1,118 @@
+#ifndef KALLISTO_KALLISTO_H
+#define KALLISTO_KALLISTO_H
+
+// Library interface to kallisto, for programs that pseudoalign and quantify
+// reads they hold in memory. Errors are reported by throwing kallisto::Error
+// instead of printing a message and exiting like the command line does.
+//
+//   auto index = kallisto::Index::load("transcripts.idx");
+//   kallisto::Session session(index);
+//   while (...) {
+//     session.pseudoalign(reads); // mates of a pair one after the other
+//   }
+//   kallisto::Estimates est = session.quantify();
+//
+// An Index can be shared by any number of sessions, also from different
+// threads. A session must only be used by one thread at a time.
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace kallisto {
+
+class Error : public std::runtime_error {
+  public:
+    explicit Error(const std::string& what) : std::runtime_error(what) {}
+};
+
+class Index {
+  public:
+    // loads an index built with kallisto index. With shared_memory the
+    // k-mer table is kept in shared memory for other processes, as with
+    // --shared-index. All indices loaded by a process must use the same k
+    static std::shared_ptr<const Index> load(const std::string& filename,
+        bool shared_memory = false);
+
+    ~Index();
+
+    int k() const;
+    const std::vector<std::string>& targetNames() const;
+    const std::vector<int>& targetLengths() const;
+    // number of equivalence classes in the index, a session numbers the
+    // classes it finds after these
+    int numECs() const;
+    // targets of an equivalence class of the index
+    const std::vector<int>& ec(int id) const;
+
+  private:
+    Index();
+    Index(const Index&) = delete;
+    Index& operator=(const Index&) = delete;
+
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+    friend class Session;
+};
+
+enum class Strand {None, FR, RF};
+
+struct SessionOptions {
+  // reads come in pairs, the two mates one after the other
+  bool paired;
+  // mean and standard deviation of the fragment length, required for
+  // single-end reads and estimated from the data for paired-end reads
+  double fragment_length;
+  double fragment_sd;
+  Strand strand;
+  // correct for sequence specific bias
+  bool bias;
+
+  SessionOptions() : paired(true), fragment_length(0.0), fragment_sd(0.0),
+    strand(Strand::None), bias(false) {}
+};
+
+struct Estimates {
+  std::vector<std::string> target_names;
+  std::vector<double> est_counts;
+  std::vector<double> eff_lengths;
+  std::vector<double> tpm;
+  size_t num_processed;
+  size_t num_pseudoaligned;
+};
+
+// pseudoaligns the reads of one sample and quantifies them
+class Session {
+  public:
+    explicit Session(std::shared_ptr<const Index> index,
+        const SessionOptions& options = SessionOptions());
+    ~Session();
+
+    // pseudoaligns and counts a batch of reads, returning the equivalence
+    // class of every read, or pair of reads, -1 if it doesn't pseudoalign
+    std::vector<int> pseudoalign(const std::vector<std::string>& reads);
+
+    // targets of an equivalence class returned by pseudoalign
+    const std::vector<int>& ec(int id) const;
+
+    // counts of the equivalence classes for all reads so far
+    std::vector<int> counts() const;
+    size_t numProcessed() const;
+    size_t numPseudoaligned() const;
+
+    // estimates the abundances from the reads so far, the session can keep
+    // pseudoaligning afterwards
+    Estimates quantify() const;
+
+  private:
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace kallisto
+
+#endif // KALLISTO_KALLISTO_H
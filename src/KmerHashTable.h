@@ -18,6 +18,7 @@ struct KmerHashTable {
   Hash hasher;
   value_type *table;
   size_t size_, pop;
+  bool owns_table; // false when table lives in memory managed elsewhere
   value_type empty;
   value_type deleted;
 
@@ -86,13 +87,13 @@ struct KmerHashTable {
   // --- hash table
 
 
-  KmerHashTable(const Hash& h = Hash() ) : hasher(h), table(nullptr), size_(0), pop(0) {
+  KmerHashTable(const Hash& h = Hash() ) : hasher(h), table(nullptr), size_(0), pop(0), owns_table(true) {
     empty.first.set_empty();
     deleted.first.set_deleted();
     init_table(1024);
   }
 
-  KmerHashTable(size_t sz, const Hash& h = Hash() ) : hasher(h), table(nullptr), size_(0), pop(0) {
+  KmerHashTable(size_t sz, const Hash& h = Hash() ) : hasher(h), table(nullptr), size_(0), pop(0), owns_table(true) {
     empty.first.set_empty();
     deleted.first.set_deleted();
     init_table((size_t) (1.2*sz));
@@ -104,13 +105,37 @@ struct KmerHashTable {
 
   void clear_table() {
     if (table != nullptr) {
-      delete[] table;
+      if (owns_table) {
+        delete[] table;
+      }
       table = nullptr;
     }
+    owns_table = true;
     size_ = 0;
     pop  = 0;
   }
 
+  // the number of slots that holds n entries without growing
+  size_t capacity_for(size_t n) {
+    return rndup(n + (n>>4) + 1);
+  }
+
+  // uses the sz slots at t, which have to outlive the table, instead of
+  // its own. With populated false they are cleared for inserting at most
+  // what fits without growing, otherwise they already hold a table of the
+  // same hash and count entries
+  void use_storage(value_type *t, size_t sz, bool populated, size_t count = 0) {
+    clear_table();
+    table = t;
+    size_ = sz;
+    owns_table = false;
+    if (populated) {
+      pop = count;
+    } else {
+      std::fill(table, table+size_, empty);
+    }
+  }
+
   size_t size() const {
     return pop;
   }
@@ -223,7 +248,10 @@ struct KmerHashTable {
         insert(old_table[i]);
       }
     }
-    delete[] old_table;
+    if (owns_table) {
+      delete[] old_table;
+    }
+    owns_table = true;
     old_table = nullptr;
 
   }
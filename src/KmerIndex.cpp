@@ -844,14 +844,18 @@ void KmerIndex::load(ProgramOptions& opt, bool loadKmerTable) {
     << std::endl;
 
   kmap.clear();
-  if (loadKmerTable) {
+  bool shared = false;
+  if (loadKmerTable && opt.shared_index) {
+    shared = loadSharedKmerTable(index_in, in, kmap_size);
+  }
+  if (loadKmerTable && !shared) {
     kmap.reserve(kmap_size);
   }
 
   // 6. read kmer->ec values
   Kmer tmp_kmer;
   KmerEntry tmp_val;
-  for (size_t i = 0; i < kmap_size; ++i) {
+  for (size_t i = 0; i < kmap_size && !shared; ++i) {
     in.read((char *)&tmp_kmer, sizeof(tmp_kmer));
     in.read((char *)&tmp_val, sizeof(tmp_val));
 
@@ -970,6 +974,58 @@ void KmerIndex::load(ProgramOptions& opt, bool loadKmerTable) {
 }
 
 
+// Points kmap at a copy in shared memory, filling it from in if this is the
+// first process to load the index. Leaves in after the k-mer table either
+// way, false if the table has to be read privately
+bool KmerIndex::loadSharedKmerTable(const std::string& index_in, std::ifstream& in, size_t kmap_size) {
+  using value_type = decltype(kmap)::value_type;
+  const size_t record_size = sizeof(Kmer) + sizeof(KmerEntry);
+  auto table_start = in.tellg();
+  size_t slots = kmap.capacity_for(kmap_size);
+
+  // the layout depends on the k-mer representation and the format
+  uint64_t tag = (INDEX_VERSION << 48) ^ ((uint64_t) k << 32) ^ ((uint64_t) sizeof(value_type) << 16)
+    ^ std::hash<size_t>()(kmap_size);
+  std::string name = SharedSegment::nameFor(index_in);
+
+  auto build = [&](char *p) {
+    kmap.use_storage((value_type*) p, slots, false);
+    Kmer tmp_kmer;
+    KmerEntry tmp_val;
+    for (size_t i = 0; i < kmap_size; ++i) {
+      in.read((char *)&tmp_kmer, sizeof(tmp_kmer));
+      in.read((char *)&tmp_val, sizeof(tmp_val));
+      kmap.insert({tmp_kmer, tmp_val});
+    }
+    // the mapping it was built in goes away
+    kmap.clear_table();
+    return in.good();
+  };
+
+  if (!kmap_segment.open(name, tag, slots * sizeof(value_type), build)) {
+    std::cerr << "[~warn] could not share the k-mer table, loading it privately" << std::endl;
+    kmap.init_table(1024);
+    in.clear();
+    in.seekg(table_start);
+    return false;
+  }
+
+  // the segment is mapped read-only, kmap must not change from here on
+  kmap.use_storage((value_type*) kmap_segment.data(), slots, true, kmap_size);
+  in.seekg(table_start + (std::streamoff) (kmap_size * record_size));
+  std::cerr << "[index] k-mer table " << ((kmap_segment.created()) ? "loaded into" : "attached from")
+    << " shared memory " << name << std::endl;
+  if (kmap_segment.created()) {
+    // the tables of a rebuilt or replaced index would stay until reboot
+    int n = SharedSegment::removeFor(index_in, name);
+    if (n > 0) {
+      std::cerr << "[index] removed " << n << " shared memory segment" << ((n == 1) ? "" : "s")
+        << " of earlier versions of the index" << std::endl;
+    }
+  }
+  return true;
+}
+
 int KmerIndex::mapPair(const char *s1, int l1, const char *s2, int l2, int ec) const {
   bool d1 = true;
   bool d2 = true;
@@ -16,6 +16,7 @@
 #include "KmerIterator.hpp"
 
 #include "KmerHashTable.h"
+#include "SharedSegment.h"
 
 #include "hash.hpp"
 
@@ -121,6 +122,7 @@ struct KmerIndex {
   // load methods
   void load(ProgramOptions& opt, bool loadKmerTable = true);
   void loadTranscriptSequences() const;
+  bool loadSharedKmerTable(const std::string& index_in, std::ifstream& in, size_t kmap_size);
 
   // positional information
   std::pair<int,bool> findPosition(int tr, Kmer km, KmerEntry val, int p = 0) const;
@@ -130,6 +132,7 @@ struct KmerIndex {
   int skip;
 
   KmerHashTable<KmerEntry, KmerHash> kmap;
+  SharedSegment kmap_segment; // holds kmap with --shared-index
   EcMap ecmap;
   DBGraph dbGraph;
   std::unordered_map<std::vector<int>, int, SortedVectorHasher> ecmapinv;
@@ -0,0 +1,131 @@
+#include "PerfCounters.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+const char* PerfCounts::name(int e) {
+  static const char* names[NumEvents] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+  return names[e];
+}
+
+PerfCounts& PerfCounts::operator+=(const PerfCounts& o) {
+  for (int e = 0; e < NumEvents; e++) {
+    counts[e] += o.counts[e];
+    valid[e] = valid[e] || o.valid[e];
+  }
+  return *this;
+}
+
+PerfCounts& PerfCounts::operator-=(const PerfCounts& o) {
+  for (int e = 0; e < NumEvents; e++) {
+    counts[e] -= std::min(counts[e], o.counts[e]);
+  }
+  return *this;
+}
+
+#ifdef __linux__
+
+PerfCounters::PerfCounters() {
+  static const uint64_t configs[PerfCounts::NumEvents] = {PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+  for (int e = 0; e < PerfCounts::NumEvents; e++) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[e];
+    attr.disabled = 1;
+    attr.inherit = 1;
+    // user space only, which is all that perf_event_paranoid 2 allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds_[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fds_[e] == -1 && error_.empty()) {
+      error_ = std::string("could not open ") + PerfCounts::name(e) + " counter: " + strerror(errno);
+      if (errno == EACCES || errno == EPERM) {
+        error_ += " (see /proc/sys/kernel/perf_event_paranoid)";
+      }
+    }
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds_) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+bool PerfCounters::available() const {
+  for (int fd : fds_) {
+    if (fd != -1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::start() {
+  for (int fd : fds_) {
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void PerfCounters::stop() {
+  for (int fd : fds_) {
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+PerfCounts PerfCounters::read() const {
+  PerfCounts c;
+  for (int e = 0; e < PerfCounts::NumEvents; e++) {
+    // value, time enabled, time running
+    uint64_t v[3];
+    if (fds_[e] == -1 || ::read(fds_[e], v, sizeof(v)) != sizeof(v)) {
+      continue;
+    }
+    c.valid[e] = true;
+    c.counts[e] = (v[2] > 0 && v[2] < v[1]) ? (uint64_t) ((double) v[0] * v[1] / v[2]) : v[0];
+  }
+  return c;
+}
+
+#else
+
+PerfCounters::PerfCounters() : error_("hardware counters are only available on Linux") {
+  for (auto& fd : fds_) {
+    fd = -1;
+  }
+}
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::available() const {
+  return false;
+}
+
+void PerfCounters::start() {}
+
+void PerfCounters::stop() {}
+
+PerfCounts PerfCounters::read() const {
+  return PerfCounts();
+}
+
+#endif // __linux__
@@ -0,0 +1,52 @@
+#ifndef KALLISTO_PERFCOUNTERS_H
+#define KALLISTO_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+// counts of the hardware events of --profile, those that could not be
+// counted are not valid
+struct PerfCounts {
+  enum Event {Cycles, Instructions, LLCMisses, BranchMisses, NumEvents};
+
+  PerfCounts() : counts(), valid() {}
+
+  // the name of an event in run_info.json
+  static const char* name(int e);
+
+  PerfCounts& operator+=(const PerfCounts& o);
+  PerfCounts& operator-=(const PerfCounts& o);
+
+  uint64_t counts[NumEvents];
+  bool valid[NumEvents];
+};
+
+// Hardware performance counters of the calling thread, and of the threads it
+// starts while they are open, through Linux perf_event_open. Every event is
+// opened on its own, so the ones the kernel or the machine does not offer are
+// left out instead of failing the run. Counts only grow between start and
+// stop, which can alternate any number of times
+class PerfCounters {
+  public:
+    PerfCounters();
+    ~PerfCounters();
+
+    // whether any event could be opened, otherwise error says why not
+    bool available() const;
+    const std::string& error() const { return error_; }
+
+    void start();
+    void stop();
+    // counts so far, scaled up when the kernel had to share the counters
+    // between more events than the machine has
+    PerfCounts read() const;
+
+  private:
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    int fds_[PerfCounts::NumEvents];
+    std::string error_;
+};
+
+#endif // KALLISTO_PERFCOUNTERS_H
@@ -62,6 +62,47 @@ void plaintext_writer(
   of.close();
 }
 
+void plaintext_bootstrap_summary(
+    const std::string& out_name,
+    const std::vector<std::string>& targ_ids,
+    const std::vector<double>& mean,
+    const std::vector<double>& var,
+    const std::vector<std::string>& quantile_names,
+    const std::vector<std::vector<double>>& quantiles
+    ){
+
+  assert( quantile_names.size() == quantiles.size() );
+
+  std::ofstream of;
+  of.open( out_name );
+
+  if (!of.is_open()) {
+    std::cerr << "Error: Couldn't open file: " << out_name << std::endl;
+
+    exit(1);
+  }
+
+  of << "target_id" << "\t"
+    << "mean" << "\t"
+    << "variance";
+  for (auto& name : quantile_names) {
+    of << "\t" << name;
+  }
+  of << std::endl;
+
+  for (auto i = 0; i < mean.size(); ++i) {
+    of << targ_ids[i] << '\t'
+      << mean[i] << '\t'
+      << var[i];
+    for (auto& q : quantiles) {
+      of << '\t' << q[i];
+    }
+    of << std::endl;
+  }
+
+  of.close();
+}
+
 std::string to_json(const std::string& id, const std::string& val, bool quote,
     bool comma, int level) {
   std::string out;
@@ -95,7 +136,8 @@ void plaintext_aux(
     const std::string& version,
     const std::string& index_v,
     const std::string& start_time,
-    const std::string& call) {
+    const std::string& call,
+    const RunStats* stats) {
   std::ofstream of;
   of.open( out_name );
 
@@ -105,62 +147,12 @@ void plaintext_aux(
     to_json("n_processed", n_processed, false) << std::endl <<
     to_json("kallisto_version", version, true) << std::endl <<
     to_json("index_version", index_v, false) << std::endl <<
-    to_json("start_time", start_time, true) << std::endl <<
-    to_json("call", call, true, false) << std::endl <<
+    to_json("start_time", start_time, true) << std::endl;
+  if (stats != nullptr) {
+    of << stats->to_json();
+  }
+  of << to_json("call", call, true, false) << std::endl <<
     "}" << std::endl;
 
   of.close();
 }
-
- 
-void writeBatchMatrix(
-  const std::string &prefix,
-  const KmerIndex &index,
-  const std::vector<std::string> &ids,
-  std::vector<std::vector<int>> &counts) {
-
-    std::string ecfilename = prefix + ".ec";
-    std::string countsfilename = prefix + ".tsv";
-    std::string cellnamesfilename = prefix + ".cells";
-
-    std::ofstream ecof, countsof, cellsof;
-    ecof.open(ecfilename.c_str(), std::ios::out);
-    // output equivalence classes in the form "EC TXLIST";
-    for (int i = 0; i < index.ecmap.size(); i++) {
-      ecof << i << "\t";
-      // output the rest of the class
-      const auto &v = index.ecmap[i];
-      bool first = true;
-      for (auto x : v) {
-        if (!first) {
-          ecof << ",";
-        } else {
-          first = false;
-        }
-        ecof << x;
-      }
-      ecof << "\n";
-    }
-    ecof.close();
-
-    // write cell ids, one line per id
-    cellsof.open(cellnamesfilename.c_str(), std::ios::out);
-    for (int j = 0; j < ids.size(); j++) {
-      cellsof << ids[j] << "\n";
-    }
-    cellsof.close();
-    
-    countsof.open(countsfilename.c_str(), std::ios::out);
-    if (!counts.empty()) {      
-      for (int j = 0; j < counts.size(); j++) {
-        const auto &v = counts[j];
-        for (int i = 0; i < v.size(); i++) {
-          if (v[i] != 0) {
-            countsof << i << "\t" << j << "\t" << v[i] << "\n";
-          }
-        }
-      }
-    }
-    countsof.close();
-
-}
@@ -10,6 +10,10 @@
 #include <vector>
 
 #include "KmerIndex.h"
+#include "RunStats.h"
+
+std::vector<double> counts_to_tpm(const std::vector<double>& est_counts,
+    const std::vector<double>& eff_lens);
 
 void plaintext_writer(
     const std::string& out_name,
@@ -19,6 +23,15 @@ void plaintext_writer(
     const std::vector<int>& lens
     );
 
+void plaintext_bootstrap_summary(
+    const std::string& out_name,
+    const std::vector<std::string>& targ_ids,
+    const std::vector<double>& mean,
+    const std::vector<double>& var,
+    const std::vector<std::string>& quantile_names,
+    const std::vector<std::vector<double>>& quantiles
+    );
+
 std::string to_json(const std::string& id, const std::string& val, bool quote,
     bool comma = true, int level = 1);
 
@@ -30,12 +43,7 @@ void plaintext_aux(
     const std::string& version,
     const std::string& index_v,
     const std::string& start_time,
-    const std::string& call);
-
-void writeBatchMatrix(
-  const std::string &prefix,
-  const KmerIndex &index,
-  const std::vector<std::string> &ids,
-  std::vector<std::vector<int>> &counts);
+    const std::string& call,
+    const RunStats* stats = nullptr);
 
 #endif
@@ -18,6 +18,66 @@
 #include "kseq.h"
 #include "PseudoBam.h"
 
+#include <chrono>
+#include <cstdio>
+
+// the counters of the worker running on this thread, with --lock-stats
+static thread_local WorkerLockStats* worker_locks = nullptr;
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// only the owning worker writes its counters, no need for an atomic add
+static void addCount(std::atomic<uint64_t>& a, uint64_t n) {
+  a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// a lock on one of the mutexes of the read processing that, when the worker
+// counts with --lock-stats, records how long it waited for and held it
+class CountedLock {
+public:
+  CountedLock(std::mutex& m, LockCounters WorkerLockStats::*which)
+    : lock_(m, std::defer_lock), counters_(nullptr), acquired_(0) {
+    if (worker_locks == nullptr) {
+      lock_.lock();
+      return;
+    }
+    counters_ = &(worker_locks->*which);
+    uint64_t t = now_ns();
+    lock_.lock();
+    acquired_ = now_ns();
+    addCount(counters_->acquisitions, 1);
+    addCount(counters_->wait_ns, acquired_ - t);
+  }
+
+  ~CountedLock() {
+    if (counters_ != nullptr) {
+      addCount(counters_->hold_ns, now_ns() - acquired_);
+    }
+  }
+
+  // the lock is released while waiting, which is neither holding it nor
+  // contention for it
+  void wait(std::condition_variable& cv) {
+    if (counters_ == nullptr) {
+      cv.wait(lock_);
+      return;
+    }
+    uint64_t t = now_ns();
+    addCount(counters_->hold_ns, t - acquired_);
+    cv.wait(lock_);
+    acquired_ = now_ns();
+    addCount(worker_locks->stalled_ns, acquired_ - t);
+  }
+
+private:
+  std::unique_lock<std::mutex> lock_;
+  LockCounters* counters_;
+  uint64_t acquired_;
+};
+
 
 void printVector(const std::vector<int>& v, std::ostream& o) {
   o << "[";
@@ -64,7 +124,115 @@ int findFirstMappingKmer(const std::vector<std::pair<KmerEntry,int>> &v,KmerEntr
   return p;
 }
 
-int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc, std::vector<std::vector<int>> &batchCounts) {
+void pseudoalignFragment(const KmerIndex& index, const MinCollector& tc, const ProgramOptions& opt,
+    const char* s1, int l1, const char* s2, int l2, bool paired,
+    std::vector<std::pair<KmerEntry,int>>& v1, std::vector<std::pair<KmerEntry,int>>& v2,
+    std::vector<int>& u, std::vector<int>& vtmp) {
+  index.match(s1,l1, v1);
+  if (paired) {
+    index.match(s2,l2, v2);
+  }
+
+  // collect the target information
+  tc.intersectKmers(v1, v2, !paired, u);
+
+  /* --  possibly modify the pseudoalignment  -- */
+
+  // If we have paired end reads where one end maps or single end reads, check if some transcsripts
+  // are not compatible with the mean fragment length
+  if (!opt.umi && !u.empty() && (!paired || v1.empty() || v2.empty()) && tc.has_mean_fl) {
+    vtmp.clear();
+    // inspect the positions
+    int fl = (int) tc.get_mean_frag_len();
+    int p = -1;
+    KmerEntry val;
+    Kmer km;
+
+    if (!v1.empty()) {
+      p = findFirstMappingKmer(v1,val);
+      km = Kmer((s1+p));
+    }
+    if (!v2.empty()) {
+      p = findFirstMappingKmer(v2,val);
+      km = Kmer((s2+p));
+    }
+
+    // for each transcript in the pseudoalignment
+    for (auto tr : u) {
+      auto x = index.findPosition(tr, km, val, p);
+      // if the fragment is within bounds for this transcript, keep it
+      if (x.second && x.first + fl <= index.target_lens_[tr]) {
+        vtmp.push_back(tr);
+      } else {
+        //pass
+      }
+      if (!x.second && x.first - fl >= 0) {
+        vtmp.push_back(tr);
+      } else {
+        //pass
+      }
+    }
+
+    if (vtmp.size() < u.size()) {
+      u = vtmp; // copy
+    }
+  }
+  
+  if (opt.strand_specific && !u.empty()) {
+    int p = -1;
+    Kmer km;
+    KmerEntry val;
+    if (!v1.empty()) {
+      vtmp.clear();
+      bool firstStrand = (opt.strand == ProgramOptions::StrandType::FR); // FR have first read mapping forward
+      p = findFirstMappingKmer(v1,val);
+      km = Kmer((s1+p));
+      bool strand = (val.isFw() == (km == km.rep())); // k-mer maps to fw strand?
+      // might need to optimize this
+      const auto &c = index.dbGraph.contigs[val.contig];
+      for (auto tr : u) {
+        for (auto ctx : c.transcripts) {
+          if (tr == ctx.trid) {
+            if ((strand == ctx.sense) == firstStrand) {
+              // swap out 
+              vtmp.push_back(tr);
+            } 
+            break;
+          }
+        }          
+      }
+      if (vtmp.size() < u.size()) {
+        u = vtmp; // copy
+      }
+    }
+    
+    if (!v2.empty()) {
+      vtmp.clear();
+      bool secondStrand = (opt.strand == ProgramOptions::StrandType::RF);
+      p = findFirstMappingKmer(v2,val);
+      km = Kmer((s2+p));
+      bool strand = (val.isFw() == (km == km.rep())); // k-mer maps to fw strand?
+      // might need to optimize this
+      const auto &c = index.dbGraph.contigs[val.contig];
+      for (auto tr : u) {
+        for (auto ctx : c.transcripts) {
+          if (tr == ctx.trid) {
+            if ((strand == ctx.sense) == secondStrand) {
+              // swap out 
+              vtmp.push_back(tr);
+            } 
+            break;
+          }
+        }          
+      }
+      if (vtmp.size() < u.size()) {
+        u = vtmp; // copy
+      }
+    }
+  }
+}
+
+int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc, RunStats* stats) {
   int limit = 1048576; 
   std::vector<std::pair<const char*, int>> seqs;
   seqs.reserve(limit/50);
@@ -86,8 +254,10 @@ int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector&
   }
 
   for (const auto& fs : opt.batch_files) { 
-    for (int i = 0; i < fs.size(); i += (paired) ? 2 : 1) {
-      if (paired) {
+    for (int i = 0; i < fs.size(); i += (paired && !opt.interleaved) ? 2 : 1) {
+      if (opt.interleaved) {
+        std::cerr << "[quant] will process interleaved file " << i+1 << ": " << fs[i] << std::endl;
+      } else if (paired) {
         std::cerr << "[quant] will process pair " << (i/2 +1) << ": "  << fs[i] << std::endl
                   << "                             " << fs[i+1] << std::endl;
       } else {
@@ -96,16 +266,24 @@ int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector&
     }
   }
   
-  std::cerr << "[quant] finding pseudoalignments for all files ..."; std::cerr.flush();
+  std::cerr << "[quant] finding pseudoalignments for all files ...";
+  if (opt.progress_interval > 0) {
+    std::cerr << std::endl;
+  }
+  std::cerr.flush();
   
 
-  MasterProcessor MP(index, opt, tc);
+  double start = wall_seconds();
+  MasterProcessor MP(index, opt, tc, stats);
   MP.processReads();
   numreads = MP.numreads;
+  if (stats != nullptr) {
+    stats->num_reads += numreads;
+    stats->reads_wall += wall_seconds() - start;
+  }
   nummapped = MP.nummapped;
-  batchCounts = std::move(MP.batchCounts);
 
-  std::cerr << " done" << std::endl;
+  std::cerr << ((opt.progress_interval > 0) ? "[quant] done" : " done") << std::endl;
 
   if (opt.bias) {
     std::cerr << "[quant] learning parameters for sequence specific bias" << std::endl;
@@ -118,13 +296,19 @@ int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector&
   } else {
     std::cerr << ", " << pretty_num(MP.num_umi) << " unique UMIs mapped" << std::endl;
   }
+  if (opt.lock_stats) {
+    MP.reportLockStats(std::cerr, true);
+    if (stats != nullptr) {
+      MP.addLockStats(*stats);
+    }
+  }
 
   return numreads;
   
 
 }
 
-int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc) {
+int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc, RunStats* stats) {
 
   int limit = 1048576;
   std::vector<std::pair<const char*, int>> seqs;
@@ -154,8 +338,10 @@ int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc)
     std::cerr << "[quant] running in single-end mode" << std::endl;
   }
 
-  for (int i = 0; i < opt.files.size(); i += (paired) ? 2 : 1) {
-    if (paired) {
+  for (int i = 0; i < opt.files.size(); i += (paired && !opt.interleaved) ? 2 : 1) {
+    if (opt.interleaved) {
+      std::cerr << "[quant] will process interleaved file " << i+1 << ": " << opt.files[i] << std::endl;
+    } else if (paired) {
       std::cerr << "[quant] will process pair " << (i/2 +1) << ": "  << opt.files[i] << std::endl
                 << "                             " << opt.files[i+1] << std::endl;
     } else {
@@ -164,18 +350,23 @@ int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc)
   }
 
   // for each file
-  std::cerr << "[quant] finding pseudoalignments for the reads ..."; std::cerr.flush();
-
-  if (opt.pseudobam) {
-    index.writePseudoBamHeader(std::cout);
+  std::cerr << "[quant] finding pseudoalignments for the reads ...";
+  if (opt.progress_interval > 0) {
+    std::cerr << std::endl;
   }
+  std::cerr.flush();
 
-  MasterProcessor MP(index, opt, tc);
+  double start = wall_seconds();
+  MasterProcessor MP(index, opt, tc, stats);
   MP.processReads();
   numreads = MP.numreads;
+  if (stats != nullptr) {
+    stats->num_reads += numreads;
+    stats->reads_wall += wall_seconds() - start;
+  }
   nummapped = MP.nummapped;
 
-  std::cerr << " done" << std::endl;
+  std::cerr << ((opt.progress_interval > 0) ? "[quant] done" : " done") << std::endl;
 
   //std::cout << "betterCount = " << betterCount << ", out of betterCand = " << betterCand << std::endl;
 
@@ -185,6 +376,12 @@ int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc)
 
   std::cerr << "[quant] processed " << pretty_num(numreads) << " reads, "
     << pretty_num(nummapped) << " reads pseudoaligned" << std::endl;
+  if (opt.lock_stats) {
+    MP.reportLockStats(std::cerr, true);
+    if (stats != nullptr) {
+      MP.addLockStats(*stats);
+    }
+  }
 
   /*
   for (int i = 0; i < 4096; i++) {
@@ -206,9 +403,114 @@ int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc)
 
 /** -- read processors -- **/
 
+// adds the (ec, count) pairs in add to c, both sorted by ec
+static void mergeSparseCounts(std::vector<std::pair<int, int>>& c, const std::vector<std::pair<int, int>>& add) {
+  if (add.empty()) {
+    return;
+  }
+  if (c.empty() || c.back().first < add.front().first) {
+    c.insert(c.end(), add.begin(), add.end());
+    return;
+  }
+  std::vector<std::pair<int, int>> merged;
+  merged.reserve(c.size() + add.size());
+  auto a = c.begin();
+  auto b = add.begin();
+  while (a != c.end() && b != add.end()) {
+    if (a->first < b->first) {
+      merged.push_back(*a++);
+    } else if (b->first < a->first) {
+      merged.push_back(*b++);
+    } else {
+      merged.push_back({a->first, a->second + b->second});
+      ++a;
+      ++b;
+    }
+  }
+  merged.insert(merged.end(), a, c.end());
+  merged.insert(merged.end(), b, add.end());
+  c.swap(merged);
+}
+
+// counts the distinct umis of every ec as (ec, count) pairs sorted by ec
+static std::vector<std::pair<int, int>> countUniqueUmis(std::vector<std::pair<int, uint64_t>>& umis) {
+  std::vector<std::pair<int, int>> counts;
+  std::sort(umis.begin(), umis.end());
+  for (size_t j = 0; j < umis.size(); j++) {
+    if (j > 0 && umis[j-1] == umis[j]) {
+      continue;
+    }
+    if (counts.empty() || counts.back().first != umis[j].first) {
+      counts.push_back({umis[j].first, 0});
+    }
+    ++counts.back().second;
+  }
+  return counts;
+}
+
 void MasterProcessor::processReads() {
+  if (opt.lock_stats) {
+    for (int i = 0; i < opt.threads; i++) {
+      lock_stats.emplace_back(new WorkerLockStats());
+    }
+  }
+
+  // the progress, and with --verbose the lock counters, are reported from a
+  // thread of their own, which only reads the counters of the workers
+  bool report_locks = opt.lock_stats && opt.verbose;
+  int interval = (opt.progress_interval == 0 && report_locks) ? 10 : opt.progress_interval;
+  double start = wall_seconds(), last = start;
+  uint64_t last_reads = 0;
+  std::mutex report_lock;
+  std::condition_variable report_cv;
+  bool report_done = false;
+  std::thread reporter;
+  if (interval > 0) {
+    reporter = std::thread([&]() {
+      std::unique_lock<std::mutex> lock(report_lock);
+      while (!report_cv.wait_for(lock, std::chrono::seconds(interval), [&]() { return report_done; })) {
+        if (opt.progress_interval > 0) {
+          reportProgress(start, last, last_reads, false);
+        }
+        if (report_locks) {
+          reportLockStats(std::cerr, false);
+        }
+      }
+    });
+  }
+
   // start worker threads
   if (!opt.batch_mode) {
+    std::string bamfn = opt.output + "/pseudoalignments.bam";
+    if (opt.pseudobam) {
+      std::string header;
+      if (opt.genomebam) {
+        if (!model.parseGTF(opt.gtf, index, opt.chrom_sizes)) {
+          exit(1);
+        }
+        if (model.num_missing > 0) {
+          std::cerr << std::endl << "[~warn] " << model.num_missing << " targets are not in the GTF file or do not match it,"
+                    << " their pseudoalignments are not projected" << std::endl;
+        }
+        header = genomeBamHeader(model, opt.sortedbam);
+      } else {
+        header = pseudoBamHeader(index, opt.sortedbam);
+      }
+      bool ok;
+      if (opt.sortedbam) {
+        ok = bamsorter.open(bamfn, header, opt.genomebam ? model.chr_lens : index.target_lens_, opt.threads);
+      } else {
+        ok = bamfile.open(bamfn, opt.threads);
+        if (ok) {
+          bamfile.write(header.data(), header.size());
+        }
+      }
+      if (!ok) {
+        std::cerr << "Error: could not open file " << bamfn << " for writing" << std::endl;
+        exit(1);
+      }
+    }
+
     std::vector<std::thread> workers;
     for (int i = 0; i < opt.threads; i++) {
       workers.emplace_back(std::thread(ReadProcessor(index,opt,tc,*this)));
@@ -219,6 +521,18 @@ void MasterProcessor::processReads() {
       workers[i].join(); //wait for them to finish
     }
 
+    if (opt.sortedbam) {
+      if (!bamsorter.close()) {
+        std::cerr << "Error: could not write sorted file " << bamfn << std::endl;
+        exit(1);
+      }
+    } else if (opt.pseudobam) {
+      if (!bamfile.close()) {
+        std::cerr << "Error: could not write file " << bamfn << std::endl;
+        exit(1);
+      }
+    }
+
     // now handle the modification of the mincollector
     for (auto &t : newECcount) {
       if (t.second <= 0) {
@@ -231,124 +545,194 @@ void MasterProcessor::processReads() {
       }
     }
   } else {
+    if (!matrixwriter.open(opt.output + "/matrix", opt.batch_ids, opt.matrix_h5)) {
+      std::cerr << "Error: could not open the matrix files in " << opt.output << " for writing" << std::endl;
+      exit(1);
+    }
+
     std::vector<std::thread> workers;
-    int num_ids = opt.batch_ids.size();
-    int id =0;
-    while (id < num_ids) {
-      // TODO: put in thread pool
-      workers.clear();
-      int nt = std::min(opt.threads, (num_ids - id));
-      for (int i = 0; i < nt; i++,id++) {
-        workers.emplace_back(std::thread(ReadProcessor(index, opt, tc, *this, id)));
-      }
-      
-      for (int i = 0; i < nt; i++) {
-        workers[i].join();
-      }
-      
-      if (opt.umi) {
-        // process the regular EC umi now
-        for (int i = 0; i < nt; i++) {
-          int l_id = id - nt + i;
-          auto &umis = batchUmis[l_id];
-          std::sort(umis.begin(), umis.end());
-          size_t sz = umis.size();
-          nummapped += sz;
-          if (sz > 0) {
-            ++batchCounts[l_id][umis[0].first];
-          }
-          for (int j = 1; j < sz; j++) {
-            if (umis[j-1] != umis[j]) {
-              ++batchCounts[l_id][umis[j].first];
-            }
-          }
-          umis.clear();
-        }
-      }
+    for (int i = 0; i < opt.threads; i++) {
+      workers.emplace_back(std::thread(ReadProcessor(index, opt, tc, *this)));
     }
-    
-    int num_newEcs = 0;
-    if (!opt.umi) {      
-      // for each cell
-      for (int id = 0; id < num_ids; id++) {
-        // for each new ec
-        for (auto &t : newBatchECcount[id]) {
-          // add the ec and count number of new ecs
-          if (t.second <= 0) {
-            continue;          
-          }
-          int ecsize = index.ecmap.size();
-          int ec = tc.increaseCount(t.first);
-          if (ec != -1 && ecsize < index.ecmap.size()) {          
-            num_newEcs++; 
-          }
-        }
-      }
-      // for each cell
-      for (int id = 0; id < num_ids; id++) {
-        auto& c = batchCounts[id];
-        c.resize(c.size() + num_newEcs,0);
-        // for each new ec
-        for (auto &t : newBatchECcount[id]) {
-          // count the ec
-          if (t.second <= 0) {
-            continue;
-          }
-          int ec = tc.findEC(t.first);
-          assert(ec != -1);
-          ++c[ec];
-        }
-      }
-    } else {
-      // UMI case
-      // for each cell
-      for (int id = 0; id < num_ids; id++) {
-        // for each new ec
-        for (auto &t : newBatchECumis[id]) {
-          // add the new ec
-          int ecsize = index.ecmap.size();
-          int ec = tc.increaseCount(t.first);
-          if (ec != -1 && ecsize < index.ecmap.size()) {
-            num_newEcs++;  
-          }
+    for (int i = 0; i < opt.threads; i++) {
+      workers[i].join();
+    }
+
+    // the new ecs were numbered after every ec of the index as the cells
+    // were written, add them to the ecmap in that order
+    for (auto &u : batch_newEcs) {
+      int ec = tc.increaseCount(u);
+      assert(ec == tc.counts.size() - 1);
+    }
+    if (!matrixwriter.close(index)) {
+      std::cerr << "Error: could not write the matrix files in " << opt.output << std::endl;
+      exit(1);
+    }
+  }
+
+  if (reporter.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(report_lock);
+      report_done = true;
+    }
+    report_cv.notify_one();
+    reporter.join();
+  }
+  if (!opt.status_file.empty()) {
+    reportProgress(start, last, last_reads, true);
+  }
+}
+
+void MasterProcessor::reportProgress(double start, double& last, uint64_t& last_reads, bool done) {
+  double now = wall_seconds();
+  uint64_t reads = progress_reads.load(std::memory_order_relaxed);
+  uint64_t mapped = progress_mapped.load(std::memory_order_relaxed);
+  double rate = (now > start) ? reads / (now - start) : 0.0;
+  double current = (now > last) ? (reads - last_reads) / (now - last) : 0.0;
+  double pct = (reads > 0) ? 100.0 * mapped / reads : 0.0;
+  last = now;
+  last_reads = reads;
+  int cells = 0;
+  if (opt.batch_mode) {
+    std::lock_guard<std::mutex> lock(reader_lock);
+    cells = batch_written;
+  }
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.1f", pct);
+  if (!done) {
+    std::cerr << "[quant] " << pretty_num((size_t) reads) << " reads processed, " << buf
+              << "% pseudoaligned, " << pretty_num((size_t) rate) << " reads/s ("
+              << pretty_num((size_t) current) << " recently)";
+    if (opt.batch_mode) {
+      std::cerr << ", " << pretty_num(cells) << " of " << pretty_num((int) opt.batch_ids.size())
+                << " cells done";
+    }
+    std::cerr << std::endl;
+  }
+
+  if (opt.status_file.empty()) {
+    return;
+  }
+  // written next to it and renamed, so a monitor never sees half a file
+  std::string tmp = opt.status_file + ".tmp";
+  std::ofstream of(tmp);
+  of << "{\n"
+     << "\t\"state\": \"" << ((done) ? "pseudoaligned" : "pseudoaligning") << "\",\n"
+     << "\t\"updated\": " << time(nullptr) << ",\n"
+     << "\t\"elapsed_seconds\": " << (int) (now - start) << ",\n"
+     << "\t\"n_processed\": " << reads << ",\n"
+     << "\t\"n_pseudoaligned\": " << mapped << ",\n"
+     << "\t\"p_pseudoaligned\": " << buf << ",\n";
+  if (opt.batch_mode) {
+    of << "\t\"n_cells\": " << opt.batch_ids.size() << ",\n"
+       << "\t\"n_cells_done\": " << cells << ",\n";
+  }
+  of << "\t\"reads_per_second\": " << (uint64_t) rate << ",\n"
+     << "\t\"current_reads_per_second\": " << (uint64_t) current << "\n"
+     << "}\n";
+  of.close();
+  if (!of || rename(tmp.c_str(), opt.status_file.c_str()) != 0) {
+    std::cerr << "[~warn] could not write the status file " << opt.status_file << std::endl;
+  }
+}
+
+// the locks counted with --lock-stats, the cell locks only in batch mode
+static const char* lock_names[] = {"reader_lock", "writer_lock", "cell_lock"};
+static LockCounters WorkerLockStats::*lock_counters[] = {&WorkerLockStats::reader,
+  &WorkerLockStats::writer, &WorkerLockStats::cell};
+
+void MasterProcessor::reportLockStats(std::ostream& o, bool per_worker) const {
+  int num_locks = (opt.batch_mode) ? 3 : 2;
+  char buf[128];
+
+  uint64_t batches = 0, batch_reads = 0, min_batch = 0, max_batch = 0, update_ns = 0, stalled_ns = 0;
+  for (auto& w : lock_stats) {
+    if (w->batches > 0) {
+      min_batch = (batches == 0) ? w->min_batch.load() : std::min(min_batch, (uint64_t) w->min_batch);
+      max_batch = std::max(max_batch, (uint64_t) w->max_batch);
+    }
+    batches += w->batches;
+    batch_reads += w->batch_reads;
+    update_ns += w->update_ns;
+    stalled_ns += w->stalled_ns;
+  }
+
+  if (per_worker) {
+    o << "[locks] lock         thread  acquisitions    wait (s)    hold (s)  update (s)" << std::endl;
+    for (int l = 0; l < num_locks; l++) {
+      for (size_t i = 0; i < lock_stats.size(); i++) {
+        const WorkerLockStats& w = *lock_stats[i];
+        const LockCounters& c = w.*lock_counters[l];
+        snprintf(buf, sizeof(buf), "%-12s %6zu %13s %11.3f %11.3f", lock_names[l], i,
+          pretty_num((size_t) c.acquisitions.load()).c_str(), c.wait_ns * 1e-9, c.hold_ns * 1e-9);
+        o << "[locks] " << buf;
+        if (l == 1) {
+          snprintf(buf, sizeof(buf), " %11.3f", w.update_ns * 1e-9);
+          o << buf;
         }
+        o << std::endl;
       }
-      // for each cell
-      for (int id = 0; id < num_ids; id++) {
-        auto& c = batchCounts[id];
-        c.resize(c.size() + num_newEcs,0);
-        std::vector<std::pair<int, std::string>> umis;
-        umis.reserve(newBatchECumis[id].size());
-        // for each new ec
-        for (auto &t : newBatchECumis[id]) {
-          // record the ec,umi          
-          int ec = tc.findEC(t.first);
-          umis.push_back({ec, std::move(t.second)});
-        }
-        // find unique umis per ec
-        std::sort(umis.begin(), umis.end());
-        size_t sz = umis.size();
-        if (sz > 0) {
-          ++batchCounts[id][umis[0].first];
-        }
-        for (int j = 1; j < sz; j++) {
-          if (umis[j-1] != umis[j]) {
-            ++batchCounts[id][umis[j].first];
-          }
-        }
-        for (auto x : c) {
-          num_umi += x;
-        }        
+    }
+  } else {
+    if (opt.progress_interval == 0) {
+      // finishes the line of finding pseudoalignments
+      o << std::endl;
+    }
+    o << "[locks]";
+    for (int l = 0; l < num_locks; l++) {
+      uint64_t wait_ns = 0, hold_ns = 0;
+      for (auto& w : lock_stats) {
+        wait_ns += ((*w).*lock_counters[l]).wait_ns;
+        hold_ns += ((*w).*lock_counters[l]).hold_ns;
       }
+      snprintf(buf, sizeof(buf), " %s wait %.3f s hold %.3f s,", lock_names[l], wait_ns * 1e-9, hold_ns * 1e-9);
+      o << buf;
     }
+    snprintf(buf, sizeof(buf), " update %.3f s", update_ns * 1e-9);
+    o << buf << std::endl;
+  }
+
+  if (batches > 0) {
+    o << "[locks] " << pretty_num((size_t) batches) << " batches of reads, "
+      << pretty_num((size_t) (batch_reads / batches)) << " reads on average, between "
+      << pretty_num((size_t) min_batch) << " and " << pretty_num((size_t) max_batch) << std::endl;
+  }
+  if (opt.batch_mode && stalled_ns > 0) {
+    snprintf(buf, sizeof(buf), "%.3f", stalled_ns * 1e-9);
+    o << "[locks] workers waited " << buf << " s for cells to be written" << std::endl;
+  }
+}
+
+void MasterProcessor::addLockStats(RunStats& stats) const {
+  int num_locks = (opt.batch_mode) ? 3 : 2;
+
+  for (int l = 0; l < num_locks; l++) {
+    RunStats::Lock lock;
+    lock.name = lock_names[l];
+    for (auto& w : lock_stats) {
+      const LockCounters& c = (*w).*lock_counters[l];
+      lock.acquisitions.push_back(c.acquisitions);
+      lock.wait.push_back(c.wait_ns * 1e-9);
+      lock.hold.push_back(c.hold_ns * 1e-9);
+    }
+    stats.locks.push_back(lock);
+  }
+  for (auto& w : lock_stats) {
+    if (w->batches > 0) {
+      stats.min_batch = (stats.num_batches == 0) ? w->min_batch.load() : std::min(stats.min_batch, (size_t) w->min_batch);
+      stats.max_batch = std::max(stats.max_batch, (size_t) w->max_batch);
+    }
+    stats.num_batches += w->batches;
   }
 }
 
 void MasterProcessor::update(const std::vector<int>& c, const std::vector<std::vector<int> > &newEcs, 
-                            std::vector<std::pair<int, std::string>>& ec_umi, std::vector<std::pair<std::vector<int>, std::string>> &new_ec_umi, 
-                            int n, std::vector<int>& flens, std::vector<int> &bias, int id) {
+                            std::vector<std::pair<int, uint64_t>>& ec_umi, std::vector<std::pair<std::vector<int>, uint64_t>> &new_ec_umi, 
+                            int n, std::vector<int>& flens, std::vector<int> &bias, BatchCell* cell) {
   // acquire the writer lock
-  std::lock_guard<std::mutex> lock(this->writer_lock);
+  CountedLock lock(this->writer_lock, &WorkerLockStats::writer);
+  int mapped_before = nummapped;
 
   if (!opt.batch_mode) {
     for (int i = 0; i < c.size(); i++) {
@@ -357,14 +741,17 @@ void MasterProcessor::update(const std::vector<int>& c, const std::vector<std::v
     }
   } else {
     if (!opt.umi) {
+      std::vector<std::pair<int, int>> nz;
       for (int i = 0; i < c.size(); i++) {
-        batchCounts[id][i] += c[i];
-        nummapped += c[i];
+        if (c[i] != 0) {
+          nz.push_back({i, c[i]});
+          nummapped += c[i];
+        }
       }
+      mergeSparseCounts(cell->counts, nz);
     } else {
-      for (auto &t : ec_umi) {
-        batchUmis[id].push_back(std::move(t));
-      }
+      cell->umis.insert(cell->umis.end(), ec_umi.begin(), ec_umi.end());
+      nummapped += ec_umi.size();
     }    
   }
 
@@ -375,11 +762,11 @@ void MasterProcessor::update(const std::vector<int>& c, const std::vector<std::v
   } else {
     if (!opt.umi) {
       for(auto &u : newEcs) {
-        ++newBatchECcount[id][u];
+        ++cell->newECcount[u];
       }
     } else {
       for (auto &u : new_ec_umi) {
-        newBatchECumis[id].push_back(std::move(u));
+        cell->newECumis.push_back(std::move(u));
       }
     }
   }
@@ -410,24 +797,192 @@ void MasterProcessor::update(const std::vector<int>& c, const std::vector<std::v
   }
 
   numreads += n;
+  progress_reads.fetch_add(n, std::memory_order_relaxed);
+  progress_mapped.fetch_add(nummapped - mapped_before, std::memory_order_relaxed);
   // releases the lock
 }
 
-ReadProcessor::ReadProcessor(const KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp, int _id) :
- paired(!opt.single_end), tc(tc), index(index), mp(mp), id(_id) {
+void MasterProcessor::writeBam(const std::string& bam) {
+  if (opt.sortedbam) {
+    bamsorter.add(bam.data(), bam.size());
+  } else {
+    bamfile.write(bam.data(), bam.size());
+  }
+}
+
+std::shared_ptr<BatchCell> MasterProcessor::nextBatchCell(const std::shared_ptr<BatchCell>& cur) {
+  CountedLock lock(this->reader_lock, &WorkerLockStats::reader);
+
+  if (cur && !cur->drained) {
+    ++cur->readers;
+    return cur;
+  }
+
+  int num_ids = opt.batch_ids.size();
+  int max_unwritten = 4 * opt.threads;
+  while (true) {
+    batch_open.erase(std::remove_if(batch_open.begin(), batch_open.end(),
+      [](const std::shared_ptr<BatchCell>& c) { return (bool) c->drained; }), batch_open.end());
+
+    std::shared_ptr<BatchCell> next;
+    if (batch_open.size() < opt.threads && batch_next < num_ids
+        && batch_next - batch_written < max_unwritten) {
+      // open the next cell
+      int id = batch_next++;
+      next = std::make_shared<BatchCell>(id);
+      next->SR.files = opt.batch_files[id];
+      if (opt.umi) {
+        next->SR.umi_files = {opt.umi_files[id]};
+      }
+      next->SR.paired = !opt.single_end;
+      next->SR.interleaved = opt.interleaved;
+      batch_open.push_back(next);
+    } else {
+      // help out with the open cell that has the fewest readers
+      for (auto &c : batch_open) {
+        if (!next || c->readers < next->readers) {
+          next = c;
+        }
+      }
+    }
+    if (next) {
+      ++next->readers;
+      return next;
+    }
+    if (batch_next == num_ids) {
+      return next; // nothing left to read
+    }
+    // too many cells are waiting to be written, wait for the oldest one
+    lock.wait(batch_cv);
+  }
+}
+
+void MasterProcessor::doneBatchChunk(const std::shared_ptr<BatchCell>& cell) {
+  {
+    CountedLock lock(this->reader_lock, &WorkerLockStats::reader);
+    // the last reader of a drained cell finishes it
+    if (--cell->readers > 0 || !cell->drained) {
+      return;
+    }
+  }
+  finishBatchCell(cell);
+}
+
+void MasterProcessor::finishBatchCell(const std::shared_ptr<BatchCell>& cell) {
+  if (opt.umi) {
+    // all the reads of the cell are in, count the regular EC umis now
+    cell->counts = countUniqueUmis(cell->umis);
+    std::vector<std::pair<int, uint64_t>>().swap(cell->umis);
+  }
+
+  std::lock_guard<std::mutex> lock(this->batch_lock);
+  if (cell->id != batch_written) {
+    // an earlier cell is still being processed
+    batch_pending.insert({cell->id, cell});
+    return;
+  }
+
+  writeBatchCell(*cell);
+
+  // write everything that was waiting on this cell
+  auto it = batch_pending.begin();
+  while (it != batch_pending.end() && it->first == batch_written) {
+    writeBatchCell(*it->second);
+    it = batch_pending.erase(it);
+  }
+}
+
+void MasterProcessor::writeBatchCell(BatchCell& cell) {
+  // new ecs are numbered in the order they are first written, so that
+  // every cell written before stays valid. Within a cell they are taken
+  // in sorted order, which doesn't depend on the threads
+  auto newEcId = [this](const std::vector<int>& u) {
+    auto it = batch_newEcIds.find(u);
+    if (it != batch_newEcIds.end()) {
+      return it->second;
+    }
+    int ec = tc.counts.size() + batch_newEcs.size();
+    batch_newEcIds.insert({u, ec});
+    batch_newEcs.push_back(u);
+    return ec;
+  };
+
+  if (!opt.umi) {
+    std::vector<const std::vector<int>*> newEcs;
+    for (auto &t : cell.newECcount) {
+      if (t.second > 0) {
+        newEcs.push_back(&t.first);
+      }
+    }
+    std::sort(newEcs.begin(), newEcs.end(),
+      [](const std::vector<int>* a, const std::vector<int>* b) { return *a < *b; });
+    std::vector<std::pair<int, int>> c;
+    for (auto u : newEcs) {
+      c.push_back({newEcId(*u), 1});
+    }
+    std::sort(c.begin(), c.end());
+    mergeSparseCounts(cell.counts, c);
+  } else {
+    std::sort(cell.newECumis.begin(), cell.newECumis.end());
+    std::vector<std::pair<int, uint64_t>> umis;
+    umis.reserve(cell.newECumis.size());
+    for (auto &t : cell.newECumis) {
+      umis.push_back({newEcId(t.first), t.second});
+    }
+    // find unique umis per ec
+    mergeSparseCounts(cell.counts, countUniqueUmis(umis));
+    for (auto &x : cell.counts) {
+      num_umi += x.second;
+    }
+  }
+
+  matrixwriter.write(cell.counts);
+
+  // release everything the cell held on to
+  std::vector<std::pair<int, int>>().swap(cell.counts);
+  std::unordered_map<std::vector<int>, int, SortedVectorHasher>().swap(cell.newECcount);
+  std::vector<std::pair<std::vector<int>, uint64_t>>().swap(cell.newECumis);
+
+  {
+    CountedLock lock(this->reader_lock, &WorkerLockStats::reader);
+    ++batch_written;
+  }
+  batch_cv.notify_all();
+}
+
+void MasterProcessor::writePseudoBam(int batch_id, std::string& bam) {
+  std::unique_lock<std::mutex> lock(this->pseudobam_lock);
+
+  if (batch_id != pseudobam_id) {
+    // an earlier batch is still being processed. The batch being waited
+    // for never blocks here, so this always moves on
+    int max_pending = 4 * opt.threads;
+    pseudobam_cv.wait(lock, [&] { return batch_id - pseudobam_id < max_pending; });
+    if (batch_id != pseudobam_id) {
+      pseudobam_pending.insert({batch_id, std::move(bam)});
+      return;
+    }
+  }
+
+  writeBam(bam);
+  ++pseudobam_id;
+
+  // flush everything that was waiting on this batch
+  auto it = pseudobam_pending.begin();
+  while (it != pseudobam_pending.end() && it->first == pseudobam_id) {
+    writeBam(it->second);
+    ++pseudobam_id;
+    it = pseudobam_pending.erase(it);
+  }
+  pseudobam_cv.notify_all();
+}
+
+ReadProcessor::ReadProcessor(const KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp) :
+ paired(!opt.single_end), tc(tc), index(index), mp(mp), readbatch_id(-1) {
    // initialize buffer
    bufsize = 1ULL<<23;
    buffer = new char[bufsize];
 
-   if (opt.batch_mode) {
-     assert(id != -1);
-     batchSR.files = opt.batch_files[id];
-     if (opt.umi) {
-       batchSR.umi_files = {opt.umi_files[id]};
-     }
-     batchSR.paired = !opt.single_end;
-   }
-
    seqs.reserve(bufsize/50);
    if (opt.umi) {
     umis.reserve(bufsize/50);
@@ -442,7 +997,8 @@ ReadProcessor::ReadProcessor(ReadProcessor && o) :
   tc(o.tc),
   index(o.index),
   mp(o.mp),
-  id(o.id),
+  readbatch_id(o.readbatch_id),
+  pseudobam_buf(std::move(o.pseudobam_buf)),
   bufsize(o.bufsize),
   numreads(o.numreads),
   seqs(std::move(o.seqs)),
@@ -452,8 +1008,9 @@ ReadProcessor::ReadProcessor(ReadProcessor && o) :
   newEcs(std::move(o.newEcs)),
   flens(std::move(o.flens)),
   bias5(std::move(o.bias5)),
-  batchSR(std::move(o.batchSR)),
-  counts(std::move(o.counts)) {
+  cell(std::move(o.cell)),
+  counts(std::move(o.counts)),
+  stats(o.stats) {
     buffer = o.buffer;
     o.buffer = nullptr;
     o.bufsize = 0;
@@ -467,33 +1024,120 @@ ReadProcessor::~ReadProcessor() {
 }
 
 void ReadProcessor::operator()() {
+  int worker_id = mp.worker_next++;
+  if (mp.opt.lock_stats) {
+    worker_locks = mp.lock_stats[worker_id].get();
+  }
+  // hardware counters of the pseudoalignment with --profile
+  std::unique_ptr<PerfCounters> perf;
+  size_t perf_reads = 0;
+  if (mp.opt.profile && mp.stats != nullptr) {
+    perf.reset(new PerfCounters());
+  }
+  double start = wall_seconds();
+  double t0 = start, t1;
   while (true) {
     // grab the reader lock
     if (mp.opt.batch_mode) {
-      if (batchSR.empty()) {
-        return;
+      cell = mp.nextBatchCell(cell);
+      if (!cell) {
+        // every cell is read
+        break;
+      }
+      CountedLock lock(cell->lock, &WorkerLockStats::cell);
+      t1 = wall_seconds();
+      stats.waiting += t1 - t0;
+      t0 = t1;
+      if (!cell->drained) {
+        cell->SR.fetchSequences(buffer, bufsize, seqs, names, quals, umis, false);
+        if (cell->SR.empty()) {
+          cell->drained = true;
+        }
       } else {
-        batchSR.fetchSequences(buffer, bufsize, seqs, names, quals, umis, false);
+        // another worker took the last reads
+        seqs.clear();
+        umis.clear();
       }
     } else {
-      std::lock_guard<std::mutex> lock(mp.reader_lock);
+      CountedLock lock(mp.reader_lock, &WorkerLockStats::reader);
+      t1 = wall_seconds();
+      stats.waiting += t1 - t0;
+      t0 = t1;
       if (mp.SR.empty()) {
         // nothing to do
-        return;
+        break;
       } else {
         // get new sequences
         mp.SR.fetchSequences(buffer, bufsize, seqs, names, quals, umis, mp.opt.pseudobam);
+        readbatch_id = mp.readbatch_id++;
       }
       // release the reader lock
     }
+    t1 = wall_seconds();
+    stats.reading += t1 - t0;
+    t0 = t1;
+    if (worker_locks != nullptr && !seqs.empty()) {
+      uint64_t n = paired ? seqs.size()/2 : seqs.size();
+      auto& w = *worker_locks;
+      if (w.batches == 0 || n < w.min_batch) {
+        w.min_batch.store(n, std::memory_order_relaxed);
+      }
+      if (n > w.max_batch) {
+        w.max_batch.store(n, std::memory_order_relaxed);
+      }
+      addCount(w.batches, 1);
+      addCount(w.batch_reads, n);
+    }
 
     // process our sequences
+    if (perf) {
+      perf->start();
+    }
     processBuffer();
+    if (perf) {
+      perf->stop();
+      perf_reads += paired ? seqs.size()/2 : seqs.size();
+    }
+    t1 = wall_seconds();
+    stats.pseudoaligning += t1 - t0;
+    t0 = t1;
+
+    if (mp.opt.pseudobam) {
+      mp.writePseudoBam(readbatch_id, pseudobam_buf);
+      t1 = wall_seconds();
+      stats.writing += t1 - t0;
+      t0 = t1;
+    }
 
     // update the results, MP acquires the lock
-    mp.update(counts, newEcs, ec_umi, new_ec_umi, paired ? seqs.size()/2 : seqs.size(), flens, bias5, id);
+    mp.update(counts, newEcs, ec_umi, new_ec_umi, paired ? seqs.size()/2 : seqs.size(), flens, bias5, cell.get());
+    t1 = wall_seconds();
+    stats.updating += t1 - t0;
+    if (worker_locks != nullptr) {
+      addCount(worker_locks->update_ns, (uint64_t) ((t1 - t0) * 1e9));
+    }
+    t0 = t1;
+    if (mp.opt.batch_mode) {
+      // finished cells are written to the matrix here
+      mp.doneBatchChunk(cell);
+      t1 = wall_seconds();
+      stats.writing += t1 - t0;
+      t0 = t1;
+    }
     clear();
   }
+
+  if (mp.stats != nullptr) {
+    t1 = wall_seconds();
+    stats.waiting += t1 - t0;
+    stats.wall = t1 - start;
+    stats.cpu = thread_cpu_seconds();
+    mp.stats->addThread(worker_id, stats);
+    if (perf) {
+      mp.stats->addProfile("pseudoalignment", "read", perf_reads, *perf);
+    }
+  }
+  worker_locks = nullptr;
 }
 
 void ReadProcessor::processBuffer() {
@@ -541,6 +1185,8 @@ void ReadProcessor::processBuffer() {
   }
 
 
+  const Transcriptome* model = (mp.opt.genomebam) ? &mp.model : nullptr;
+
   // actually process the sequences
   for (int i = 0; i < seqs.size(); i++) {
     s1 = seqs[i].first;
@@ -556,110 +1202,8 @@ void ReadProcessor::processBuffer() {
     v2.clear();
     u.clear();
 
-    // process read
-    index.match(s1,l1, v1);
-    if (paired) {
-      index.match(s2,l2, v2);
-    }
-
-    // collect the target information
+    pseudoalignFragment(index, tc, mp.opt, s1, l1, s2, l2, paired, v1, v2, u, vtmp);
     int ec = -1;
-    int r = tc.intersectKmers(v1, v2, !paired, u);
-
-    /* --  possibly modify the pseudoalignment  -- */
-
-    // If we have paired end reads where one end maps or single end reads, check if some transcsripts
-    // are not compatible with the mean fragment length
-    if (!mp.opt.umi && !u.empty() && (!paired || v1.empty() || v2.empty()) && tc.has_mean_fl) {
-      vtmp.clear();
-      // inspect the positions
-      int fl = (int) tc.get_mean_frag_len();
-      int p = -1;
-      KmerEntry val;
-      Kmer km;
-
-      if (!v1.empty()) {
-        p = findFirstMappingKmer(v1,val);
-        km = Kmer((s1+p));
-      }
-      if (!v2.empty()) {
-        p = findFirstMappingKmer(v2,val);
-        km = Kmer((s2+p));
-      }
-
-      // for each transcript in the pseudoalignment
-      for (auto tr : u) {
-        auto x = index.findPosition(tr, km, val, p);
-        // if the fragment is within bounds for this transcript, keep it
-        if (x.second && x.first + fl <= index.target_lens_[tr]) {
-          vtmp.push_back(tr);
-        } else {
-          //pass
-        }
-        if (!x.second && x.first - fl >= 0) {
-          vtmp.push_back(tr);
-        } else {
-          //pass
-        }
-      }
-
-      if (vtmp.size() < u.size()) {
-        u = vtmp; // copy
-      }
-    }
-    
-    if (mp.opt.strand_specific && !u.empty()) {
-      int p = -1;
-      Kmer km;
-      KmerEntry val;
-      if (!v1.empty()) {
-        vtmp.clear();
-        bool firstStrand = (mp.opt.strand == ProgramOptions::StrandType::FR); // FR have first read mapping forward
-        p = findFirstMappingKmer(v1,val);
-        km = Kmer((s1+p));
-        bool strand = (val.isFw() == (km == km.rep())); // k-mer maps to fw strand?
-        // might need to optimize this
-        const auto &c = index.dbGraph.contigs[val.contig];
-        for (auto tr : u) {
-          for (auto ctx : c.transcripts) {
-            if (tr == ctx.trid) {
-              if ((strand == ctx.sense) == firstStrand) {
-                // swap out 
-                vtmp.push_back(tr);
-              } 
-              break;
-            }
-          }          
-        }
-        if (vtmp.size() < u.size()) {
-          u = vtmp; // copy
-        }
-      }
-      
-      if (!v2.empty()) {
-        vtmp.clear();
-        bool secondStrand = (mp.opt.strand == ProgramOptions::StrandType::RF);
-        p = findFirstMappingKmer(v2,val);
-        km = Kmer((s2+p));
-        bool strand = (val.isFw() == (km == km.rep())); // k-mer maps to fw strand?
-        // might need to optimize this
-        const auto &c = index.dbGraph.contigs[val.contig];
-        for (auto tr : u) {
-          for (auto ctx : c.transcripts) {
-            if (tr == ctx.trid) {
-              if ((strand == ctx.sense) == secondStrand) {
-                // swap out 
-                vtmp.push_back(tr);
-              } 
-              break;
-            }
-          }          
-        }
-        if (vtmp.size() < u.size()) {
-          u = vtmp; // copy
-        }
-      }
-    }
 
     // find the ec
     if (!u.empty()) {
@@ -676,9 +1220,9 @@ void ReadProcessor::processBuffer() {
         }
       } else {       
         if (ec == -1 || ec >= counts.size()) {
-          new_ec_umi.emplace_back(u, std::move(umis[i]));          
+          new_ec_umi.emplace_back(u, umis[i]);          
         } else {
-          ec_umi.emplace_back(ec, std::move(umis[i]));
+          ec_umi.emplace_back(ec, umis[i]);
         }
       }
 
@@ -705,22 +1249,17 @@ void ReadProcessor::processBuffer() {
     // pseudobam
     if (mp.opt.pseudobam) {
       if (paired) {
-        outputPseudoBam(index, u,
+        outputPseudoBam(pseudobam_buf, index, u,
           s1, names[i-1].first, quals[i-1].first, l1, names[i-1].second, v1,
           s2, names[i].first, quals[i].first, l2, names[i].second, v2,
-          paired);
+          paired, model);
       } else {
-        outputPseudoBam(index, u,
+        outputPseudoBam(pseudobam_buf, index, u,
           s1, names[i].first, quals[i].first, l1, names[i].second, v1,
           nullptr, nullptr, nullptr, 0, 0, v2,
-          paired);
+          paired, model);
       }
     }
-
-    /*
-    if (opt.verbose && numreads % 100000 == 0 ) {
-      std::cerr << "[quant] Processed " << pretty_num(numreads) << std::endl;
-    }*/
   }
 
 }
@@ -733,6 +1272,7 @@ void ReadProcessor::clear() {
   counts.resize(tc.counts.size(),0);
   ec_umi.clear();
   new_ec_umi.clear();
+  pseudobam_buf.clear();
 }
 
 
@@ -758,15 +1298,37 @@ SequenceReader::~SequenceReader() {
 
 
 
+// opens a file of reads, - is standard input
+static gzFile openReads(const std::string& fn) {
+  if (fn == "-") {
+    return gzdopen(fileno(stdin), "r");
+  }
+  return gzopen(fn.c_str(), "r");
+}
+
+// reads the mate of the pair in seq1 from an interleaved file into seq2. seq2
+// only lends its strings: the record is read through seq1 and swapped over
+static int readInterleavedMate(kseq_t* seq1, kseq_t* seq2) {
+  std::swap(seq1->name, seq2->name);
+  std::swap(seq1->comment, seq2->comment);
+  std::swap(seq1->seq, seq2->seq);
+  std::swap(seq1->qual, seq2->qual);
+  int l = kseq_read(seq1);
+  std::swap(seq1->name, seq2->name);
+  std::swap(seq1->comment, seq2->comment);
+  std::swap(seq1->seq, seq2->seq);
+  std::swap(seq1->qual, seq2->qual);
+  return l;
+}
+
 // returns true if there is more left to read from the files
 bool SequenceReader::fetchSequences(char *buf, const int limit, std::vector<std::pair<const char *, int> > &seqs,
   std::vector<std::pair<const char *, int> > &names,
   std::vector<std::pair<const char *, int> > &quals,
-  std::vector<std::string> &umis, 
+  std::vector<uint64_t> &umis, 
   bool full) {
     
   std::string line;
-  std::string umi;
   
     
   seqs.clear();
@@ -801,13 +1363,16 @@ bool SequenceReader::fetchSequences(char *buf, const int limit, std::vector<std:
         }
         
         // open the next one
-        fp1 = gzopen(files[current_file].c_str(),"r");
+        fp1 = openReads(files[current_file]);
         seq1 = kseq_init(fp1);
         l1 = kseq_read(seq1);
         state = true;
-        if (paired) {
+        if (paired && interleaved) {
+          seq2 = kseq_init(fp1); // never read from
+          l2 = readInterleavedMate(seq1, seq2);
+        } else if (paired) {
           current_file++;
-          fp2 = gzopen(files[current_file].c_str(),"r");
+          fp2 = openReads(files[current_file]);
           seq2 = kseq_init(fp2);
           l2 = kseq_read(seq2);
         }
@@ -836,11 +1401,11 @@ bool SequenceReader::fetchSequences(char *buf, const int limit, std::vector<std:
         seqs.emplace_back(p1,l1);
         
         if (usingUMIfiles) {
-          std::stringstream ss;
+          // the umi is the first word on the line
           std::getline(*f_umi, line);
-          ss.str(line);
-          ss >> umi;
-          umis.emplace_back(std::move(umi));
+          size_t b = std::min(line.find_first_not_of(" \t\r"), line.size());
+          size_t e = std::min(line.find_first_of(" \t\r", b), line.size());
+          umis.push_back(packUmi(line.data() + b, e - b));
         }
         if (full) {
           p1 = buf+bufpos;
@@ -876,7 +1441,7 @@ bool SequenceReader::fetchSequences(char *buf, const int limit, std::vector<std:
       // read for the next one
       l1 = kseq_read(seq1);
       if (paired) {
-        l2 = kseq_read(seq2);
+        l2 = (interleaved) ? readInterleavedMate(seq1, seq2) : kseq_read(seq2);
       }
     } else {
       current_file++; // move to next file
@@ -899,6 +1464,7 @@ SequenceReader::SequenceReader(SequenceReader&& o) :
   nl1(o.nl1),
   nl2(o.nl2),
   paired(o.paired),
+  interleaved(o.interleaved),
   files(std::move(o.files)),
   umi_files(std::move(o.umi_files)),
   f_umi(std::move(o.f_umi)),
@@ -6,7 +6,11 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <memory>
 #include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <fstream>
 
@@ -16,6 +20,11 @@
 #include <condition_variable>
 
 #include "MinCollector.h"
+#include "BGZFWriter.h"
+#include "BamSorter.h"
+#include "BatchMatrixWriter.h"
+#include "GeneModel.h"
+#include "RunStats.h"
 
 #include "common.h"
 
@@ -24,8 +33,44 @@
 KSEQ_INIT(gzFile, gzread)
 #endif
 
-int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc);
-int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc, std::vector<std::vector<int>> &batchCounts);
+int ProcessReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc, RunStats* stats = nullptr);
+int ProcessBatchReads(KmerIndex& index, const ProgramOptions& opt, MinCollector& tc, RunStats* stats = nullptr);
+
+// pseudoaligns a read, or a pair of reads when paired, leaving the
+// compatible targets in u. v1, v2 and vtmp are scratch space, v1 and v2
+// hold the k-mer matches of each read afterwards
+void pseudoalignFragment(const KmerIndex& index, const MinCollector& tc, const ProgramOptions& opt,
+    const char* s1, int l1, const char* s2, int l2, bool paired,
+    std::vector<std::pair<KmerEntry,int>>& v1, std::vector<std::pair<KmerEntry,int>>& v2,
+    std::vector<int>& u, std::vector<int>& vtmp);
+
+// packs a UMI into 64 bits, 2 bits per base after a leading 1 so that UMIs
+// of different lengths stay distinct. A UMI longer than 31 bases or with
+// anything but ACGT in it is hashed instead and has the top bit set
+inline uint64_t packUmi(const char* s, size_t len) {
+  if (len <= 31) {
+    uint64_t x = 1;
+    size_t i = 0;
+    for (; i < len; i++) {
+      uint64_t b;
+      switch (s[i]) {
+        case 'A': b = 0; break;
+        case 'C': b = 1; break;
+        case 'G': b = 2; break;
+        case 'T': b = 3; break;
+        default: b = 4;
+      }
+      if (b == 4) {
+        break;
+      }
+      x = (x << 2) | b;
+    }
+    if (i == len) {
+      return x;
+    }
+  }
+  return std::hash<std::string>()(std::string(s, len)) | (1ULL << 63);
+}
 
 class SequenceReader {
 public:
@@ -33,13 +78,13 @@ public:
   SequenceReader(const ProgramOptions& opt) :
   fp1(0),fp2(0),seq1(0),seq2(0),
   l1(0),l2(0),nl1(0),nl2(0),
-  paired(!opt.single_end), files(opt.files),
+  paired(!opt.single_end), interleaved(opt.interleaved), files(opt.files),
   f_umi(new std::ifstream{}),
   current_file(0), state(false) {}
   SequenceReader() :
   fp1(0),fp2(0),seq1(0),seq2(0),
   l1(0),l2(0),nl1(0),nl2(0),
-  paired(false), 
+  paired(false), interleaved(false),
   f_umi(new std::ifstream{}),
   current_file(0), state(false) {}
   SequenceReader(SequenceReader&& o);
@@ -50,7 +95,7 @@ public:
   bool fetchSequences(char *buf, const int limit, std::vector<std::pair<const char*, int>>& seqs,
                       std::vector<std::pair<const char*, int>>& names,
                       std::vector<std::pair<const char*, int>>& quals,
-                      std::vector<std::string>& umis, 
+                      std::vector<uint64_t>& umis, 
                       bool full=false);
 
 public:
@@ -58,79 +103,163 @@ public:
   kseq_t *seq1 = 0, *seq2 = 0;
   int l1,l2,nl1,nl2;
   bool paired;
-  std::vector<std::string> files;
+  bool interleaved; // paired reads alternate in files, seq2 holds the mate
+  std::vector<std::string> files; // - is stdin
   std::vector<std::string> umi_files;
   std::unique_ptr<std::ifstream> f_umi;
   int current_file;
   bool state; // is the file open
 };
 
+// a cell being read in batch mode, shared by every worker reading from it
+struct BatchCell {
+  BatchCell(int id) : id(id), drained(false), readers(0) {}
+  int id;
+  SequenceReader SR;
+  std::mutex lock; // guards SR
+  std::atomic<bool> drained; // SR has handed out its last reads
+  int readers; // chunks taken but not yet merged, guarded by reader_lock
+
+  // what has been counted so far, guarded by writer_lock
+  std::vector<std::pair<int, int>> counts; // (ec, count) sorted by ec
+  std::unordered_map<std::vector<int>, int, SortedVectorHasher> newECcount;
+  std::vector<std::pair<int, uint64_t>> umis;
+  std::vector<std::pair<std::vector<int>, uint64_t>> newECumis;
+};
+
+// how often a lock was taken and how long it was waited for and held, in
+// nanoseconds. Atomic so --verbose can report while the workers count
+struct LockCounters {
+  LockCounters() : acquisitions(0), wait_ns(0), hold_ns(0) {}
+
+  std::atomic<uint64_t> acquisitions;
+  std::atomic<uint64_t> wait_ns;
+  std::atomic<uint64_t> hold_ns;
+};
+
+// what a worker counts with --lock-stats, only written by that worker
+struct WorkerLockStats {
+  WorkerLockStats() : batches(0), batch_reads(0), min_batch(0), max_batch(0),
+    update_ns(0), stalled_ns(0) {}
+
+  LockCounters reader; // reader_lock
+  LockCounters writer; // writer_lock
+  LockCounters cell; // the lock of the cell being read, batch mode only
+  std::atomic<uint64_t> batches; // chunks of reads from fetchSequences
+  std::atomic<uint64_t> batch_reads;
+  std::atomic<uint64_t> min_batch;
+  std::atomic<uint64_t> max_batch;
+  std::atomic<uint64_t> update_ns; // in MasterProcessor::update
+  std::atomic<uint64_t> stalled_ns; // waiting for cells to be written
+};
+
 class MasterProcessor {
 public:
-  MasterProcessor (KmerIndex &index, const ProgramOptions& opt, MinCollector &tc)
-    : tc(tc), index(index), opt(opt), SR(opt), numreads(0)
-    ,nummapped(0), num_umi(0), tlencount(0), biasCount(0), maxBiasCount((opt.bias) ? 1000000 : 0) { 
-      if (opt.batch_mode) {
-        batchCounts.resize(opt.batch_ids.size(), {});
-        
-        for (auto &t : batchCounts) {
-          t.resize(tc.counts.size(),0);
-        }
-        newBatchECcount.resize(opt.batch_ids.size());
-        newBatchECumis.resize(opt.batch_ids.size());
-        batchUmis.resize(opt.batch_ids.size());
-      }
-    }
+  MasterProcessor (KmerIndex &index, const ProgramOptions& opt, MinCollector &tc, RunStats* stats = nullptr)
+    : tc(tc), index(index), opt(opt), stats(stats), SR(opt), numreads(0)
+    ,nummapped(0), num_umi(0), tlencount(0), biasCount(0), maxBiasCount((opt.bias) ? 1000000 : 0)
+    ,readbatch_id(0), pseudobam_id(0), batch_next(0), batch_written(0), worker_next(0)
+    ,progress_reads(0), progress_mapped(0) {}
 
   std::mutex reader_lock;
   std::mutex writer_lock;
+  std::mutex pseudobam_lock;
+  std::mutex batch_lock;
 
   SequenceReader SR;
   MinCollector& tc;
   KmerIndex& index;
   const ProgramOptions& opt;
+  RunStats* stats; // collects the time each worker spent, if set
   int numreads;
   int nummapped;
   int num_umi;
   std::atomic<int> tlencount;
   std::atomic<int> biasCount;
-  std::vector<std::vector<int>> batchCounts;
   const int maxBiasCount;
   std::unordered_map<std::vector<int>, int, SortedVectorHasher> newECcount;
-  std::vector<std::unordered_map<std::vector<int>, int, SortedVectorHasher>> newBatchECcount;
-  std::vector<std::vector<std::pair<int, std::string>>> batchUmis;
-  std::vector<std::vector<std::pair<std::vector<int>, std::string>>> newBatchECumis;
+  // pseudobam output is written in the order the batches were read,
+  // batches that finish early wait in pseudobam_pending. A worker whose
+  // batch is too far ahead of the next one to write waits on pseudobam_cv,
+  // so memory does not grow behind one slow batch
+  int readbatch_id;
+  int pseudobam_id;
+  std::map<int, std::string> pseudobam_pending;
+  std::condition_variable pseudobam_cv;
+  BGZFWriter bamfile;
+  BamSorter bamsorter;
+  Transcriptome model; // only loaded for genomebam
+  // batch mode: up to opt.threads cells are open at once. A worker keeps
+  // reading chunks from its cell and, once that runs dry, opens the next
+  // cell or joins the open cell with the fewest readers, so a large cell is
+  // spread over all threads instead of holding up the rest
+  std::vector<std::shared_ptr<BatchCell>> batch_open;
+  int batch_next;
+  // finished cells are written to the matrix in order, those that finish
+  // early wait in batch_pending. No new cell is opened while too many are
+  // unwritten, so memory does not grow with the number of cells. New ECs
+  // get their ids as cells are written and are only added to tc at the end
+  int batch_written;
+  std::condition_variable batch_cv;
+  std::map<int, std::shared_ptr<BatchCell>> batch_pending;
+  std::unordered_map<std::vector<int>, int, SortedVectorHasher> batch_newEcIds;
+  std::vector<std::vector<int>> batch_newEcs;
+  BatchMatrixWriter matrixwriter;
+  // one per worker with --lock-stats, indexed by worker_id
+  std::vector<std::unique_ptr<WorkerLockStats>> lock_stats;
+  // the workers number themselves as they start, which is also their slot
+  // in RunStats::threads, so that the lock counters line up with it
+  std::atomic<int> worker_next;
+  // numreads and nummapped, for the progress reports while the workers run
+  std::atomic<uint64_t> progress_reads;
+  std::atomic<uint64_t> progress_mapped;
   void processReads();
+  // reports the reads processed since start, and since the last report,
+  // to stderr and the status file. Once done only the status file is written
+  void reportProgress(double start, double& last, uint64_t& last_reads, bool done);
+  // the lock counters so far, every worker or only the totals
+  void reportLockStats(std::ostream& o, bool per_worker) const;
+  void addLockStats(RunStats& stats) const;
+
+  std::shared_ptr<BatchCell> nextBatchCell(const std::shared_ptr<BatchCell>& cur);
+  void doneBatchChunk(const std::shared_ptr<BatchCell>& cell);
+  void finishBatchCell(const std::shared_ptr<BatchCell>& cell);
+  void writeBatchCell(BatchCell& cell);
 
-  void update(const std::vector<int>& c, const std::vector<std::vector<int>>& newEcs, std::vector<std::pair<int, std::string>>& ec_umi, std::vector<std::pair<std::vector<int>, std::string>> &new_ec_umi, int n, std::vector<int>& flens, std::vector<int> &bias, int id = -1);
+  void writePseudoBam(int batch_id, std::string& bam);
+  void writeBam(const std::string& bam);
+
+  void update(const std::vector<int>& c, const std::vector<std::vector<int>>& newEcs, std::vector<std::pair<int, uint64_t>>& ec_umi, std::vector<std::pair<std::vector<int>, uint64_t>> &new_ec_umi, int n, std::vector<int>& flens, std::vector<int> &bias, BatchCell* cell = nullptr);
 };
 
 class ReadProcessor {
 public:
-  ReadProcessor(const KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp, int id = -1);
+  ReadProcessor(const KmerIndex& index, const ProgramOptions& opt, const MinCollector& tc, MasterProcessor& mp);
   ReadProcessor(ReadProcessor && o);
   ~ReadProcessor();
   char *buffer;
   size_t bufsize;
   bool paired;
   const MinCollector& tc;
-  std::vector<std::pair<int, std::string>> ec_umi;
-  std::vector<std::pair<std::vector<int>, std::string>> new_ec_umi;
+  std::vector<std::pair<int, uint64_t>> ec_umi;
+  std::vector<std::pair<std::vector<int>, uint64_t>> new_ec_umi;
   const KmerIndex& index;
   MasterProcessor& mp;
-  SequenceReader batchSR;
+  std::shared_ptr<BatchCell> cell; // batch mode only
   int numreads;
-  int id;
+  int readbatch_id;
+  std::string pseudobam_buf;
 
   std::vector<std::pair<const char*, int>> seqs;
   std::vector<std::pair<const char*, int>> names;
   std::vector<std::pair<const char*, int>> quals;
-  std::vector<std::string> umis;
+  std::vector<uint64_t> umis;
   std::vector<std::vector<int>> newEcs;
   std::vector<int> flens;
   std::vector<int> bias5;
 
   std::vector<int> counts;
+  ThreadStats stats;
 
   void operator()();
   void processBuffer();
@@ -1,16 +1,342 @@
 #include "PseudoBam.h"
 
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+#include "GeneModel.h"
+
 /** --- pseudobam functions -- **/
 
-void outputPseudoBam(const KmerIndex &index, const std::vector<int> &u,
+static void put_i32(std::string &out, int32_t x) {
+  char b[4];
+  for (int i = 0; i < 4; i++) {
+    b[i] = (x >> (8*i)) & 0xff;
+  }
+  out.append(b, 4);
+}
+
+static void put_u16(std::string &out, uint16_t x) {
+  char b[2] = {(char) (x & 0xff), (char) ((x >> 8) & 0xff)};
+  out.append(b, 2);
+}
+
+// bin of the smallest UCSC bin containing [beg, end), from the SAM spec
+static int reg2bin(int beg, int end) {
+  --end;
+  if (beg>>14 == end>>14) return ((1<<15)-1)/7 + (beg>>14);
+  if (beg>>17 == end>>17) return ((1<<12)-1)/7 + (beg>>17);
+  if (beg>>20 == end>>20) return ((1<<9)-1)/7 + (beg>>20);
+  if (beg>>23 == end>>23) return ((1<<6)-1)/7 + (beg>>23);
+  if (beg>>26 == end>>26) return ((1<<3)-1)/7 + (beg>>26);
+  return 0;
+}
+
+// append one BAM alignment record to out. Positions are 1-based as in SAM,
+// 0 meaning unset, refID -1 means '*'. nmap < 0 omits the NH tag
+static void appendBamRecord(std::string &out, const char *name, int flag,
+    int refID, int pos, int mapq, const uint32_t *cig, int ncig,
+    int next_refID, int next_pos, int tlen,
+    const char *seq, const char *qual, int len, int nmap) {
+  static const int8_t seq_nt16[256] = {
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15, 0,15,15,
+    15, 1,14, 2, 13,15,15, 4, 11,15,15,12, 15, 3,15,15,
+    15,15, 5, 6,  8,15, 7, 9, 15,10,15,15, 15,15,15,15,
+    15, 1,14, 2, 13,15,15, 4, 11,15,15,12, 15, 3,15,15,
+    15,15, 5, 6,  8,15, 7, 9, 15,10,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15
+  };
+
+  int l_name = std::min((int) strlen(name), 254);
+  int span = 0;
+  for (int i = 0; i < ncig; i++) {
+    int op = cig[i] & 0xf;
+    if (op == 0 || op == 2 || op == 3) { // M, D, N consume the reference
+      span += cig[i] >> 4;
+    }
+  }
+  int beg = pos - 1;
+  int bin = reg2bin(beg, beg + ((span > 0) ? span : 1));
+
+  size_t start = out.size();
+  put_i32(out, 0); // block_size, filled in below
+  put_i32(out, refID);
+  put_i32(out, beg);
+  out.push_back((char) (l_name + 1));
+  out.push_back((char) mapq);
+  put_u16(out, bin);
+  put_u16(out, ncig);
+  put_u16(out, flag);
+  put_i32(out, len);
+  put_i32(out, next_refID);
+  put_i32(out, next_pos - 1);
+  put_i32(out, tlen);
+  out.append(name, l_name);
+  out.push_back('\0');
+  for (int i = 0; i < ncig; i++) {
+    put_i32(out, cig[i]);
+  }
+  for (int i = 0; i < len; i += 2) {
+    int hi = seq_nt16[(unsigned char) seq[i]];
+    int lo = (i + 1 < len) ? seq_nt16[(unsigned char) seq[i+1]] : 0;
+    out.push_back((char) ((hi << 4) | lo));
+  }
+  for (int i = 0; i < len; i++) {
+    out.push_back((char) (qual[i] - 33));
+  }
+  if (nmap >= 0) {
+    out.append("NH", 2);
+    if (nmap < 256) {
+      out.push_back('C');
+      out.push_back((char) nmap);
+    } else if (nmap < 65536) {
+      out.push_back('S');
+      put_u16(out, nmap);
+    } else {
+      out.push_back('I');
+      put_i32(out, nmap);
+    }
+  }
+
+  int32_t block_size = out.size() - start - 4;
+  for (int i = 0; i < 4; i++) {
+    out[start + i] = (block_size >> (8*i)) & 0xff;
+  }
+}
+
+// a transcriptome record kept for projection onto the genome
+struct TargetRecord {
+  int flag;
+  int tr;
+  int pos;
+  uint32_t cig[3];
+  int ncig;
+};
+
+// a record projected onto the genome
+struct GenomeRecord {
+  int flag;
+  int chr;
+  int pos; // 0-based
+  int end;
+  std::vector<uint32_t> cigar;
+};
+
+static bool projectRecord(const Transcriptome &model, const TargetRecord &r, GenomeRecord &g) {
+  g.flag = r.flag & ~(0x10 | 0x20 | 0x100);
+  g.chr = -1;
+  g.pos = -1;
+  g.end = -1;
+  g.cigar.clear();
+  if (r.flag & 0x04) {
+    return true; // placed at the mate later
+  }
+
+  int lclip = 0, mlen = 0, rclip = 0;
+  for (int i = 0; i < r.ncig; i++) {
+    int op = r.cig[i] & 0xf, n = r.cig[i] >> 4;
+    if (op == BAM_CMATCH) {
+      mlen = n;
+    } else if (mlen == 0) {
+      lclip = n;
+    } else {
+      rclip = n;
+    }
+  }
+  bool flip;
+  if (!model.project(r.tr, r.pos - 1, mlen, lclip, rclip, g.chr, g.pos, flip, g.cigar)) {
+    return false;
+  }
+  g.end = g.pos;
+  for (auto c : g.cigar) {
+    if ((c & 0xf) == BAM_CMATCH || (c & 0xf) == BAM_CREF_SKIP) {
+      g.end += c >> 4;
+    }
+  }
+  if (((r.flag & 0x10) != 0) != flip) {
+    g.flag |= 0x10;
+  }
+  return true;
+}
+
+// project the per target records of a read (pair) onto the genome, records
+// of different targets landing on the same locus with the same CIGAR are
+// written once
+static void outputGenomeRecords(std::string &out, const Transcriptome &model,
+    const std::vector<TargetRecord> &recs1, const std::vector<TargetRecord> &recs2,
+    const char *s1, const char *n1, const char *q1, int slen1,
+    const char *s2, const char *n2, const char *q2, int slen2,
+    bool paired) {
+  std::vector<std::pair<GenomeRecord, GenomeRecord>> kept;
+  std::set<std::vector<int>> seen;
+  GenomeRecord g1, g2;
+  std::vector<int> key;
+
+  for (size_t i = 0; i < recs1.size(); i++) {
+    if (!projectRecord(model, recs1[i], g1)) {
+      continue;
+    }
+    if (paired) {
+      if (!projectRecord(model, recs2[i], g2)) {
+        continue;
+      }
+      // an unmapped read is placed at its mate
+      if (g1.flag & 0x04) {
+        g1.chr = g2.chr;
+        g1.pos = g2.pos;
+      }
+      if (g2.flag & 0x04) {
+        g2.chr = g1.chr;
+        g2.pos = g1.pos;
+      }
+    }
+
+    key.clear();
+    for (auto g : {&g1, &g2}) {
+      key.push_back(g->flag);
+      key.push_back(g->chr);
+      key.push_back(g->pos);
+      key.insert(key.end(), g->cigar.begin(), g->cigar.end());
+      key.push_back(-1);
+      if (!paired) {
+        break;
+      }
+    }
+    if (seen.insert(key).second) {
+      kept.push_back({g1, g2});
+    }
+  }
+
+  if (kept.empty()) {
+    // none of the targets are in the annotation
+    if (paired) {
+      appendBamRecord(out, n1, 77, -1, 0, 0, nullptr, 0, -1, 0, 0, s1, q1, slen1, -1);
+      appendBamRecord(out, n2, 141, -1, 0, 0, nullptr, 0, -1, 0, 0, s2, q2, slen2, -1);
+    } else {
+      appendBamRecord(out, n1, 4, -1, 0, 0, nullptr, 0, -1, 0, 0, s1, q1, slen1, -1);
+    }
+    return;
+  }
+
+  // reads as they appear on the reverse strand, made when first needed
+  std::string rc1s, rc1q, rc2s, rc2q;
+  auto revcomp = [](std::string &rs, std::string &rq, const char *s, const char *q, int n) {
+    if (rs.empty()) {
+      rs.resize(n + 1);
+      rq.resize(n + 1);
+      revseq(&rs[0], &rq[0], s, q, n);
+    }
+  };
+
+  int nmap = kept.size();
+  for (size_t i = 0; i < kept.size(); i++) {
+    auto &a = kept[i].first;
+    auto &b = kept[i].second;
+    int sec = (i > 0) ? 0x100 : 0;
+    if (!paired) {
+      const char *s = s1, *q = q1;
+      if (a.flag & 0x10) {
+        revcomp(rc1s, rc1q, s1, q1, slen1);
+        s = rc1s.c_str();
+        q = rc1q.c_str();
+      }
+      appendBamRecord(out, n1, a.flag | sec, a.chr, a.pos + 1, 255, a.cigar.data(), a.cigar.size(),
+        -1, 0, 0, s, q, slen1, nmap);
+      continue;
+    }
+
+    // fragment length from the outer ends on the genome
+    int tlen = 0;
+    if (!(a.flag & 0x04) && !(b.flag & 0x04)) {
+      tlen = std::max(a.end, b.end) - std::min(a.pos, b.pos);
+    }
+    bool first_left = (a.pos <= b.pos);
+
+    for (int r = 0; r < 2; r++) {
+      auto &g = (r == 0) ? a : b;
+      auto &m = (r == 0) ? b : a;
+      int flag = g.flag | sec;
+      if (!(m.flag & 0x04) && (m.flag & 0x10)) {
+        flag |= 0x20;
+      }
+      const char *s = (r == 0) ? s1 : s2;
+      const char *q = (r == 0) ? q1 : q2;
+      int slen = (r == 0) ? slen1 : slen2;
+      if (g.flag & 0x10) {
+        auto &rs = (r == 0) ? rc1s : rc2s;
+        auto &rq = (r == 0) ? rc1q : rc2q;
+        revcomp(rs, rq, s, q, slen);
+        s = rs.c_str();
+        q = rq.c_str();
+      }
+      int t = ((r == 0) == first_left) ? tlen : -tlen;
+      appendBamRecord(out, (r == 0) ? n1 : n2, flag, g.chr, g.pos + 1, 255, g.cigar.data(), g.cigar.size(),
+        m.chr, m.pos + 1, t, s, q, slen, nmap);
+    }
+  }
+}
+
+// binary header from the SAM text header and the reference dictionary
+static std::string bamHeader(const std::string &text, const std::vector<std::string> &names,
+    const std::vector<int> &lens) {
+  std::string out("BAM\1", 4);
+  put_i32(out, text.size());
+  out.append(text);
+  put_i32(out, names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    put_i32(out, names[i].size() + 1);
+    out.append(names[i]);
+    out.push_back('\0');
+    put_i32(out, lens[i]);
+  }
+  return out;
+}
+
+static const std::string SAM_HD = "@HD\tVN:1.0\n";
+static const std::string SAM_HD_SORTED = "@HD\tVN:1.0\tSO:coordinate\n";
+
+std::string pseudoBamHeader(const KmerIndex &index, bool sorted) {
+  std::ostringstream text;
+  index.writePseudoBamHeader(text);
+  std::string t = text.str();
+  if (sorted && t.compare(0, SAM_HD.size(), SAM_HD) == 0) {
+    t.replace(0, SAM_HD.size(), SAM_HD_SORTED);
+  }
+  return bamHeader(t, index.target_names_, index.target_lens_);
+}
+
+std::string genomeBamHeader(const Transcriptome &model, bool sorted) {
+  std::ostringstream text;
+  text << (sorted ? SAM_HD_SORTED : SAM_HD);
+  for (size_t i = 0; i < model.chr_names.size(); i++) {
+    text << "@SQ\tSN:" << model.chr_names[i] << "\tLN:" << model.chr_lens[i] << "\n";
+  }
+  text << "@PG\tID:kallisto\tPN:kallisto\tVN:"<< KALLISTO_VERSION << "\n";
+  return bamHeader(text.str(), model.chr_names, model.chr_lens);
+}
+
+void outputPseudoBam(std::string &out, const KmerIndex &index, const std::vector<int> &u,
     const char *s1, const char *n1, const char *q1, int slen1, int nlen1, const std::vector<std::pair<KmerEntry,int>>& v1,
     const char *s2, const char *n2, const char *q2, int slen2, int nlen2, const std::vector<std::pair<KmerEntry,int>>& v2,
-    bool paired) {
+    bool paired, const Transcriptome *model) {
 
-  static char buf1[32768];
-  static char buf2[32768];
-  static char cig_[1000];
-  char *cig = &cig_[0];
+  char buf1[32768];
+  char buf2[32768];
+  uint32_t cig[3];
+  int ncig;
+  // with a gene model, records are collected for projection
+  std::vector<TargetRecord> recs1, recs2;
 
 
   if (nlen1 > 2 && n1[nlen1-2] == '/') {
@@ -24,12 +350,12 @@ void outputPseudoBam(const KmerIndex &index, const std::vector<int> &u,
   if (u.empty()) {
     // no mapping
     if (paired) {
-      printf("%s\t77\t*\t0\t0\t*\t*\t0\t0\t%s\t%s\n", n1,s1,q1);
-      printf("%s\t141\t*\t0\t0\t*\t*\t0\t0\t%s\t%s\n", n2,s2,q2);
+      appendBamRecord(out, n1, 77, -1, 0, 0, nullptr, 0, -1, 0, 0, s1, q1, slen1, -1);
+      appendBamRecord(out, n2, 141, -1, 0, 0, nullptr, 0, -1, 0, 0, s2, q2, slen2, -1);
       //o << seq1->name.s << "" << seq1->seq.s << "\t" << seq1->qual.s << "\n";
       //o << seq2->name.s << "\t141\t*\t0\t0\t*\t*\t0\t0\t" << seq2->seq.s << "\t" << seq2->qual.s << "\n";
     } else {
-      printf("%s\t4\t*\t0\t0\t*\t*\t0\t0\t%s\t%s\n", n1,s1,q1);
+      appendBamRecord(out, n1, 4, -1, 0, 0, nullptr, 0, -1, 0, 0, s1, q1, slen1, -1);
     }
   } else {
     if (paired) {
@@ -120,13 +446,17 @@ void outputPseudoBam(const KmerIndex &index, const std::vector<int> &u,
         int posread = (f1 & 0x10) ? (x1.first - slen1 + 1) : x1.first;
         int posmate = (f1 & 0x20) ? (x2.first - slen2 + 1) : x2.first;
 
-        getCIGARandSoftClip(cig, bool(f1 & 0x10), (f1 & 0x04) == 0, posread, posmate, slen1, index.target_lens_[tr]);
+        ncig = getCIGARandSoftClip(cig, bool(f1 & 0x10), (f1 & 0x04) == 0, posread, posmate, slen1, index.target_lens_[tr]);
         int tlen = x2.first - x1.first;
         if (tlen != 0) {
           tlen += (tlen>0) ? 1 : -1;
         }
 
-        printf("%s\t%d\t%s\t%d\t255\t%s\t=\t%d\t%d\t%s\t%s\tNH:i:%d\n", n1, f1 & 0xFFFF, index.target_names_[tr].c_str(), posread, cig, posmate, tlen, (f1 & 0x10) ? &buf1[0] : s1, (f1 & 0x10) ? &buf2[0] : q1, nmap);
+        if (model != nullptr) {
+          recs1.push_back({f1 & 0xFFFF, tr, posread, {cig[0], cig[1], cig[2]}, ncig});
+          continue;
+        }
+        appendBamRecord(out, n1, f1 & 0xFFFF, tr, posread, 255, cig, ncig, tr, posmate, tlen, (f1 & 0x10) ? &buf1[0] : s1, (f1 & 0x10) ? &buf2[0] : q1, slen1, nmap);
       }
 
       revset = false;
@@ -167,13 +497,21 @@ void outputPseudoBam(const KmerIndex &index, const std::vector<int> &u,
         int posread = (f2 & 0x10) ? (x2.first - slen2 + 1) : x2.first;
         int posmate = (f2 & 0x20) ? (x1.first - slen1 + 1) : x1.first;
 
-        getCIGARandSoftClip(cig, bool(f2 & 0x10), (f2 & 0x04) == 0, posread, posmate, slen2, index.target_lens_[tr]);
+        ncig = getCIGARandSoftClip(cig, bool(f2 & 0x10), (f2 & 0x04) == 0, posread, posmate, slen2, index.target_lens_[tr]);
         int tlen = x1.first - x2.first;
         if (tlen != 0) {
           tlen += (tlen > 0) ? 1 : -1;
         }
 
-        printf("%s\t%d\t%s\t%d\t255\t%s\t=\t%d\t%d\t%s\t%s\tNH:i:%d\n", n2, f2 & 0xFFFF, index.target_names_[tr].c_str(), posread, cig, posmate, tlen, (f2 & 0x10) ? &buf1[0] : s2,  (f2 & 0x10) ? &buf2[0] : q2, nmap);
+        if (model != nullptr) {
+          recs2.push_back({f2 & 0xFFFF, tr, posread, {cig[0], cig[1], cig[2]}, ncig});
+          continue;
+        }
+        appendBamRecord(out, n2, f2 & 0xFFFF, tr, posread, 255, cig, ncig, tr, posmate, tlen, (f2 & 0x10) ? &buf1[0] : s2,  (f2 & 0x10) ? &buf2[0] : q2, slen2, nmap);
+      }
+
+      if (model != nullptr) {
+        outputGenomeRecords(out, *model, recs1, recs2, s1, n1, q1, slen1, s2, n2, q2, slen2, paired);
       }
 
 
@@ -209,9 +547,17 @@ void outputPseudoBam(const KmerIndex &index, const std::vector<int> &u,
         firstTr = false;
         int posread = (f1 & 0x10) ? (x1.first - slen1+1) : x1.first;
         int dummy=1;
-        getCIGARandSoftClip(cig, bool(f1 & 0x10), (f1 & 0x04) == 0, posread, dummy, slen1, index.target_lens_[tr]);
+        ncig = getCIGARandSoftClip(cig, bool(f1 & 0x10), (f1 & 0x04) == 0, posread, dummy, slen1, index.target_lens_[tr]);
 
-        printf("%s\t%d\t%s\t%d\t255\t%s\t*\t%d\t%d\t%s\t%s\tNH:i:%d\n", n1, f1 & 0xFFFF, index.target_names_[tr].c_str(), posread, cig, 0, 0, (f1 & 0x10) ? &buf1[0] : s1, (f1 & 0x10) ? &buf2[0] : q1, nmap);
+        if (model != nullptr) {
+          recs1.push_back({f1 & 0xFFFF, tr, posread, {cig[0], cig[1], cig[2]}, ncig});
+          continue;
+        }
+        appendBamRecord(out, n1, f1 & 0xFFFF, tr, posread, 255, cig, ncig, -1, 0, 0, (f1 & 0x10) ? &buf1[0] : s1, (f1 & 0x10) ? &buf2[0] : q1, slen1, nmap);
+      }
+
+      if (model != nullptr) {
+        outputGenomeRecords(out, *model, recs1, recs2, s1, n1, q1, slen1, nullptr, nullptr, nullptr, 0, paired);
       }
     }
   }
@@ -237,9 +583,10 @@ void revseq(char *b1, char *b2, const char *s, const char *q, int n) {
 
 
 
-void getCIGARandSoftClip(char* cig, bool strand, bool mapped, int &posread, int &posmate, int length, int targetlength) {
+int getCIGARandSoftClip(uint32_t* cig, bool strand, bool mapped, int &posread, int &posmate, int length, int targetlength) {
   int softclip = 1 - posread;
   int overhang = (posread + length) - targetlength - 1;
+  int n = 0;
 
   if (posread <= 0) {
     posread = 1;
@@ -248,21 +595,24 @@ void getCIGARandSoftClip(char* cig, bool strand, bool mapped, int &posread, int
   if (mapped) {
     if (softclip > 0) {
       if (overhang > 0) {
-        sprintf(cig, "%dS%dM%dS",softclip, (length-overhang - softclip), overhang);
+        cig[n++] = (softclip << 4) | BAM_CSOFT_CLIP;
+        cig[n++] = ((length-overhang - softclip) << 4) | BAM_CMATCH;
+        cig[n++] = (overhang << 4) | BAM_CSOFT_CLIP;
       } else {
-        sprintf(cig, "%dS%dM",softclip,length-softclip);
+        cig[n++] = (softclip << 4) | BAM_CSOFT_CLIP;
+        cig[n++] = ((length-softclip) << 4) | BAM_CMATCH;
       }
     } else if (overhang > 0) {
-      sprintf(cig, "%dM%dS", length-overhang, overhang);
+      cig[n++] = ((length-overhang) << 4) | BAM_CMATCH;
+      cig[n++] = (overhang << 4) | BAM_CSOFT_CLIP;
     } else {
-      sprintf(cig, "%dM",length);
+      cig[n++] = (length << 4) | BAM_CMATCH;
     }
-  } else {
-    sprintf(cig, "*");
   }
 
 
   if (posmate <= 0) {
     posmate = 1;
   }
+  return n;
 }
@@ -1,12 +1,35 @@
+#ifndef KALLISTO_PSEUDOBAM_H
+#define KALLISTO_PSEUDOBAM_H
+
+#include <cstdint>
 #include <vector>
 #include <iostream>
+#include <string>
 #include <utility>
 
 #include "KmerIndex.h"
 
-void outputPseudoBam(const KmerIndex &index, const std::vector<int> &u,
+class Transcriptome;
+
+// BAM cigar operations
+const uint32_t BAM_CMATCH = 0;
+const uint32_t BAM_CREF_SKIP = 3;
+const uint32_t BAM_CSOFT_CLIP = 4;
+
+// binary BAM header: the SAM text header and the list of targets
+std::string pseudoBamHeader(const KmerIndex &index, bool sorted = false);
+// same for pseudoalignments projected to the chromosomes of the model
+std::string genomeBamHeader(const Transcriptome &model, bool sorted = false);
+
+// appends the BAM records for one read (pair) to out, so each thread can
+// format into its own buffer. With a gene model the records are projected
+// to the genome and duplicate loci collapsed
+void outputPseudoBam(std::string &out, const KmerIndex &index, const std::vector<int> &u,
                     const char *s1, const char *n1, const char *q1, int slen1, int nlen1, const std::vector<std::pair<KmerEntry,int>>& v1,
                     const char *s2, const char *n2, const char *q2, int slen2, int nlen2, const std::vector<std::pair<KmerEntry,int>>& v2,
-                    bool paired);
+                    bool paired, const Transcriptome *model = nullptr);
 void revseq(char *b1, char *b2, const char *s, const char *q, int n);
-void getCIGARandSoftClip(char* cig, bool strand, bool mapped, int &posread, int &posmate, int length, int targetlength);
+// fills cig with at most 3 operations and returns how many were used
+int getCIGARandSoftClip(uint32_t* cig, bool strand, bool mapped, int &posread, int &posmate, int length, int targetlength);
+
+#endif // KALLISTO_PSEUDOBAM_H
@@ -0,0 +1,201 @@
+#include "RunStats.h"
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <time.h>
+
+double wall_seconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double cpu_seconds(clockid_t clock) {
+  timespec ts;
+  if (clock_gettime(clock, &ts) != 0) {
+    return 0.0;
+  }
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double process_cpu_seconds() {
+  return cpu_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+double thread_cpu_seconds() {
+  return cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+ThreadStats& ThreadStats::operator+=(const ThreadStats& o) {
+  wall += o.wall;
+  cpu += o.cpu;
+  reading += o.reading;
+  waiting += o.waiting;
+  pseudoaligning += o.pseudoaligning;
+  updating += o.updating;
+  writing += o.writing;
+  return *this;
+}
+
+void RunStats::addStage(const std::string& name, double wall, double cpu) {
+  for (auto& s : stages) {
+    if (s.name == name) {
+      s.wall += wall;
+      s.cpu += cpu;
+      return;
+    }
+  }
+  stages.push_back({name, wall, cpu});
+}
+
+void RunStats::addThread(size_t worker, const ThreadStats& t) {
+  std::lock_guard<std::mutex> lock(threads_lock);
+  if (threads.size() <= worker) {
+    threads.resize(worker + 1);
+  }
+  threads[worker] = t;
+}
+
+void RunStats::addProfile(const std::string& name, const std::string& unit, double units,
+    const PerfCounters& counters, const PerfCounters* part) {
+  std::lock_guard<std::mutex> lock(threads_lock);
+  if (!counters.available()) {
+    profile_error = counters.error();
+    return;
+  }
+  PerfCounts c = counters.read();
+  if (part != nullptr) {
+    c -= part->read();
+  }
+  for (auto& p : profiles) {
+    if (p.name == name) {
+      p.units += units;
+      p.counts += c;
+      return;
+    }
+  }
+  profiles.push_back({name, unit, units, c});
+}
+
+// seconds with millisecond precision
+static std::string seconds(double s) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", s);
+  return buf;
+}
+
+std::string RunStats::to_json(int level) const {
+  std::string indent(level, '\t');
+  std::stringstream o;
+
+  o << indent << "\"stages\": {\n";
+  for (size_t i = 0; i < stages.size(); i++) {
+    o << indent << "\t\"" << stages[i].name << "\": {\"wall_seconds\": " << seconds(stages[i].wall)
+      << ", \"cpu_seconds\": " << seconds(stages[i].cpu) << "}"
+      << ((i + 1 < stages.size()) ? "," : "") << "\n";
+  }
+  o << indent << "},\n";
+
+  if (reads_wall > 0.0) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", num_reads / reads_wall);
+    o << indent << "\"reads_per_second\": " << buf << ",\n";
+  }
+
+  if (!threads.empty()) {
+    o << indent << "\"threads\": [\n";
+    for (size_t i = 0; i < threads.size(); i++) {
+      const auto& t = threads[i];
+      double busy = t.wall - t.waiting;
+      o << indent << "\t{\"wall_seconds\": " << seconds(t.wall)
+        << ", \"cpu_seconds\": " << seconds(t.cpu)
+        << ", \"reading\": " << seconds(t.reading)
+        << ", \"waiting\": " << seconds(t.waiting)
+        << ", \"pseudoaligning\": " << seconds(t.pseudoaligning)
+        << ", \"updating\": " << seconds(t.updating)
+        << ", \"writing\": " << seconds(t.writing)
+        << ", \"busy_fraction\": " << seconds((t.wall > 0.0) ? busy / t.wall : 0.0) << "}"
+        << ((i + 1 < threads.size()) ? "," : "") << "\n";
+    }
+    o << indent << "],\n";
+  }
+
+  if (!locks.empty()) {
+    o << indent << "\"locks\": {\n";
+    for (size_t i = 0; i < locks.size(); i++) {
+      const auto& l = locks[i];
+      o << indent << "\t\"" << l.name << "\": {\"acquisitions\": [";
+      for (size_t j = 0; j < l.acquisitions.size(); j++) {
+        o << ((j > 0) ? ", " : "") << l.acquisitions[j];
+      }
+      o << "], \"wait_seconds\": [";
+      for (size_t j = 0; j < l.wait.size(); j++) {
+        o << ((j > 0) ? ", " : "") << seconds(l.wait[j]);
+      }
+      o << "], \"hold_seconds\": [";
+      for (size_t j = 0; j < l.hold.size(); j++) {
+        o << ((j > 0) ? ", " : "") << seconds(l.hold[j]);
+      }
+      o << "]}" << ((i + 1 < locks.size()) ? "," : "") << "\n";
+    }
+    o << indent << "},\n";
+  }
+
+  if (num_batches > 0) {
+    o << indent << "\"read_batches\": {\"count\": " << num_batches
+      << ", \"mean_reads\": " << num_reads / num_batches
+      << ", \"min_reads\": " << min_batch
+      << ", \"max_reads\": " << max_batch << "},\n";
+  }
+
+  if (!profiles.empty() || !profile_error.empty()) {
+    o << indent << "\"profile\": {\n";
+    if (profiles.empty()) {
+      o << indent << "\t\"error\": \"" << profile_error << "\"\n";
+    }
+    for (size_t i = 0; i < profiles.size(); i++) {
+      const auto& p = profiles[i];
+      const auto& c = p.counts;
+      o << indent << "\t\"" << p.name << "\": {\"" << p.unit << "s\": " << (uint64_t) p.units;
+      for (int e = 0; e < PerfCounts::NumEvents; e++) {
+        if (c.valid[e]) {
+          o << ", \"" << PerfCounts::name(e) << "\": " << c.counts[e];
+        }
+      }
+      if (p.units > 0) {
+        char buf[32];
+        o << ", \"per_" << p.unit << "\": {";
+        bool first = true;
+        for (int e = 0; e < PerfCounts::NumEvents; e++) {
+          if (c.valid[e]) {
+            snprintf(buf, sizeof(buf), "%.2f", c.counts[e] / p.units);
+            o << ((first) ? "" : ", ") << "\"" << PerfCounts::name(e) << "\": " << buf;
+            first = false;
+          }
+        }
+        o << "}";
+      }
+      if (c.valid[PerfCounts::Cycles] && c.valid[PerfCounts::Instructions] && c.counts[PerfCounts::Cycles] > 0) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", (double) c.counts[PerfCounts::Instructions] / c.counts[PerfCounts::Cycles]);
+        o << ", \"instructions_per_cycle\": " << buf;
+      }
+      o << "}" << ((i + 1 < profiles.size()) ? "," : "") << "\n";
+    }
+    o << indent << "},\n";
+  }
+  return o.str();
+}
+
+StageTimer::StageTimer(RunStats& stats, const std::string& name)
+  : stats_(stats), name_(name), wall_(wall_seconds()), cpu_(process_cpu_seconds()), running_(true) {}
+
+StageTimer::~StageTimer() {
+  stop();
+}
+
+void StageTimer::stop() {
+  if (running_) {
+    stats_.addStage(name_, wall_seconds() - wall_, process_cpu_seconds() - cpu_);
+    running_ = false;
+  }
+}
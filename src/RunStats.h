@@ -0,0 +1,104 @@
+#ifndef KALLISTO_RUNSTATS_H
+#define KALLISTO_RUNSTATS_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.h"
+
+// seconds on a monotonic clock, from an arbitrary start
+double wall_seconds();
+// seconds of cpu time used by all threads of the process
+double process_cpu_seconds();
+// seconds of cpu time used by the calling thread
+double thread_cpu_seconds();
+
+// what a worker thread spent its time on while processing the reads, in
+// seconds. Everything but waiting counts as busy
+struct ThreadStats {
+  ThreadStats() : wall(0.0), cpu(0.0), reading(0.0), waiting(0.0),
+    pseudoaligning(0.0), updating(0.0), writing(0.0) {}
+
+  double wall;
+  double cpu;
+  double reading; // parsing and decompressing reads
+  double waiting; // for another thread to hand over the reads
+  double pseudoaligning;
+  double updating; // merging the results into the totals
+  double writing; // pseudobam or batch matrix output
+
+  ThreadStats& operator+=(const ThreadStats& o);
+};
+
+// Wall clock and cpu time of the stages of a run and of the threads that
+// process the reads, written to run_info.json
+struct RunStats {
+  struct Stage {
+    std::string name;
+    double wall;
+    double cpu;
+  };
+
+  // a lock of the read processing with --lock-stats, an entry per worker
+  struct Lock {
+    std::string name;
+    std::vector<uint64_t> acquisitions;
+    std::vector<double> wait;
+    std::vector<double> hold;
+  };
+
+  // hardware counters of a stage with --profile, per unit of work
+  struct Profile {
+    std::string name;
+    std::string unit; // read, iteration, ...
+    double units;
+    PerfCounts counts;
+  };
+
+  RunStats() : num_reads(0), reads_wall(0.0), num_batches(0), min_batch(0), max_batch(0) {}
+
+  // a stage that is added again accumulates
+  void addStage(const std::string& name, double wall, double cpu);
+  // the threads are kept in the order of their worker ids
+  void addThread(size_t worker, const ThreadStats& t);
+  // counters of the same stage add up, also from different threads, less
+  // those of a part of the stage that is reported on its own. Where counters
+  // are not available, profile_error says why
+  void addProfile(const std::string& name, const std::string& unit, double units,
+      const PerfCounters& counters, const PerfCounters* part = nullptr);
+
+  // the entries for run_info.json, each line ending in a comma
+  std::string to_json(int level = 1) const;
+
+  std::vector<Stage> stages;
+  std::vector<ThreadStats> threads;
+  std::mutex threads_lock;
+  size_t num_reads;
+  double reads_wall; // wall time spent processing the reads
+  std::vector<Lock> locks;
+  // chunks of reads the workers took at a time, with --lock-stats
+  size_t num_batches;
+  size_t min_batch;
+  size_t max_batch;
+  std::vector<Profile> profiles;
+  std::string profile_error;
+};
+
+// times a stage from construction until stop or destruction
+class StageTimer {
+  public:
+    StageTimer(RunStats& stats, const std::string& name);
+    ~StageTimer();
+    void stop();
+
+  private:
+    RunStats& stats_;
+    std::string name_;
+    double wall_;
+    double cpu_;
+    bool running_;
+};
+
+#endif // KALLISTO_RUNSTATS_H
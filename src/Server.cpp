@@ -0,0 +1,429 @@
+#include "Server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the last line the server sends for a job, followed by the exit status
+static const std::string JOB_DONE = "[serve] job finished with status ";
+// a request is the working directory of the client and the arguments, each
+// terminated by a NUL, and an empty string to end it
+static const size_t MAX_REQUEST_SIZE = 1 << 20;
+// a client has this long to send its request
+static const std::chrono::seconds REQUEST_TIMEOUT(5);
+
+static volatile sig_atomic_t stop_serving = 0;
+
+static void handle_stop(int) {
+  stop_serving = 1;
+}
+
+struct ServerJob {
+  int id;
+  int fd;
+  std::string cwd;
+  std::vector<std::string> args;
+  int threads;
+};
+
+// a connection whose request has not fully arrived yet
+struct PendingRequest {
+  std::string buf;
+  std::chrono::steady_clock::time_point deadline;
+};
+
+static bool make_address(const std::string& path, sockaddr_un& addr) {
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Error: socket path " << path << " is too long" << std::endl;
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+static bool write_all(int fd, const char* p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w <= 0) {
+      return false;
+    }
+    p += w;
+    n -= w;
+  }
+  return true;
+}
+
+static void reply(int fd, const std::string& msg) {
+  write_all(fd, msg.data(), msg.size());
+}
+
+// the number of threads asked for with -t, --threads
+static int job_threads(const std::vector<std::string>& args) {
+  int threads = 1;
+  for (size_t i = 1; i < args.size(); i++) {
+    const auto& a = args[i];
+    if ((a == "-t" || a == "--threads") && i + 1 < args.size()) {
+      threads = atoi(args[++i].c_str());
+    } else if (a.compare(0, 10, "--threads=") == 0) {
+      threads = atoi(a.c_str() + 10);
+    } else if (a.size() > 2 && a.compare(0, 2, "-t") == 0) {
+      threads = atoi(a.c_str() + 2);
+    }
+  }
+  return std::max(threads, 1);
+}
+
+// whether the client on fd runs as the same user as the server
+static bool same_user(int fd) {
+#ifdef SO_PEERCRED
+  ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+static bool request_complete(const std::string& buf) {
+  return buf.size() >= 2 && buf.compare(buf.size() - 2, 2, std::string(2, '\0')) == 0;
+}
+
+// reads what a client has sent so far without blocking. Returns false if
+// the client went away or sent too much, otherwise the request is complete
+// once request_complete says so
+static bool read_request(int fd, std::string& buf) {
+  char tmp[4096];
+  while (!request_complete(buf)) {
+    ssize_t n = read(fd, tmp, sizeof(tmp));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (n <= 0 || buf.size() + n > MAX_REQUEST_SIZE) {
+      return false;
+    }
+    buf.append(tmp, n);
+  }
+  return true;
+}
+
+// splits a complete request into the job, false if it is malformed
+static bool parse_request(const std::string& buf, ServerJob& job) {
+  std::vector<std::string> fields;
+  size_t b = 0;
+  while (b < buf.size() - 1) {
+    size_t e = buf.find('\0', b);
+    fields.push_back(buf.substr(b, e - b));
+    b = e + 1;
+  }
+  if (fields.size() < 2) {
+    return false;
+  }
+  job.cwd = fields[0];
+  job.args.assign(fields.begin() + 1, fields.end());
+  return true;
+}
+
+bool serve(const std::string& socket_path, int max_threads, const JobRunner& run) {
+  sockaddr_un addr;
+  if (!make_address(socket_path, addr)) {
+    return false;
+  }
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // refuse to take over the socket of a server that is still running
+  if (connect(listen_fd, (sockaddr*) &addr, sizeof(addr)) == 0) {
+    std::cerr << "Error: a server is already listening on " << socket_path << std::endl;
+    close(listen_fd);
+    return false;
+  }
+  close(listen_fd);
+  unlink(socket_path.c_str());
+
+  // jobs run as the server's user, only that user may connect. The socket
+  // is created without access for others whatever the umask, and chmod
+  // makes sure of it
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t old_mask = umask(0077);
+  int bound = (listen_fd < 0) ? -1 : bind(listen_fd, (sockaddr*) &addr, sizeof(addr));
+  umask(old_mask);
+  if (listen_fd < 0 || bound != 0 || chmod(socket_path.c_str(), 0600) != 0
+      || listen(listen_fd, 64) != 0) {
+    std::cerr << "Error: could not listen on " << socket_path << ": " << strerror(errno) << std::endl;
+    if (listen_fd >= 0) {
+      close(listen_fd);
+    }
+    return false;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  std::cerr << "[serve] listening on " << socket_path << " with " << max_threads << " threads" << std::endl;
+
+  std::deque<ServerJob> queue;
+  std::map<pid_t, ServerJob> running;
+  // connections are read as their data arrives, so that a slow or stuck
+  // client does not hold up the jobs of the others
+  std::map<int, PendingRequest> pending;
+  int used_threads = 0;
+  int num_jobs = 0;
+
+  std::vector<pollfd> pfds;
+  while (!stop_serving || !running.empty()) {
+    pfds.clear();
+    if (!stop_serving) {
+      pfds.push_back({listen_fd, POLLIN, 0});
+      for (auto& p : pending) {
+        pfds.push_back({p.first, POLLIN, 0});
+      }
+    }
+    int ready = poll(pfds.data(), pfds.size(), 100);
+
+    for (size_t i = 0; ready > 0 && i < pfds.size(); i++) {
+      if (pfds[i].revents == 0) {
+        continue;
+      }
+      int fd = pfds[i].fd;
+      if (fd == listen_fd) {
+        int cfd = accept(listen_fd, nullptr, nullptr);
+        if (cfd >= 0 && !same_user(cfd)) {
+          reply(cfd, "Error: the server only runs jobs of its own user\n" + JOB_DONE + "1\n");
+          close(cfd);
+          std::cerr << "[~warn] refused a connection from another user" << std::endl;
+        } else if (cfd >= 0) {
+          fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+          pending[cfd].deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+        }
+        continue;
+      }
+
+      auto it = pending.find(fd);
+      if (!read_request(fd, it->second.buf)) {
+        // the client is gone, or sent more than any request
+        close(fd);
+        pending.erase(it);
+        continue;
+      }
+      if (!request_complete(it->second.buf)) {
+        continue;
+      }
+      // the job writes to the connection as its stdout and stderr
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+      ServerJob job;
+      job.id = ++num_jobs;
+      job.fd = fd;
+      bool ok = parse_request(it->second.buf, job);
+      pending.erase(it);
+      if (!ok) {
+        reply(fd, "Error: malformed request\n" + JOB_DONE + "1\n");
+        close(fd);
+        continue;
+      }
+      job.threads = job_threads(job.args);
+      if (job.threads > max_threads) {
+        // later options win, so this caps the job at the budget
+        job.args.push_back("--threads=" + std::to_string(max_threads));
+        job.threads = max_threads;
+      }
+      std::cerr << "[serve] job " << job.id << " queued: " << job.args[0]
+                << " with " << job.threads << " threads in " << job.cwd << std::endl;
+      queue.push_back(std::move(job));
+    }
+
+    // drop the clients that did not send a request in time
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = pending.begin(); it != pending.end();) {
+      if (stop_serving || now > it->second.deadline) {
+        fcntl(it->first, F_SETFL, fcntl(it->first, F_GETFL) & ~O_NONBLOCK);
+        reply(it->first, std::string((stop_serving) ? "Error: the server is shutting down\n"
+            : "Error: the request did not arrive in time\n") + JOB_DONE + "1\n");
+        close(it->first);
+        it = pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    // reap the jobs that are done
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      auto it = running.find(pid);
+      if (it == running.end()) {
+        continue;
+      }
+      int ret = (WIFEXITED(status)) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+      reply(it->second.fd, JOB_DONE + std::to_string(ret) + "\n");
+      close(it->second.fd);
+      used_threads -= it->second.threads;
+      std::cerr << "[serve] job " << it->second.id << " finished with status " << ret << std::endl;
+      running.erase(it);
+    }
+
+    if (stop_serving) {
+      // drop the jobs that haven't started
+      for (auto& job : queue) {
+        reply(job.fd, "Error: the server is shutting down\n" + JOB_DONE + "1\n");
+        close(job.fd);
+      }
+      queue.clear();
+      continue;
+    }
+
+    // start whatever fits in the thread budget, in order
+    while (!queue.empty() && used_threads + queue.front().threads <= max_threads) {
+      ServerJob job = std::move(queue.front());
+      queue.pop_front();
+      std::cout.flush();
+      std::cerr.flush();
+      pid = fork();
+      if (pid < 0) {
+        reply(job.fd, std::string("Error: could not start job: ") + strerror(errno) + "\n" + JOB_DONE + "1\n");
+        close(job.fd);
+        continue;
+      }
+      if (pid == 0) {
+        // the job only talks to its own client
+        close(listen_fd);
+        for (auto& p : pending) {
+          close(p.first);
+        }
+        for (auto& j : queue) {
+          close(j.fd);
+        }
+        for (auto& r : running) {
+          close(r.second.fd);
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        int null_fd = open("/dev/null", O_RDONLY);
+        dup2(null_fd, 0);
+        close(null_fd);
+        dup2(job.fd, 1);
+        dup2(job.fd, 2);
+        close(job.fd);
+
+        int ret = 1;
+        if (chdir(job.cwd.c_str()) != 0) {
+          std::cerr << "Error: could not change to directory " << job.cwd << std::endl;
+        } else {
+          ret = run(job.args);
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(stdout);
+        _exit(ret);
+      }
+      used_threads += job.threads;
+      std::cerr << "[serve] job " << job.id << " started" << std::endl;
+      running.insert({pid, std::move(job)});
+    }
+  }
+
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  std::cerr << "[serve] stopped" << std::endl;
+  return true;
+}
+
+int submitJob(const std::string& socket_path, const std::vector<std::string>& args) {
+  sockaddr_un addr;
+  if (!make_address(socket_path, addr)) {
+    return 1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+    std::cerr << "Error: could not connect to a server on " << socket_path << ": " << strerror(errno) << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return 1;
+  }
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    std::cerr << "Error: could not get the working directory" << std::endl;
+    close(fd);
+    return 1;
+  }
+  std::string req(cwd);
+  req.push_back('\0');
+  for (const auto& a : args) {
+    req += a;
+    req.push_back('\0');
+  }
+  req.push_back('\0');
+  signal(SIGPIPE, SIG_IGN);
+  if (!write_all(fd, req.data(), req.size())) {
+    std::cerr << "Error: could not send the job to " << socket_path << std::endl;
+    close(fd);
+    return 1;
+  }
+
+  // relay everything up to the line with the exit status
+  int ret = 1;
+  bool done = false;
+  std::string line;
+  char buf[4096];
+  while (!done) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    for (ssize_t i = 0; i < n && !done; i++) {
+      line.push_back(buf[i]);
+      if (buf[i] != '\n' && buf[i] != '\r') {
+        continue;
+      }
+      // the job may have left a line unfinished
+      size_t p = line.find(JOB_DONE);
+      if (p != std::string::npos) {
+        std::cerr << line.substr(0, p);
+        ret = atoi(line.c_str() + p + JOB_DONE.size());
+        done = true;
+      } else {
+        std::cerr << line;
+      }
+      line.clear();
+    }
+  }
+  std::cerr << line;
+  std::cerr.flush();
+  close(fd);
+  if (!done) {
+    std::cerr << "Error: lost the connection to the server" << std::endl;
+  }
+  return ret;
+}
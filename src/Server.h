@@ -0,0 +1,22 @@
+#ifndef KALLISTO_SERVER_H
+#define KALLISTO_SERVER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// runs one job, args is the command line after "kallisto", e.g. quant ...
+typedef std::function<int(const std::vector<std::string>& args)> JobRunner;
+
+// Serves jobs sent by submitJob on a Unix socket until SIGINT or SIGTERM.
+// Every job runs in a forked child, which shares the memory of the server,
+// including a loaded index, copy-on-write. Jobs are started in the order
+// they arrive as long as the threads they ask for (-t) fit in max_threads,
+// their output goes back to the client
+bool serve(const std::string& socket_path, int max_threads, const JobRunner& run);
+
+// sends a job to a server and relays its output to stderr, returns the
+// exit status of the job
+int submitJob(const std::string& socket_path, const std::vector<std::string>& args);
+
+#endif // KALLISTO_SERVER_H
@@ -0,0 +1,281 @@
+#include "SharedSegment.h"
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t SEGMENT_MAGIC = 0x6b616c6c6973746fULL; // "kallisto"
+// how long to wait for another process to size a segment it created and
+// write its header
+static const int SEGMENT_WAIT_MS = 10000;
+
+// the data follows the header, which the creating process fills in. The
+// magic is written last, a segment is all zeros before that
+struct SegmentHeader {
+  std::atomic<uint64_t> magic;
+  uint64_t tag;
+  uint64_t size;
+  std::atomic<int64_t> pid;
+  std::atomic<uint32_t> ready;
+};
+
+static const size_t HEADER_SIZE = 64;
+static_assert(sizeof(SegmentHeader) <= HEADER_SIZE, "segment header too large");
+
+SharedSegment::~SharedSegment() {
+  unmap();
+}
+
+void SharedSegment::unmap() {
+  if (base_ != nullptr) {
+    munmap(base_, map_size_);
+    base_ = nullptr;
+    map_size_ = 0;
+  }
+}
+
+// the part of a segment name that only depends on the path of file
+static std::string namePrefix(const std::string& file) {
+  std::string path = file;
+  char *real = realpath(file.c_str(), nullptr);
+  if (real != nullptr) {
+    path = real;
+    free(real);
+  }
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "/kallisto-%016llx-",
+      (unsigned long long) std::hash<std::string>()(path));
+  return prefix;
+}
+
+std::string SharedSegment::nameFor(const std::string& file) {
+  std::stringstream key;
+  struct stat st;
+  if (stat(file.c_str(), &st) == 0) {
+    key << st.st_dev << ":" << st.st_ino << ":" << st.st_size << ":" << st.st_mtime;
+  }
+  char version[20];
+  snprintf(version, sizeof(version), "%016llx",
+      (unsigned long long) std::hash<std::string>()(key.str()));
+  return namePrefix(file) + version;
+}
+
+int SharedSegment::removeFor(const std::string& file, const std::string& keep) {
+  std::string prefix = namePrefix(file);
+  std::vector<std::string> names;
+  // on Linux the segments are files in /dev/shm, elsewhere only the one of
+  // the current version of file can be found
+  DIR *dir = opendir("/dev/shm");
+  if (dir != nullptr) {
+    while (dirent *e = readdir(dir)) {
+      std::string name = std::string("/") + e->d_name;
+      if (name.compare(0, prefix.size(), prefix) == 0) {
+        names.push_back(name);
+      }
+    }
+    closedir(dir);
+  } else {
+    names.push_back(nameFor(file));
+  }
+
+  int removed = 0;
+  for (auto& name : names) {
+    if (name == keep) {
+      continue;
+    }
+    // /dev/shm is sticky, but don't rely on it to leave others' segments
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      continue;
+    }
+    struct stat st;
+    bool ours = fstat(fd, &st) == 0 && st.st_uid == geteuid();
+    close(fd);
+    if (ours && remove(name)) {
+      ++removed;
+    }
+  }
+  return removed;
+}
+
+const char* SharedSegment::data() const {
+  return (base_ == nullptr) ? nullptr : (const char*) base_ + HEADER_SIZE;
+}
+
+bool SharedSegment::remove(const std::string& name) {
+  return shm_unlink(name.c_str()) == 0;
+}
+
+bool SharedSegment::open(const std::string& name, uint64_t tag, size_t size,
+    const std::function<bool(char*)>& build) {
+  unmap();
+  created_ = false;
+  // a segment left behind by a crashed process is removed and built again
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool exists = false;
+    if (create(name, tag, size, build, exists)) {
+      created_ = true;
+      return true;
+    }
+    if (!exists) {
+      return false;
+    }
+    bool stale = false;
+    if (attach(name, tag, size, stale)) {
+      return true;
+    }
+    if (!stale) {
+      return false;
+    }
+    std::cerr << "[~warn] removing the unfinished shared memory segment " << name << std::endl;
+    remove(name);
+  }
+  return false;
+}
+
+bool SharedSegment::create(const std::string& name, uint64_t tag, size_t size,
+    const std::function<bool(char*)>& build, bool& exists) {
+  // other users could otherwise read the table, the owner check in attach
+  // keeps them from forging one
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    exists = (errno == EEXIST);
+    if (!exists) {
+      std::cerr << "[~warn] could not create shared memory segment " << name << ": " << strerror(errno) << std::endl;
+    }
+    return false;
+  }
+
+  size_t map_size = HEADER_SIZE + size;
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, map_size) == 0) {
+    p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (p == MAP_FAILED) {
+    std::cerr << "[~warn] could not allocate shared memory segment " << name << ": " << strerror(errno) << std::endl;
+    close(fd);
+    remove(name);
+    return false;
+  }
+#ifdef MADV_HUGEPAGE
+  // large tables are looked up at random, fewer TLB misses help
+  madvise(p, map_size, MADV_HUGEPAGE);
+#endif
+
+  SegmentHeader *header = new (p) SegmentHeader;
+  header->pid.store(getpid());
+  header->tag = tag;
+  header->size = size;
+  header->ready.store(0);
+  header->magic.store(SEGMENT_MAGIC, std::memory_order_release);
+
+  if (!build((char*) p + HEADER_SIZE)) {
+    munmap(p, map_size);
+    close(fd);
+    remove(name);
+    return false;
+  }
+  header->ready.store(1, std::memory_order_release);
+  munmap(p, map_size);
+
+  // the creator sees the data read-only like everyone else
+  base_ = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base_ == MAP_FAILED) {
+    base_ = nullptr;
+    return false;
+  }
+  map_size_ = map_size;
+  return true;
+}
+
+bool SharedSegment::attach(const std::string& name, uint64_t tag, size_t size, bool& stale) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    // removed since, try to create it again
+    stale = (errno == ENOENT);
+    return false;
+  }
+
+  // a segment another user made, with a name anyone can work out, could
+  // hold anything
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_uid != geteuid()) {
+    std::cerr << "[~warn] shared memory segment " << name << " belongs to another user, not using it" << std::endl;
+    close(fd);
+    return false;
+  }
+
+  // the creator may not have sized it yet
+  int waited = 0;
+  while (fstat(fd, &st) == 0 && (size_t) st.st_size < HEADER_SIZE && waited < SEGMENT_WAIT_MS) {
+    usleep(100000);
+    waited += 100;
+  }
+  if ((size_t) st.st_size < HEADER_SIZE) {
+    close(fd);
+    stale = true;
+    return false;
+  }
+
+  size_t map_size = st.st_size;
+  void *p = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    std::cerr << "[~warn] could not map shared memory segment " << name << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  // the creator may have sized it but not written the header yet, wait for
+  // that unless it died in between
+  const SegmentHeader *header = (const SegmentHeader*) p;
+  while (header->magic.load(std::memory_order_acquire) == 0) {
+    int64_t pid = header->pid.load();
+    if ((pid != 0 && kill(pid, 0) != 0 && errno == ESRCH) || waited >= SEGMENT_WAIT_MS) {
+      munmap(p, map_size);
+      stale = true;
+      return false;
+    }
+    usleep(100000);
+    waited += 100;
+  }
+  if (header->magic.load() != SEGMENT_MAGIC || header->tag != tag || header->size != size
+      || map_size != HEADER_SIZE + size) {
+    std::cerr << "[~warn] shared memory segment " << name << " holds different data, not using it" << std::endl;
+    munmap(p, map_size);
+    return false;
+  }
+
+  // wait while the creator fills it, unless it died doing so
+  bool announced = false;
+  while (header->ready.load(std::memory_order_acquire) == 0) {
+    if (kill(header->pid.load(), 0) != 0 && errno == ESRCH) {
+      munmap(p, map_size);
+      stale = true;
+      return false;
+    }
+    if (!announced) {
+      std::cerr << "[index] waiting for process " << header->pid.load() << " to fill " << name << std::endl;
+      announced = true;
+    }
+    usleep(100000);
+  }
+
+  base_ = p;
+  map_size_ = map_size;
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef KALLISTO_SHAREDSEGMENT_H
+#define KALLISTO_SHAREDSEGMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// A named POSIX shared memory segment that the first process to open it
+// fills and every process, including the first, then maps read-only. Only
+// the user that created a segment can use it. Segments stay in /dev/shm
+// after the processes exit, so later runs attach without building them
+// again, until they are removed or the machine reboots
+class SharedSegment {
+  public:
+    SharedSegment() : base_(nullptr), map_size_(0), created_(false) {}
+    ~SharedSegment();
+
+    // a segment name for the contents of file, which changes when the file
+    // is replaced or modified. Names start with a prefix for the path of the
+    // file, so that the segments of its earlier versions can be found
+    static std::string nameFor(const std::string& file);
+
+    // removes the segments of this user for file, those of earlier versions
+    // of it too, except keep. Returns the number removed
+    static int removeFor(const std::string& file, const std::string& keep = "");
+
+    // maps the segment with size bytes of data, calling build to fill it if
+    // it doesn't exist yet. tag identifies the layout of the data, a segment
+    // with another tag or size is not used. false if the segment can't be
+    // used, data() is null then
+    bool open(const std::string& name, uint64_t tag, size_t size,
+        const std::function<bool(char*)>& build);
+
+    const char* data() const;
+    bool created() const { return created_; }
+
+    static bool remove(const std::string& name);
+
+  private:
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    bool create(const std::string& name, uint64_t tag, size_t size,
+        const std::function<bool(char*)>& build, bool& exists);
+    bool attach(const std::string& name, uint64_t tag, size_t size, bool& stale);
+    void unmap();
+
+    void *base_;
+    size_t map_size_;
+    bool created_;
+};
+
+#endif // KALLISTO_SHAREDSEGMENT_H
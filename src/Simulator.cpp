@@ -0,0 +1,185 @@
+#include "Simulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+#include "BGZFWriter.h"
+
+bool readAbundances(const std::string& fn, const KmerIndex& index, std::vector<double>& tpm) {
+  std::ifstream in(fn);
+  if (!in.is_open()) {
+    std::cerr << "Error: could not open abundance file " << fn << std::endl;
+    return false;
+  }
+
+  std::string line, field;
+  std::getline(in, line);
+  int id_col = -1, tpm_col = -1;
+  std::stringstream header(line);
+  for (int i = 0; std::getline(header, field, '\t'); i++) {
+    if (field == "target_id") {
+      id_col = i;
+    } else if (field == "tpm") {
+      tpm_col = i;
+    }
+  }
+  if (id_col == -1 || tpm_col == -1) {
+    std::cerr << "Error: abundance file " << fn << " needs a target_id and a tpm column" << std::endl;
+    return false;
+  }
+
+  std::unordered_map<std::string, int> ids;
+  for (int i = 0; i < index.num_trans; i++) {
+    ids.insert({index.target_names_[i], i});
+  }
+  tpm.assign(index.num_trans, 0.0);
+  size_t num_unknown = 0;
+  std::vector<std::string> fields;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    fields.clear();
+    std::stringstream ss(line);
+    while (std::getline(ss, field, '\t')) {
+      fields.push_back(field);
+    }
+    if (fields.size() <= std::max(id_col, tpm_col)) {
+      std::cerr << "Error: malformed line in abundance file " << fn << ": " << line << std::endl;
+      return false;
+    }
+    auto it = ids.find(fields[id_col]);
+    if (it == ids.end()) {
+      ++num_unknown;
+      continue;
+    }
+    tpm[it->second] = std::max(0.0, atof(fields[tpm_col].c_str()));
+  }
+  if (num_unknown > 0) {
+    std::cerr << "[~warn] " << pretty_num(num_unknown) << " targets in " << fn
+              << " are not in the index, they are skipped" << std::endl;
+  }
+  return true;
+}
+
+std::vector<double> randomAbundances(int num_targets, size_t seed) {
+  std::mt19937 gen(seed);
+  std::lognormal_distribution<double> expr(0.0, 2.0);
+  std::vector<double> tpm(num_targets);
+  double total = 0.0;
+  for (auto& x : tpm) {
+    x = expr(gen);
+    total += x;
+  }
+  for (auto& x : tpm) {
+    x *= 1e6 / total;
+  }
+  return tpm;
+}
+
+bool simulateReads(const KmerIndex& index, const std::vector<double>& tpm, const ProgramOptions& opt) {
+  bool paired = !opt.single_end;
+  int rl = opt.read_length;
+
+  // fragments come from a target in proportion to its abundance and the
+  // number of places a fragment of average length fits in it
+  std::vector<double> weights(index.num_trans, 0.0);
+  double total = 0.0;
+  for (int i = 0; i < index.num_trans; i++) {
+    int len = index.target_lens_[i];
+    if (len >= rl) {
+      weights[i] = tpm[i] * std::max(1.0, len - opt.fld + 1.0);
+      total += weights[i];
+    }
+  }
+  if (total <= 0.0) {
+    std::cerr << "Error: no target with a positive abundance is as long as the reads" << std::endl;
+    return false;
+  }
+
+  std::vector<std::string> fns = {opt.output + "/reads_1.fastq.gz"};
+  if (paired) {
+    fns.push_back(opt.output + "/reads_2.fastq.gz");
+  }
+  // the reads are for benchmarks, compress them fast rather than small
+  std::vector<BGZFWriter> out(fns.size());
+  for (size_t i = 0; i < fns.size(); i++) {
+    if (!out[i].open(fns[i], opt.threads, 1)) {
+      std::cerr << "Error: could not open file " << fns[i] << " for writing" << std::endl;
+      return false;
+    }
+  }
+
+  std::mt19937 gen(opt.seed);
+  std::discrete_distribution<int> target(weights.begin(), weights.end());
+  std::normal_distribution<double> fraglen(opt.fld, opt.sd);
+  std::bernoulli_distribution reverse(0.5);
+  std::uniform_int_distribution<int> other_base(1, 3);
+  // the gaps between errors, rather than a draw for every base
+  std::geometric_distribution<int> error_gap((opt.error_rate > 0.0) ? opt.error_rate : 0.5);
+  static const char bases[] = "ACGT";
+  auto addErrors = [&](std::string& read) {
+    if (opt.error_rate <= 0.0) {
+      return;
+    }
+    for (size_t p = error_gap(gen); p < read.size(); p += 1 + error_gap(gen)) {
+      int b = std::find(bases, bases + 4, read[p]) - bases;
+      read[p] = bases[(b + other_base(gen)) % 4];
+    }
+  };
+
+  std::vector<size_t> counts(index.num_trans, 0);
+  std::string quals(rl, 'I');
+  std::string frag, read, name, rec;
+  for (size_t n = 0; n < opt.sim_reads; n++) {
+    int t = target(gen);
+    const std::string& seq = index.target_seqs_[t];
+    int len = seq.size();
+    int fl = std::min(len, std::max(rl, (int) std::lround(fraglen(gen))));
+    int start = std::uniform_int_distribution<int>(0, len - fl)(gen);
+    bool rev = reverse(gen);
+    ++counts[t];
+
+    frag.assign(seq, start, fl);
+    if (rev) {
+      frag = revcomp(frag);
+    }
+    name = "@" + index.target_names_[t] + ":" + std::to_string(start) + ":" + std::to_string(fl)
+      + ((rev) ? ":-:" : ":+:") + std::to_string(n) + "\n";
+
+    read.assign(frag, 0, rl);
+    addErrors(read);
+    rec = name + read + "\n+\n" + quals + "\n";
+    out[0].write(rec.data(), rec.size());
+    if (paired) {
+      read = revcomp(frag.substr(fl - rl, rl));
+      addErrors(read);
+      rec = name + read + "\n+\n" + quals + "\n";
+      out[1].write(rec.data(), rec.size());
+    }
+  }
+  for (size_t i = 0; i < out.size(); i++) {
+    if (!out[i].close()) {
+      std::cerr << "Error: could not write file " << fns[i] << std::endl;
+      return false;
+    }
+  }
+
+  std::string truthfn = opt.output + "/truth.tsv";
+  std::ofstream truth(truthfn);
+  if (!truth.is_open()) {
+    std::cerr << "Error: could not open file " << truthfn << " for writing" << std::endl;
+    return false;
+  }
+  truth << "target_id\tlength\ttpm\tfragments\n";
+  for (int i = 0; i < index.num_trans; i++) {
+    truth << index.target_names_[i] << "\t" << index.target_lens_[i] << "\t"
+          << tpm[i] << "\t" << counts[i] << "\n";
+  }
+  return true;
+}
@@ -0,0 +1,30 @@
+#ifndef KALLISTO_SIMULATOR_H
+#define KALLISTO_SIMULATOR_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "KmerIndex.h"
+
+// Simulates RNA-seq reads from the targets of an index, for benchmarks that
+// need more reads than the test data has. Fragments are drawn from targets
+// in proportion to abundance times effective length, with a normal fragment
+// length, either strand and uniform substitution errors. The reads only
+// depend on the seed, not on the number of threads, which compress the
+// output
+
+// reads the target_id and tpm columns of a tab separated file with a header,
+// such as the abundance.tsv of quant, into a tpm per target of the index.
+// Targets missing from the file get 0
+bool readAbundances(const std::string& fn, const KmerIndex& index, std::vector<double>& tpm);
+
+// random abundances, log-normally distributed, scaled to a million
+std::vector<double> randomAbundances(int num_targets, size_t seed);
+
+// writes opt.sim_reads fragments to reads_1.fastq.gz (and reads_2.fastq.gz
+// for paired-end reads) in opt.output, and the fragments drawn from each
+// target to truth.tsv. Needs the target sequences of the index
+bool simulateReads(const KmerIndex& index, const std::vector<double>& tpm, const ProgramOptions& opt);
+
+#endif // KALLISTO_SIMULATOR_H
@@ -19,6 +19,8 @@ struct ProgramOptions {
   double sd;
   int min_range;
   int bootstrap;
+  bool sparse_bootstrap;
+  bool bootstrap_summary;
   std::vector<std::string> transfasta;
   bool batch_mode;
   std::string batch_file_name;
@@ -28,16 +30,35 @@ struct ProgramOptions {
   std::vector<std::string> umi_files;
   bool plaintext;
   bool write_index;
+  bool shared_index; // k-mer table in shared memory
+  bool lock_stats; // count lock contention of the worker threads
+  int progress_interval; // seconds between progress reports, 0 for none
+  bool profile; // hardware counters in run_info.json
+  std::string status_file; // progress as JSON for job monitors
   bool single_end;
+  bool interleaved; // both reads of a pair in one file
   bool strand_specific;
   bool peek; // only used for H5Dump
   bool bias;
+  bool single_precision;
   bool pseudobam;
+  bool sortedbam;
+  bool genomebam;
+  bool matrix_h5;
+  std::string gtf;
+  std::string chrom_sizes;
   bool make_unique;
   enum class StrandType {None, FR, RF};
   StrandType strand;
   bool umi;
   std::string gfa; // used for inspect
+  bool remove_shared; // used for inspect
+  std::string server_socket; // used for serve and submit
+  // used for simulate
+  size_t sim_reads;
+  int read_length;
+  double error_rate;
+  std::string abundance_file;
 
 ProgramOptions() :
   verbose(false),
@@ -50,17 +71,32 @@ ProgramOptions() :
   sd(0.0),
   min_range(1),
   bootstrap(0),
+  sparse_bootstrap(false),
+  bootstrap_summary(false),
   batch_mode(false),
   plaintext(false),
   write_index(false),
+  shared_index(false),
+  lock_stats(false),
+  progress_interval(0),
+  profile(false),
   single_end(false),
+  interleaved(false),
   strand_specific(false),
   peek(false),
   bias(false),
+  single_precision(false),
   pseudobam(false),
+  sortedbam(false),
+  genomebam(false),
+  matrix_h5(false),
   make_unique(false),
   strand(StrandType::None),
-  umi(false)
+  umi(false),
+  remove_shared(false),
+  sim_reads(1000000),
+  read_length(100),
+  error_rate(0.001)
   {}
 };
 
@@ -26,10 +26,18 @@ const double* vec_to_ptr(const std::vector<double>& v) {
   return v.data();
 }
 
+const float* vec_to_ptr(const std::vector<float>& v) {
+  return v.data();
+}
+
 const int* vec_to_ptr(const std::vector<int>& v) {
   return v.data();
 }
 
+const int64_t* vec_to_ptr(const std::vector<int64_t>& v) {
+  return v.data();
+}
+
 hid_t get_datatype_id(const std::vector<std::string>& v) {
   size_t max_len = 0;
   for (auto& x : v) {
@@ -55,11 +63,21 @@ hid_t get_datatype_id(const std::vector<double>& v) {
   return H5T_NATIVE_DOUBLE;
 }
 
+hid_t get_datatype_id(const std::vector<float>& v) {
+  v.size(); // shutup, compiler
+  return H5T_NATIVE_FLOAT;
+}
+
 hid_t get_datatype_id(const std::vector<int>& v) {
   v.size(); // shutup, compiler
   return H5T_NATIVE_INT;
 }
 
+hid_t get_datatype_id(const std::vector<int64_t>& v) {
+  v.size(); // shutup, compiler
+  return H5T_NATIVE_INT64;
+}
+
 void read_vector(
     hid_t dataset_id,
     hid_t datatype_id,
@@ -138,3 +156,25 @@ void read_vector(
 
   delete [] pool;
 }
+
+void read_vector(
+    hid_t dataset_id,
+    hid_t datatype_id,
+    hid_t dataspace_id,
+    std::vector<float>& out) {
+
+  hsize_t dims[1];
+
+  H5Sget_simple_extent_dims(dataspace_id, dims, NULL);
+
+  float *pool = new float[ dims[0] ];
+
+  H5Dread(dataset_id, datatype_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, pool);
+  out.reserve(dims[0]);
+
+  for (size_t i = 0; i < dims[0]; ++i) {
+    out.push_back( pool[i] );
+  }
+
+  delete [] pool;
+}
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 
+#include <cstdint>
 #include <cstring>
 #include <memory>
 #include <string>
@@ -18,14 +19,22 @@ char* vec_to_ptr(const std::vector<std::string>& v);
 
 const double* vec_to_ptr(const std::vector<double>& v);
 
+const float* vec_to_ptr(const std::vector<float>& v);
+
 const int* vec_to_ptr(const std::vector<int>& v);
 
+const int64_t* vec_to_ptr(const std::vector<int64_t>& v);
+
 hid_t get_datatype_id(const std::vector<std::string>& v);
 
 hid_t get_datatype_id(const std::vector<double>& v);
 
+hid_t get_datatype_id(const std::vector<float>& v);
+
 hid_t get_datatype_id(const std::vector<int>& v);
 
+hid_t get_datatype_id(const std::vector<int64_t>& v);
+
 // str_vec: a vector of string to be written out
 // group_id: a group_id which has already been opened
 // dataset_name: the to write out to
@@ -47,12 +56,14 @@ herr_t vector_to_h5(
 
   // create the propery which allows for compression
   hid_t prop_id = H5Pcreate(H5P_DATASET_CREATE);
-  // chunk size is same size as vector
-  status = H5Pset_chunk(prop_id, 1, dims);
-  assert( status >= 0 );
+  // chunk size is same size as vector, empty datasets can't be chunked
+  if (dims[0] > 0) {
+    status = H5Pset_chunk(prop_id, 1, dims);
+    assert( status >= 0 );
 
-  status = H5Pset_deflate(prop_id, compression_level);
-  assert( status >= 0 );
+    status = H5Pset_deflate(prop_id, compression_level);
+    assert( status >= 0 );
+  }
 
   // create the data type
   hid_t datatype_id = get_datatype_id(str_vec);
@@ -85,6 +96,79 @@ herr_t vector_to_h5(
   return status;
 }
 
+// creates an empty 1-d dataset of T which can be grown with append_to_h5,
+// stored in compressed chunks of chunk_size elements
+//
+// return: the id of the dataset, close it with H5Dclose
+template <typename T>
+hid_t create_extendable_h5(
+    hid_t group_id,
+    const std::string& dataset_name,
+    hsize_t chunk_size,
+    uint compression_level = 6
+    ) {
+  herr_t status;
+
+  hsize_t dims[1] = {0};
+  hsize_t max_dims[1] = {H5S_UNLIMITED};
+  hsize_t chunk_dims[1] = {chunk_size};
+
+  hid_t prop_id = H5Pcreate(H5P_DATASET_CREATE);
+  status = H5Pset_chunk(prop_id, 1, chunk_dims);
+  assert( status >= 0 );
+  status = H5Pset_deflate(prop_id, compression_level);
+  assert( status >= 0 );
+
+  hid_t dataspace_id = H5Screate_simple(1, dims, max_dims);
+  hid_t dataset_id = H5Dcreate(group_id, dataset_name.c_str(),
+      get_datatype_id(std::vector<T>()), dataspace_id, H5P_DEFAULT, prop_id,
+      H5P_DEFAULT);
+
+  status = H5Pclose(prop_id);
+  assert( status >= 0 );
+  status = H5Sclose(dataspace_id);
+  assert( status >= 0 );
+
+  return dataset_id;
+}
+
+// appends v to the end of a dataset made by create_extendable_h5
+//
+// return: the status of H5Dwrite
+template <typename T>
+herr_t append_to_h5(hid_t dataset_id, const std::vector<T>& v) {
+  herr_t status;
+  if (v.empty()) {
+    return 0;
+  }
+
+  hid_t dataspace_id = H5Dget_space(dataset_id);
+  hsize_t offset[1];
+  H5Sget_simple_extent_dims(dataspace_id, offset, NULL);
+  H5Sclose(dataspace_id);
+
+  hsize_t count[1] = {v.size()};
+  hsize_t dims[1] = {offset[0] + count[0]};
+  status = H5Dset_extent(dataset_id, dims);
+  assert( status >= 0 );
+
+  // write v into the new tail of the dataset
+  dataspace_id = H5Dget_space(dataset_id);
+  status = H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, offset, NULL,
+      count, NULL);
+  assert( status >= 0 );
+  hid_t memspace_id = H5Screate_simple(1, count, NULL);
+
+  status = H5Dwrite(dataset_id, get_datatype_id(v), memspace_id,
+      dataspace_id, H5P_DEFAULT, vec_to_ptr(v));
+  assert( status >= 0 );
+
+  H5Sclose(memspace_id);
+  H5Sclose(dataspace_id);
+
+  return status;
+}
+
 // end: writing utils
 
 // begin: reading utils
@@ -100,6 +184,9 @@ void read_vector(hid_t dataset_id, hid_t datatype_id, hid_t dataspace_id,
 void read_vector(hid_t dataset_id, hid_t datatype_id, hid_t dataspace_id,
     std::vector<double>& out);
 
+void read_vector(hid_t dataset_id, hid_t datatype_id, hid_t dataspace_id,
+    std::vector<float>& out);
+
 template <typename T>
 void read_dataset(hid_t group_id,
     const std::string& dset_name,
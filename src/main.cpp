@@ -1,5 +1,6 @@
 #include <string>
 #include <iostream>
+#include <memory>
 #include <random>
 #include <sstream>
 #include <vector>
@@ -9,6 +10,8 @@
 #include <time.h>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include <zlib.h>
 
@@ -21,7 +24,12 @@
 #include "weights.h"
 #include "Inspect.h"
 #include "Bootstrap.h"
+#include "BootstrapSummary.h"
 #include "H5Writer.h"
+#include "Server.h"
+#include "RunStats.h"
+#include "Simulator.h"
+#include "PerfCounters.h"
 
 
 //#define ERROR_STR "\033[1mError:\033[0m"
@@ -80,11 +88,12 @@ void ParseOptionsIndex(int argc, char **argv, ProgramOptions& opt) {
 }
 
 void ParseOptionsInspect(int argc, char **argv, ProgramOptions& opt) {
-
+  int remove_shared_flag = 0;
 
   const char *opt_string = "";
   static struct option long_options[] = {
     // long args
+    {"remove-shared", no_argument, &remove_shared_flag, 1},
     {"gfa", required_argument, 0, 'g'},
     {0,0,0,0}
   };
@@ -108,6 +117,7 @@ void ParseOptionsInspect(int argc, char **argv, ProgramOptions& opt) {
     default: break;
     }
   }
+  opt.remove_shared = remove_shared_flag;
   opt.index = argv[optind];
 }
 
@@ -118,22 +128,42 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
   int plaintext_flag = 0;
   int write_index_flag = 0;
   int single_flag = 0;
+  int interleaved_flag = 0;
+  int shared_index_flag = 0;
+  int lock_stats_flag = 0;
+  int profile_flag = 0;
   int strand_FR_flag = 0;
   int strand_RF_flag = 0;
   int bias_flag = 0;
   int pbam_flag = 0;
+  int sbam_flag = 0;
+  int gbam_flag = 0;
+  int sparse_bs_flag = 0;
+  int bs_summary_flag = 0;
+  int single_precision_flag = 0;
 
-  const char *opt_string = "t:i:l:s:o:n:m:d:b:";
+  const char *opt_string = "t:i:l:s:o:n:m:d:b:g:";
   static struct option long_options[] = {
     // long args
     {"verbose", no_argument, &verbose_flag, 1},
     {"plaintext", no_argument, &plaintext_flag, 1},
     {"write-index", no_argument, &write_index_flag, 1},
     {"single", no_argument, &single_flag, 1},
+    {"interleaved", no_argument, &interleaved_flag, 1},
+    {"shared-index", no_argument, &shared_index_flag, 1},
+    {"lock-stats", no_argument, &lock_stats_flag, 1},
+    {"profile", no_argument, &profile_flag, 1},
+    {"progress", required_argument, 0, 'P'},
+    {"status-file", required_argument, 0, 'F'},
     {"fr-stranded", no_argument, &strand_FR_flag, 1},
     {"rf-stranded", no_argument, &strand_RF_flag, 1},
     {"bias", no_argument, &bias_flag, 1},
     {"pseudobam", no_argument, &pbam_flag, 1},
+    {"sortedbam", no_argument, &sbam_flag, 1},
+    {"genomebam", no_argument, &gbam_flag, 1},
+    {"sparse-bootstrap", no_argument, &sparse_bs_flag, 1},
+    {"bootstrap-summary", no_argument, &bs_summary_flag, 1},
+    {"single-precision", no_argument, &single_precision_flag, 1},
     {"seed", required_argument, 0, 'd'},
     // short args
     {"threads", required_argument, 0, 't'},
@@ -144,6 +174,8 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
     {"iterations", required_argument, 0, 'n'},
     {"min-range", required_argument, 0, 'm'},
     {"bootstrap-samples", required_argument, 0, 'b'},
+    {"gtf", required_argument, 0, 'g'},
+    {"chromosomes", required_argument, 0, 'C'},
     {0,0,0,0}
   };
   int c;
@@ -193,6 +225,22 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
       stringstream(optarg) >> opt.seed;
       break;
     }
+    case 'g': {
+      opt.gtf = optarg;
+      break;
+    }
+    case 'C': {
+      opt.chrom_sizes = optarg;
+      break;
+    }
+    case 'P': {
+      stringstream(optarg) >> opt.progress_interval;
+      break;
+    }
+    case 'F': {
+      opt.status_file = optarg;
+      break;
+    }
     default: break;
     }
   }
@@ -218,6 +266,22 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
     opt.single_end = true;
   }
 
+  if (interleaved_flag) {
+    opt.interleaved = true;
+  }
+
+  if (shared_index_flag) {
+    opt.shared_index = true;
+  }
+
+  if (lock_stats_flag) {
+    opt.lock_stats = true;
+  }
+
+  if (profile_flag) {
+    opt.profile = true;
+  }
+
   if (strand_FR_flag) {
     opt.strand_specific = true;
     opt.strand = ProgramOptions::StrandType::FR;
@@ -235,17 +299,46 @@ void ParseOptionsEM(int argc, char **argv, ProgramOptions& opt) {
   if (pbam_flag) {
     opt.pseudobam = true;
   }
+
+  if (sbam_flag) {
+    opt.pseudobam = true;
+    opt.sortedbam = true;
+  }
+
+  if (gbam_flag) {
+    opt.pseudobam = true;
+    opt.sortedbam = true;
+    opt.genomebam = true;
+  }
+
+  if (sparse_bs_flag) {
+    opt.sparse_bootstrap = true;
+  }
+
+  if (bs_summary_flag) {
+    opt.bootstrap_summary = true;
+  }
+
+  if (single_precision_flag) {
+    opt.single_precision = true;
+  }
 }
 
 void ParseOptionsEMOnly(int argc, char **argv, ProgramOptions& opt) {
   int verbose_flag = 0;
   int plaintext_flag = 0;
+  int sparse_bs_flag = 0;
+  int bs_summary_flag = 0;
+  int single_precision_flag = 0;
 
   const char *opt_string = "t:s:l:s:o:n:m:d:b:";
   static struct option long_options[] = {
     // long args
     {"verbose", no_argument, &verbose_flag, 1},
     {"plaintext", no_argument, &plaintext_flag, 1},
+    {"sparse-bootstrap", no_argument, &sparse_bs_flag, 1},
+    {"bootstrap-summary", no_argument, &bs_summary_flag, 1},
+    {"single-precision", no_argument, &single_precision_flag, 1},
     {"seed", required_argument, 0, 'd'},
     // short args
     {"threads", required_argument, 0, 't'},
@@ -311,23 +404,51 @@ void ParseOptionsEMOnly(int argc, char **argv, ProgramOptions& opt) {
   if (plaintext_flag) {
     opt.plaintext = true;
   }
+
+  if (sparse_bs_flag) {
+    opt.sparse_bootstrap = true;
+  }
+
+  if (bs_summary_flag) {
+    opt.bootstrap_summary = true;
+  }
+
+  if (single_precision_flag) {
+    opt.single_precision = true;
+  }
 }
 
 void ParseOptionsPseudo(int argc, char **argv, ProgramOptions& opt) {
   int verbose_flag = 0;
   int single_flag = 0;
+  int interleaved_flag = 0;
+  int shared_index_flag = 0;
+  int lock_stats_flag = 0;
+  int profile_flag = 0;
   int strand_flag = 0;
   int pbam_flag = 0;
+  int sbam_flag = 0;
+  int gbam_flag = 0;
   int umi_flag = 0;
+  int h5_flag = 0;
 
-  const char *opt_string = "t:i:l:s:o:b:";
+  const char *opt_string = "t:i:l:s:o:b:g:";
   static struct option long_options[] = {
     // long args
     {"verbose", no_argument, &verbose_flag, 1},
     {"single", no_argument, &single_flag, 1},
+    {"interleaved", no_argument, &interleaved_flag, 1},
+    {"shared-index", no_argument, &shared_index_flag, 1},
+    {"lock-stats", no_argument, &lock_stats_flag, 1},
+    {"profile", no_argument, &profile_flag, 1},
+    {"progress", required_argument, 0, 'P'},
+    {"status-file", required_argument, 0, 'F'},
     //{"strand-specific", no_argument, &strand_flag, 1},
     {"pseudobam", no_argument, &pbam_flag, 1},
+    {"sortedbam", no_argument, &sbam_flag, 1},
+    {"genomebam", no_argument, &gbam_flag, 1},
     {"umi", no_argument, &umi_flag, 'u'},
+    {"hdf5", no_argument, &h5_flag, 1},
     {"batch", required_argument, 0, 'b'},
     // short args
     {"threads", required_argument, 0, 't'},
@@ -335,6 +456,8 @@ void ParseOptionsPseudo(int argc, char **argv, ProgramOptions& opt) {
     {"fragment-length", required_argument, 0, 'l'},
     {"sd", required_argument, 0, 's'},
     {"output-dir", required_argument, 0, 'o'},
+    {"gtf", required_argument, 0, 'g'},
+    {"chromosomes", required_argument, 0, 'C'},
     {0,0,0,0}
   };
   int c;
@@ -374,6 +497,22 @@ void ParseOptionsPseudo(int argc, char **argv, ProgramOptions& opt) {
       opt.batch_file_name = optarg;
       break;
     }
+    case 'g': {
+      opt.gtf = optarg;
+      break;
+    }
+    case 'C': {
+      opt.chrom_sizes = optarg;
+      break;
+    }
+    case 'P': {
+      stringstream(optarg) >> opt.progress_interval;
+      break;
+    }
+    case 'F': {
+      opt.status_file = optarg;
+      break;
+    }
     default: break;
     }
   }
@@ -383,6 +522,10 @@ void ParseOptionsPseudo(int argc, char **argv, ProgramOptions& opt) {
     opt.single_end = true; // UMI implies single end reads
   }
 
+  if (h5_flag) {
+    opt.matrix_h5 = true;
+  }
+
   // all other arguments are fast[a/q] files to be read
   for (int i = optind; i < argc; i++) {
     opt.files.push_back(argv[i]);
@@ -396,6 +539,22 @@ void ParseOptionsPseudo(int argc, char **argv, ProgramOptions& opt) {
     opt.single_end = true;
   }
 
+  if (interleaved_flag) {
+    opt.interleaved = true;
+  }
+
+  if (shared_index_flag) {
+    opt.shared_index = true;
+  }
+
+  if (lock_stats_flag) {
+    opt.lock_stats = true;
+  }
+
+  if (profile_flag) {
+    opt.profile = true;
+  }
+
   if (strand_flag) {
     opt.strand_specific = true;
   }
@@ -403,6 +562,17 @@ void ParseOptionsPseudo(int argc, char **argv, ProgramOptions& opt) {
   if (pbam_flag) {
     opt.pseudobam = true;
   }
+
+  if (sbam_flag) {
+    opt.pseudobam = true;
+    opt.sortedbam = true;
+  }
+
+  if (gbam_flag) {
+    opt.pseudobam = true;
+    opt.sortedbam = true;
+    opt.genomebam = true;
+  }
   
   
 }
@@ -449,6 +619,128 @@ void ParseOptionsH5Dump(int argc, char **argv, ProgramOptions& opt) {
   }
 }
 
+void ParseOptionsServe(int argc, char **argv, ProgramOptions& opt) {
+  const char *opt_string = "i:t:";
+  static struct option long_options[] = {
+    // long args
+    {"socket", required_argument, 0, 'S'},
+    // short args
+    {"index", required_argument, 0, 'i'},
+    {"threads", required_argument, 0, 't'},
+    {0,0,0,0}
+  };
+
+  int c;
+  int option_index = 0;
+  while (true) {
+    c = getopt_long(argc, argv, opt_string, long_options, &option_index);
+
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 0:
+      break;
+    case 'i': {
+      opt.index = optarg;
+      break;
+    }
+    case 't': {
+      stringstream(optarg) >> opt.threads;
+      break;
+    }
+    case 'S': {
+      opt.server_socket = optarg;
+      break;
+    }
+    default: break;
+    }
+  }
+}
+
+void ParseOptionsSimulate(int argc, char **argv, ProgramOptions& opt) {
+  int single_flag = 0;
+
+  const char *opt_string = "i:o:n:l:s:r:e:a:t:";
+  static struct option long_options[] = {
+    // long args
+    {"single", no_argument, &single_flag, 1},
+    {"seed", required_argument, 0, 'd'},
+    // short args
+    {"index", required_argument, 0, 'i'},
+    {"output-dir", required_argument, 0, 'o'},
+    {"reads", required_argument, 0, 'n'},
+    {"fragment-length", required_argument, 0, 'l'},
+    {"sd", required_argument, 0, 's'},
+    {"read-length", required_argument, 0, 'r'},
+    {"error-rate", required_argument, 0, 'e'},
+    {"abundance", required_argument, 0, 'a'},
+    {"threads", required_argument, 0, 't'},
+    {0,0,0,0}
+  };
+
+  int c;
+  int option_index = 0;
+  while (true) {
+    c = getopt_long(argc, argv, opt_string, long_options, &option_index);
+
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 0:
+      break;
+    case 'i': {
+      opt.index = optarg;
+      break;
+    }
+    case 'o': {
+      opt.output = optarg;
+      break;
+    }
+    case 'n': {
+      stringstream(optarg) >> opt.sim_reads;
+      break;
+    }
+    case 'l': {
+      stringstream(optarg) >> opt.fld;
+      break;
+    }
+    case 's': {
+      stringstream(optarg) >> opt.sd;
+      break;
+    }
+    case 'r': {
+      stringstream(optarg) >> opt.read_length;
+      break;
+    }
+    case 'e': {
+      stringstream(optarg) >> opt.error_rate;
+      break;
+    }
+    case 'a': {
+      opt.abundance_file = optarg;
+      break;
+    }
+    case 't': {
+      stringstream(optarg) >> opt.threads;
+      break;
+    }
+    case 'd': {
+      stringstream(optarg) >> opt.seed;
+      break;
+    }
+    default: break;
+    }
+  }
+
+  if (single_flag) {
+    opt.single_end = true;
+  }
+}
+
 bool CheckOptionsIndex(ProgramOptions& opt) {
 
   bool ret = true;
@@ -514,13 +806,22 @@ bool CheckOptionsEM(ProgramOptions& opt, bool emonly = false) {
       ret = false;
     } else {
       struct stat stFileInfo;
+      int num_stdin = 0;
       for (auto& fn : opt.files) {
+        if (fn == "-") {
+          ++num_stdin;
+          continue;
+        }
         auto intStat = stat(fn.c_str(), &stFileInfo);
         if (intStat != 0) {
           cerr << ERROR_STR << " file not found " << fn << endl;
           ret = false;
         }
       }
+      if (num_stdin > 1) {
+        cerr << ERROR_STR << " standard input (-) can only be given once" << endl;
+        ret = false;
+      }
     }
 
     /*
@@ -529,7 +830,12 @@ bool CheckOptionsEM(ProgramOptions& opt, bool emonly = false) {
       ret = false;
     }*/
 
-    if (!opt.single_end) {
+    if (opt.interleaved && opt.single_end) {
+      cerr << "Error: --interleaved is for paired-end reads and cannot be used with --single" << endl;
+      ret = false;
+    }
+
+    if (!opt.single_end && !opt.interleaved) {
       if (opt.files.size() % 2 != 0) {
         cerr << "Error: paired-end mode requires an even number of input files" << endl
              << "       (use --single for processing single-end reads)" << endl;
@@ -633,10 +939,13 @@ bool CheckOptionsEM(ProgramOptions& opt, bool emonly = false) {
       cerr << "Warning: you asked for " << opt.threads
            << ", but only " << n << " cores on the machine" << endl;
     }
-    if (opt.threads > 1 && opt.pseudobam) {
-      cerr << "Error: pseudobam is not compatible with running on many threads."<< endl;
-      ret = false;
-    }
+  }
+
+  if (opt.progress_interval < 0) {
+    cerr << "Error: invalid progress interval " << opt.progress_interval << endl;
+    ret = false;
+  } else if (!opt.status_file.empty() && opt.progress_interval == 0) {
+    opt.progress_interval = 10;
   }
 
   if (opt.bootstrap < 0) {
@@ -644,6 +953,46 @@ bool CheckOptionsEM(ProgramOptions& opt, bool emonly = false) {
     ret = false;
   }
 
+  if (opt.sparse_bootstrap && opt.plaintext) {
+    cerr << "Error: sparse bootstraps are only supported for HDF5 output, cannot use --plaintext" << endl;
+    ret = false;
+  }
+
+  if (opt.bootstrap_summary && opt.sparse_bootstrap) {
+    cerr << "Error: cannot use --sparse-bootstrap with --bootstrap-summary, no bootstraps are stored" << endl;
+    ret = false;
+  }
+
+  if (opt.bootstrap_summary && opt.bootstrap == 0) {
+    cerr << "[~warn] --bootstrap-summary has no effect without bootstrap samples (-b)" << endl;
+  }
+
+  if (opt.genomebam) {
+    if (opt.gtf.empty()) {
+      cerr << "Error: --genomebam requires a GTF file, use --gtf" << endl;
+      ret = false;
+    } else {
+      struct stat stFileInfo;
+      auto intStat = stat(opt.gtf.c_str(), &stFileInfo);
+      if (intStat != 0) {
+        cerr << "Error: GTF file not found " << opt.gtf << endl;
+        ret = false;
+      }
+    }
+    if (opt.chrom_sizes.empty()) {
+      cerr << "[~warn] without --chromosomes the BAM header has chromosome lengths from the GTF file" << endl;
+    } else {
+      struct stat stFileInfo;
+      auto intStat = stat(opt.chrom_sizes.c_str(), &stFileInfo);
+      if (intStat != 0) {
+        cerr << "Error: chromosome sizes file not found " << opt.chrom_sizes << endl;
+        ret = false;
+      }
+    }
+  } else if (!opt.gtf.empty() || !opt.chrom_sizes.empty()) {
+    cerr << "[~warn] --gtf and --chromosomes are only used with --genomebam" << endl;
+  }
+
   return ret;
 }
 
@@ -679,13 +1028,22 @@ bool CheckOptionsPseudo(ProgramOptions& opt) {
       ret = false;
     } else {
       struct stat stFileInfo;      
+      int num_stdin = 0;
       for (auto& fn : opt.files) {        
+        if (fn == "-") {
+          ++num_stdin;
+          continue;
+        }
         auto intStat = stat(fn.c_str(), &stFileInfo);
         if (intStat != 0) {
           cerr << ERROR_STR << " file not found " << fn << endl;
           ret = false;
         }
       }
+      if (num_stdin > 1) {
+        cerr << ERROR_STR << " standard input (-) can only be given once" << endl;
+        ret = false;
+      }
     }
   } else {
     if (opt.files.size() != 0) {
@@ -714,7 +1072,7 @@ bool CheckOptionsPseudo(ProgramOptions& opt) {
             continue;
           }
           opt.batch_ids.push_back(id);
-          if (opt.single_end && !opt.umi) {
+          if ((opt.single_end || opt.interleaved) && !opt.umi) {
             ss >> f1;
             opt.batch_files.push_back({f1});
             intstat = stat(f1.c_str(), &stFileInfo);
@@ -753,7 +1111,12 @@ bool CheckOptionsPseudo(ProgramOptions& opt) {
     ret = false;
   }*/
 
-  if (!opt.single_end) {
+  if (opt.interleaved && opt.single_end) {
+    cerr << "Error: --interleaved is for paired-end reads and cannot be used with --single or --umi" << endl;
+    ret = false;
+  }
+
+  if (!opt.single_end && !opt.interleaved) {
     if (opt.files.size() % 2 != 0) {
       cerr << "Error: paired-end mode requires an even number of input files" << endl
            << "       (use --single for processing single-end reads)" << endl;
@@ -830,10 +1193,50 @@ bool CheckOptionsPseudo(ProgramOptions& opt) {
       cerr << "Warning: you asked for " << opt.threads
            << ", but only " << n << " cores on the machine" << endl;
     }
-    if (opt.threads > 1 && opt.pseudobam) {
-      cerr << "Error: pseudobam is not compatible with running on many threads."<< endl;
+  }
+
+  if (opt.progress_interval < 0) {
+    cerr << "Error: invalid progress interval " << opt.progress_interval << endl;
+    ret = false;
+  } else if (!opt.status_file.empty() && opt.progress_interval == 0) {
+    opt.progress_interval = 10;
+  }
+
+  if (opt.genomebam) {
+    if (opt.gtf.empty()) {
+      cerr << "Error: --genomebam requires a GTF file, use --gtf" << endl;
       ret = false;
+    } else {
+      struct stat stFileInfo;
+      auto intStat = stat(opt.gtf.c_str(), &stFileInfo);
+      if (intStat != 0) {
+        cerr << "Error: GTF file not found " << opt.gtf << endl;
+        ret = false;
+      }
     }
+    if (opt.chrom_sizes.empty()) {
+      cerr << "[~warn] without --chromosomes the BAM header has chromosome lengths from the GTF file" << endl;
+    } else {
+      struct stat stFileInfo;
+      auto intStat = stat(opt.chrom_sizes.c_str(), &stFileInfo);
+      if (intStat != 0) {
+        cerr << "Error: chromosome sizes file not found " << opt.chrom_sizes << endl;
+        ret = false;
+      }
+    }
+  } else if (!opt.gtf.empty() || !opt.chrom_sizes.empty()) {
+    cerr << "[~warn] --gtf and --chromosomes are only used with --genomebam" << endl;
+  }
+
+  if (opt.matrix_h5 && !opt.batch_mode) {
+    cerr << "[~warn] --hdf5 only applies to the batch matrix, use --batch" << endl;
+  }
+
+  if (opt.pseudobam && opt.batch_mode) {
+    // batch mode reads neither names nor qualities, and its batches are
+    // not numbered for the ordered BAM output
+    cerr << "Error: --pseudobam, --sortedbam and --genomebam cannot be used with --batch" << endl;
+    ret = false;
   }
 
   return ret;
@@ -906,6 +1309,116 @@ bool CheckOptionsH5Dump(ProgramOptions& opt) {
   return ret;
 }
 
+bool CheckOptionsServe(ProgramOptions& opt) {
+  bool ret = true;
+  if (opt.index.empty()) {
+    cerr << "Error: kallisto index file missing" << endl;
+    ret = false;
+  } else {
+    struct stat stFileInfo;
+    auto intStat = stat(opt.index.c_str(), &stFileInfo);
+    if (intStat != 0) {
+      cerr << "Error: kallisto index file not found " << opt.index << endl;
+      ret = false;
+    } else {
+      // jobs run in the directories of their clients
+      char *path = realpath(opt.index.c_str(), nullptr);
+      opt.index = path;
+      free(path);
+    }
+  }
+
+  if (opt.server_socket.empty()) {
+    cerr << "Error: need a socket file to listen on" << endl;
+    ret = false;
+  }
+
+  if (opt.threads <= 0) {
+    cerr << "Error: invalid number of threads " << opt.threads << endl;
+    ret = false;
+  } else {
+    unsigned int n = std::thread::hardware_concurrency();
+    if (n != 0 && n < opt.threads) {
+      cerr << "Warning: you asked for " << opt.threads
+           << ", but only " << n << " cores on the machine" << endl;
+    }
+  }
+
+  return ret;
+}
+
+bool CheckOptionsSimulate(ProgramOptions& opt) {
+  bool ret = true;
+  if (opt.index.empty()) {
+    cerr << "Error: kallisto index file missing" << endl;
+    ret = false;
+  } else {
+    struct stat stFileInfo;
+    auto intStat = stat(opt.index.c_str(), &stFileInfo);
+    if (intStat != 0) {
+      cerr << "Error: kallisto index file not found " << opt.index << endl;
+      ret = false;
+    }
+  }
+
+  if (opt.sim_reads == 0) {
+    cerr << "Error: number of reads to simulate must be positive" << endl;
+    ret = false;
+  }
+  if (opt.read_length < 1) {
+    cerr << "Error: invalid read length " << opt.read_length << endl;
+    ret = false;
+  }
+  if (opt.error_rate < 0.0 || opt.error_rate >= 1.0) {
+    cerr << "Error: error rate must be at least 0 and less than 1" << endl;
+    ret = false;
+  }
+
+  if (opt.fld == 0.0 && opt.sd == 0.0) {
+    opt.fld = 200.0;
+    opt.sd = 20.0;
+  } else if (opt.fld <= 0.0 || opt.sd <= 0.0) {
+    cerr << "Error: fragment length mean and sd must both be positive" << endl;
+    ret = false;
+  }
+  if (!opt.single_end && opt.fld < opt.read_length) {
+    cerr << "Error: fragments of paired-end reads must be at least as long as a read" << endl;
+    ret = false;
+  }
+
+  if (!opt.abundance_file.empty()) {
+    struct stat stFileInfo;
+    if (stat(opt.abundance_file.c_str(), &stFileInfo) != 0) {
+      cerr << "Error: abundance file not found " << opt.abundance_file << endl;
+      ret = false;
+    }
+  }
+
+  if (opt.threads <= 0) {
+    cerr << "Error: invalid number of threads " << opt.threads << endl;
+    ret = false;
+  }
+
+  if (opt.output.empty()) {
+    cerr << "Error: need to specify output directory " << opt.output << endl;
+    ret = false;
+  } else {
+    struct stat stFileInfo;
+    auto intStat = stat(opt.output.c_str(), &stFileInfo);
+    if (intStat == 0) {
+      if (!S_ISDIR(stFileInfo.st_mode)) {
+        cerr << "Error: file " << opt.output << " exists and is not a directory" << endl;
+        ret = false;
+      }
+    } else if (mkdir(opt.output.c_str(), 0777) == -1) {
+      cerr << "Error: could not create directory " << opt.output << endl;
+      ret = false;
+    }
+  }
+
+  return ret;
+}
+
 void PrintCite() {
   cout << "When using this program in your research, please cite" << endl << endl
        << "  Bray, N. L., Pimentel, H., Melsted, P. & Pachter, L." << endl
@@ -926,6 +1439,9 @@ void usage() {
        << "    quant         Runs the quantification algorithm " << endl
        << "    pseudo        Runs the pseudoalignment step " << endl
        << "    h5dump        Converts HDF5-formatted results to plaintext" << endl
+       << "    serve         Keeps an index loaded and runs submitted jobs" << endl
+       << "    submit        Sends a quant or pseudo job to a server" << endl
+       << "    simulate      Simulates reads from the targets of an index" << endl
        << "    version       Prints version information"<< endl
        << "    cite          Prints citation information" << endl << endl
        << "Running kallisto <CMD> without arguments prints usage information for <CMD>"<< endl << endl;
@@ -957,7 +1473,10 @@ void usageInspect() {
   cout << "kallisto " << KALLISTO_VERSION << endl << endl
        << "Usage: kallisto inspect INDEX-file" << endl << endl
        << "Optional arguments:" << endl
-       << "    --gfa=STRING              Filename for GFA output of T-DBG" << endl << endl;
+       << "    --gfa=STRING              Filename for GFA output of T-DBG" << endl
+       << "    --remove-shared           Remove the k-mer tables of this index, and of" << endl
+       << "                              earlier versions of it, that --shared-index" << endl
+       << "                              left in shared memory" << endl << endl;
 }
 
 void usageEM(bool valid_input = true) {
@@ -966,7 +1485,8 @@ void usageEM(bool valid_input = true) {
   cout << "kallisto " << KALLISTO_VERSION << endl
        << "Computes equivalence classes for reads and quantifies abundances" << endl << endl;
   }
-  cout << "Usage: kallisto quant [arguments] FASTQ-files" << endl << endl
+  cout << "Usage: kallisto quant [arguments] FASTQ-files" << endl
+       << "       (a FASTQ file named - is read from standard input)" << endl << endl
        << "Required arguments:" << endl
        << "-i, --index=STRING            Filename for the kallisto index to be used for" << endl
        << "                              quantification" << endl
@@ -975,15 +1495,39 @@ void usageEM(bool valid_input = true) {
        << "    --bias                    Perform sequence based bias correction" << endl
        << "-b, --bootstrap-samples=INT   Number of bootstrap samples (default: 0)" << endl
        << "    --seed=INT                Seed for the bootstrap sampling (default: 42)" << endl
+       << "    --sparse-bootstrap        Store bootstraps sparsely as single precision in HDF5" << endl
+       << "    --bootstrap-summary       Only output per-target mean, variance and quantiles" << endl
+       << "                              of the bootstrap estimates" << endl
+       << "    --single-precision        Store EM weights and abundances in single precision" << endl
        << "    --plaintext               Output plaintext instead of HDF5" << endl
        << "    --single                  Quantify single-end reads" << endl
+       << "    --interleaved             Paired-end reads are interleaved in each file" << endl
+       << "    --shared-index            Keep the k-mer table in shared memory (/dev/shm)," << endl
+       << "                              where later runs on the index attach to it," << endl
+       << "                              remove it with kallisto inspect --remove-shared" << endl
        << "    --fr-stranded             Strand specific reads, first read forward" << endl
        << "    --rf-stranded             Strand specific reads, first read reverse" << endl
        << "-l, --fragment-length=DOUBLE  Estimated average fragment length" << endl
        << "-s, --sd=DOUBLE               Estimated standard deviation of fragment length" << endl
        << "                              (default: value is estimated from the input data)" << endl
        << "-t, --threads=INT             Number of threads to use (default: 1)" << endl
-       << "    --pseudobam               Output pseudoalignments in SAM format to stdout" << endl;
+       << "    --lock-stats              Report how long the threads waited for each other," << endl
+       << "                              every 10 seconds with --verbose" << endl
+       << "    --progress=INT            Report the reads processed every INT seconds" << endl
+       << "    --status-file=FILE        Keep the progress in FILE as JSON, updated every" << endl
+       << "                              10 seconds unless --progress is given" << endl
+       << "    --profile                 Count cycles, instructions, cache and branch misses" << endl
+       << "                              per read and EM round in run_info.json (Linux)" << endl
+       << "    --pseudobam               Save pseudoalignments to transcriptome to BAM file" << endl
+       << "    --sortedbam               Save pseudoalignments to a coordinate sorted and" << endl
+       << "                              indexed BAM file, implies --pseudobam" << endl
+       << "    --genomebam               Project pseudoalignments to the genome, collapsing" << endl
+       << "                              isoforms, in a sorted and indexed BAM file" << endl
+       << "-g, --gtf=STRING              GTF file with the transcript models, required for" << endl
+       << "                              --genomebam" << endl
+       << "    --chromosomes=STRING      Tab separated file with the chromosome names and" << endl
+       << "                              lengths of the genome for --genomebam, e.g. a" << endl
+       << "                              samtools .fai or UCSC chrom.sizes file" << endl;
 
 }
 
@@ -993,7 +1537,8 @@ void usagePseudo(bool valid_input = true) {
          << "Computes equivalence classes for reads and quantifies abundances" << endl << endl;
   }
 
-  cout << "Usage: kallisto pseudo [arguments] FASTQ-files" << endl << endl
+  cout << "Usage: kallisto pseudo [arguments] FASTQ-files" << endl
+       << "       (a FASTQ file named - is read from standard input)" << endl << endl
        << "Required arguments:" << endl
        << "-i, --index=STRING            Filename for the kallisto index to be used for" << endl
        << "                              pseudoalignment" << endl
@@ -1001,12 +1546,33 @@ void usagePseudo(bool valid_input = true) {
        << "Optional arguments:" << endl
        << "-u  --umi                     First file in pair is a UMI file" << endl
        << "-b  --batch=FILE              Process files listed in FILE" << endl
+       << "    --hdf5                    Also write the batch matrix as compressed CSR in HDF5" << endl
        << "    --single                  Quantify single-end reads" << endl
+       << "    --interleaved             Paired-end reads are interleaved in each file" << endl
+       << "    --shared-index            Keep the k-mer table in shared memory (/dev/shm)," << endl
+       << "                              where later runs on the index attach to it," << endl
+       << "                              remove it with kallisto inspect --remove-shared" << endl
        << "-l, --fragment-length=DOUBLE  Estimated average fragment length" << endl
        << "-s, --sd=DOUBLE               Estimated standard deviation of fragment length" << endl
        << "                              (default: value is estimated from the input data)" << endl
        << "-t, --threads=INT             Number of threads to use (default: 1)" << endl
-       << "    --pseudobam               Output pseudoalignments in SAM format to stdout" << endl;
+       << "    --lock-stats              Report how long the threads waited for each other," << endl
+       << "                              every 10 seconds with --verbose" << endl
+       << "    --progress=INT            Report the reads processed every INT seconds" << endl
+       << "    --status-file=FILE        Keep the progress in FILE as JSON, updated every" << endl
+       << "                              10 seconds unless --progress is given" << endl
+       << "    --profile                 Count cycles, instructions, cache and branch misses" << endl
+       << "                              per read and EM round in run_info.json (Linux)" << endl
+       << "    --pseudobam               Save pseudoalignments to transcriptome to BAM file" << endl
+       << "    --sortedbam               Save pseudoalignments to a coordinate sorted and" << endl
+       << "                              indexed BAM file, implies --pseudobam" << endl
+       << "    --genomebam               Project pseudoalignments to the genome, collapsing" << endl
+       << "                              isoforms, in a sorted and indexed BAM file" << endl
+       << "-g, --gtf=STRING              GTF file with the transcript models, required for" << endl
+       << "                              --genomebam" << endl
+       << "    --chromosomes=STRING      Tab separated file with the chromosome names and" << endl
+       << "                              lengths of the genome for --genomebam, e.g. a" << endl
+       << "                              samtools .fai or UCSC chrom.sizes file" << endl;
 
 }
 
@@ -1020,9 +1586,56 @@ void usageEMOnly() {
        << "-l, --fragment-length=DOUBLE  Estimated fragment length (default: value is estimated from the input data)" << endl
        << "-b, --bootstrap-samples=INT   Number of bootstrap samples (default: 0)" << endl
        << "    --seed=INT                Seed for the bootstrap sampling (default: 42)" << endl
+       << "    --sparse-bootstrap        Store bootstraps sparsely as single precision in HDF5" << endl
+       << "    --bootstrap-summary       Only output per-target mean, variance and quantiles" << endl
+       << "                              of the bootstrap estimates" << endl
+       << "    --single-precision        Store EM weights and abundances in single precision" << endl
        << "    --plaintext               Output plaintext instead of HDF5" << endl << endl;
 }
 
+void usageServe() {
+  cout << "kallisto " << KALLISTO_VERSION << endl
+       << "Keeps an index in memory and runs the jobs sent with kallisto submit" << endl << endl
+       << "Usage: kallisto serve [arguments]" << endl << endl
+       << "Required arguments:" << endl
+       << "-i, --index=STRING            Filename for the kallisto index to be loaded" << endl
+       << "    --socket=FILE             Unix socket to listen on" << endl << endl
+       << "Optional arguments:" << endl
+       << "-t, --threads=INT             Number of threads shared by the running jobs" << endl
+       << "                              (default: 1)" << endl << endl;
+}
+
+void usageSimulate() {
+  cout << "kallisto " << KALLISTO_VERSION << endl
+       << "Simulates reads from the targets of an index, for benchmarking" << endl << endl
+       << "Usage: kallisto simulate [arguments]" << endl << endl
+       << "Required arguments:" << endl
+       << "-i, --index=STRING            Filename for the kallisto index to sample from" << endl
+       << "-o, --output-dir=STRING       Directory to write the reads and truth.tsv to" << endl << endl
+       << "Optional arguments:" << endl
+       << "-n, --reads=INT               Number of reads, or pairs, (default: 1000000)" << endl
+       << "-a, --abundance=FILE          Abundances to sample from, the target_id and tpm" << endl
+       << "                              columns of a file such as abundance.tsv" << endl
+       << "                              (default: log-normally distributed at random)" << endl
+       << "    --single                  Simulate single-end reads" << endl
+       << "-r, --read-length=INT         Length of the reads (default: 100)" << endl
+       << "-l, --fragment-length=DOUBLE  Average fragment length (default: 200)" << endl
+       << "-s, --sd=DOUBLE               Standard deviation of fragment length (default: 20)" << endl
+       << "-e, --error-rate=DOUBLE       Substitution errors per base (default: 0.001)" << endl
+       << "    --seed=INT                Seed for the simulation (default: 42)" << endl
+       << "-t, --threads=INT             Number of threads compressing the output" << endl
+       << "                              (default: 1)" << endl << endl;
+}
+
+void usageSubmit() {
+  cout << "kallisto " << KALLISTO_VERSION << endl
+       << "Runs a quant or pseudo job on a kallisto server" << endl << endl
+       << "Usage: kallisto submit --socket=FILE quant|pseudo [arguments]" << endl << endl
+       << "The arguments are those of kallisto quant or pseudo, -i can be left out" << endl
+       << "and the index of the server is used. Paths are relative to the current" << endl
+       << "directory, reads can't come from standard input" << endl << endl;
+}
+
 std::string argv_to_string(int argc, char *argv[]) {
   std::string res;
   for (int i = 0; i < argc; ++i) {
@@ -1047,6 +1660,266 @@ std::string get_local_time() {
   return ret.substr(0, ret.size() - 1);
 }
 
+void write_bootstrap_summary(const ProgramOptions& opt, H5Writer& writer,
+    const BootstrapSummary& summary, const std::vector<std::string>& target_names) {
+  cerr << "[bstrp] writing summary of " << summary.num_bootstrap() << " bootstraps" << endl;
+  if (!opt.plaintext) {
+    writer.write_bootstrap_summary(summary);
+  } else {
+    plaintext_bootstrap_summary(opt.output + "/bootstrap_summary.tsv",
+        target_names, summary.mean_, summary.variance(),
+        BootstrapSummary::quantile_names, summary.quantiles());
+  }
+}
+
+// quantifies the reads of opt with an index that is already loaded
+void quantify(const ProgramOptions& opt, KmerIndex& index,
+    const std::string& call, const std::string& start_time, RunStats& stats) {
+  MinCollector collection(index, opt);
+  int num_processed = 0;
+  StageTimer timer(stats, "pseudoalignment");
+  num_processed = ProcessReads(index, opt, collection, &stats);
+  timer.stop();
+
+  // save modified index for future use
+  if (opt.write_index) {
+    index.write((opt.output + "/index.saved"), false);
+  }
+
+  // if mean FL not provided, estimate
+  std::vector<int> fld;
+  if (opt.fld == 0.0) {
+    fld = collection.flens; // copy
+    collection.compute_mean_frag_lens_trunc();
+  } else {
+    auto mean_fl = (opt.fld > 0.0) ? opt.fld : collection.get_mean_frag_len();
+    auto sd_fl = opt.sd;
+    collection.init_mean_fl_trunc( mean_fl, sd_fl );
+    //fld.resize(MAX_FRAG_LEN,0); // no obersvations
+    fld = trunc_gaussian_counts(0, MAX_FRAG_LEN, mean_fl, sd_fl, 10000);
+
+    // for (size_t i = 0; i < collection.mean_fl_trunc.size(); ++i) {
+    //   cout << "--- " << i << '\t' << collection.mean_fl_trunc[i] << endl;
+    // }
+  }
+
+  std::vector<int> preBias(4096,1);
+  if (opt.bias) {
+    preBias = collection.bias5; // copy
+  }
+
+  auto fl_means = get_frag_len_means(index.target_lens_, collection.mean_fl_trunc);
+
+  /*for (int i = 0; i < collection.bias3.size(); i++) {
+    std::cout << i << "\t" << collection.bias3[i] << "\t" << collection.bias5[i] << "\n";
+    }*/
+
+  double em_wall = wall_seconds();
+  double em_cpu = process_cpu_seconds();
+  std::unique_ptr<PerfCounters> em_perf;
+  if (opt.profile) {
+    em_perf.reset(new PerfCounters());
+    em_perf->start();
+  }
+  EMAlgorithm em(collection.counts, index, collection, fl_means, opt);
+  em.run(10000, 50, true, opt.bias);
+  if (em_perf) {
+    em_perf->stop();
+  }
+  // bias correction is part of the EM run, but is reported on its own
+  stats.addStage("em", wall_seconds() - em_wall - em.bias_wall_,
+      process_cpu_seconds() - em_cpu - em.bias_cpu_);
+  if (opt.bias) {
+    stats.addStage("bias", em.bias_wall_, em.bias_cpu_);
+  }
+  if (em_perf) {
+    stats.addProfile("em", "iteration", em.num_rounds_, *em_perf, em.bias_perf_.get());
+    if (em.bias_perf_) {
+      stats.addProfile("bias", "update", em.bias_updates_, *em.bias_perf_);
+    }
+    em_perf.reset();
+  }
+
+  StageTimer output_timer(stats, "output");
+  H5Writer writer;
+  if (!opt.plaintext) {
+    writer.init(opt.output + "/abundance.h5", (opt.bootstrap_summary) ? 0 : opt.bootstrap, num_processed, fld, preBias, em.post_bias_, 6,
+        index.INDEX_VERSION, call, start_time, opt.sparse_bootstrap);
+    writer.write_main(em, index.target_names_, index.target_lens_);
+  }
+
+  plaintext_writer(opt.output + "/abundance.tsv", em.target_names_,
+      em.alpha_, em.eff_lens_, index.target_lens_);
+  output_timer.stop();
+
+  if (opt.bootstrap > 0) {
+    StageTimer bootstrap_timer(stats, "bootstrap");
+    auto B = opt.bootstrap;
+    std::mt19937_64 rand;
+    rand.seed( opt.seed );
+
+    std::vector<size_t> seeds;
+    for (auto s = 0; s < B; ++s) {
+      seeds.push_back( rand() );
+    }
+
+    BootstrapSummary bs_summary;
+    if (opt.bootstrap_summary) {
+      bs_summary.init(index.num_trans);
+    }
+
+    if (opt.threads > 1) {
+      auto n_threads = opt.threads;
+      if (opt.threads > opt.bootstrap) {
+        cerr
+          << "[~warn] number of threads (" << opt.threads <<
+          ") greater than number of bootstraps" << endl
+          << "[~warn] (cont'd) updating threads to number of bootstraps "
+          << opt.bootstrap << endl;
+        n_threads = opt.bootstrap;
+      }
+
+      BootstrapThreadPool pool(opt.threads, seeds, collection.counts, index,
+          collection, em.eff_lens_, opt, writer, bs_summary, fl_means);
+    } else {
+      for (auto b = 0; b < B; ++b) {
+        Bootstrap bs(collection.counts, index, collection, em.eff_lens_, seeds[b], fl_means, opt);
+        cerr << "[bstrp] running EM for the bootstrap: " << b + 1 << "\r";
+        auto res = bs.run_em();
+
+        if (opt.bootstrap_summary) {
+          bs_summary.add(b, res.alpha_);
+        } else if (!opt.plaintext) {
+          writer.write_bootstrap(res, b);
+        } else {
+          plaintext_writer(opt.output + "/bs_abundance_" + std::to_string(b) + ".tsv",
+              em.target_names_, res.alpha_, em.eff_lens_, index.target_lens_);
+        }
+      }
+    }
+
+    cerr << endl;
+
+    if (opt.bootstrap_summary) {
+      write_bootstrap_summary(opt, writer, bs_summary, em.target_names_);
+    }
+  }
+
+  // last, so it has the time of every stage
+  plaintext_aux(
+      opt.output + "/run_info.json",
+      std::string(std::to_string(index.num_trans)),
+      std::string(std::to_string(opt.bootstrap)),
+      std::string(std::to_string(num_processed)),
+      KALLISTO_VERSION,
+      std::string(std::to_string(index.INDEX_VERSION)),
+      start_time,
+      call,
+      &stats);
+
+  cerr << endl;
+}
+
+// pseudoaligns the reads of opt with an index that is already loaded
+void pseudoalign(const ProgramOptions& opt, KmerIndex& index,
+    const std::string& call, const std::string& start_time, RunStats& stats) {
+  MinCollector collection(index, opt);
+  int num_processed = 0;
+
+  if (!opt.batch_mode) {
+    StageTimer timer(stats, "pseudoalignment");
+    num_processed = ProcessReads(index, opt, collection, &stats);
+    timer.stop();
+    StageTimer output_timer(stats, "output");
+    collection.write((opt.output + "/pseudoalignments"));
+  } else {
+    // the matrix files are written as the cells finish
+    StageTimer timer(stats, "pseudoalignment");
+    num_processed = ProcessBatchReads(index, opt, collection, &stats);
+    /*
+    for (int i = 0; i < opt.batch_ids.size(); i++) {
+      std::fill(collection.counts.begin(), collection.counts.end(),0);
+      opt.files = opt.batch_files[i];
+      num_processed += ProcessReads(index, opt, collection);
+      batchCounts.push_back(collection.counts);
+    }
+    */
+  }
+
+  plaintext_aux(
+      opt.output + "/run_info.json",
+      std::string(std::to_string(index.num_trans)),
+      std::string(std::to_string(0)), // no bootstraps in pseudo
+      std::string(std::to_string(num_processed)),
+      KALLISTO_VERSION,
+      std::string(std::to_string(index.INDEX_VERSION)),
+      start_time,
+      call,
+      &stats);
+
+  cerr << endl;
+}
+
+// runs a job sent to kallisto serve, in its own process
+int runServerJob(const ProgramOptions& server_opt, KmerIndex& index,
+    const std::vector<std::string>& args) {
+  auto start_time(get_local_time());
+  const std::string& cmd = args[0];
+  if (cmd != "quant" && cmd != "pseudo") {
+    cerr << "Error: the server only runs quant and pseudo jobs, not " << cmd << endl;
+    return 1;
+  }
+
+  std::vector<std::string> argv_str(1, "kallisto");
+  argv_str.insert(argv_str.end(), args.begin(), args.end());
+  std::vector<char*> argv;
+  for (auto& a : argv_str) {
+    argv.push_back(&a[0]);
+  }
+  argv.push_back(nullptr);
+  int argc = argv.size() - 1;
+
+  ProgramOptions opt;
+  optind = 0; // getopt starts over
+  if (cmd == "quant") {
+    ParseOptionsEM(argc-1, argv.data()+1, opt);
+  } else {
+    ParseOptionsPseudo(argc-1, argv.data()+1, opt);
+  }
+
+  if (opt.index.empty()) {
+    opt.index = server_opt.index;
+  } else {
+    char *path = realpath(opt.index.c_str(), nullptr);
+    bool same = (path != nullptr && server_opt.index == path);
+    free(path);
+    if (!same) {
+      cerr << "Error: the server has the index " << server_opt.index << " loaded" << endl;
+      return 1;
+    }
+  }
+  for (const auto& fn : opt.files) {
+    if (fn == "-") {
+      cerr << "Error: a job on the server can't read from standard input" << endl;
+      return 1;
+    }
+  }
+
+  bool ok = (cmd == "quant") ? CheckOptionsEM(opt) : CheckOptionsPseudo(opt);
+  if (!ok) {
+    cerr << endl;
+    return 1;
+  }
+  // the index was loaded by the server
+  RunStats stats;
+  if (cmd == "quant") {
+    quantify(opt, index, argv_to_string(argc, argv.data()), start_time, stats);
+  } else {
+    pseudoalign(opt, index, argv_to_string(argc, argv.data()), start_time, stats);
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   std::cout.sync_with_stdio(false);
   setvbuf(stdout, NULL, _IOFBF, 1048576);
@@ -1090,6 +1963,10 @@ int main(int argc, char *argv[]) {
       if (!CheckOptionsInspect(opt)) {
         usageInspect();
         exit(1);
+      } else if (opt.remove_shared) {
+        int n = SharedSegment::removeFor(opt.index);
+        cerr << "[index] removed " << n << " shared memory segment" << ((n == 1) ? "" : "s")
+             << " of " << opt.index << endl;
       } else {
         KmerIndex index(opt);
         index.load(opt);
@@ -1109,112 +1986,11 @@ int main(int argc, char *argv[]) {
       } else {
         // run the em algorithm
         KmerIndex index(opt);
+        RunStats stats;
+        StageTimer timer(stats, "index_load");
         index.load(opt);
-
-        MinCollector collection(index, opt);
-        int num_processed = 0;
-        num_processed = ProcessReads(index, opt, collection);
-
-        // save modified index for future use
-        if (opt.write_index) {
-          index.write((opt.output + "/index.saved"), false);
-        }
-
-        // if mean FL not provided, estimate
-        std::vector<int> fld;
-        if (opt.fld == 0.0) {
-          fld = collection.flens; // copy
-          collection.compute_mean_frag_lens_trunc();
-        } else {
-          auto mean_fl = (opt.fld > 0.0) ? opt.fld : collection.get_mean_frag_len();
-          auto sd_fl = opt.sd;
-          collection.init_mean_fl_trunc( mean_fl, sd_fl );
-          //fld.resize(MAX_FRAG_LEN,0); // no obersvations
-          fld = trunc_gaussian_counts(0, MAX_FRAG_LEN, mean_fl, sd_fl, 10000);
-
-          // for (size_t i = 0; i < collection.mean_fl_trunc.size(); ++i) {
-          //   cout << "--- " << i << '\t' << collection.mean_fl_trunc[i] << endl;
-          // }
-        }
-
-        std::vector<int> preBias(4096,1);
-        if (opt.bias) {
-          preBias = collection.bias5; // copy
-        }
-
-        auto fl_means = get_frag_len_means(index.target_lens_, collection.mean_fl_trunc);
-
-        /*for (int i = 0; i < collection.bias3.size(); i++) {
-          std::cout << i << "\t" << collection.bias3[i] << "\t" << collection.bias5[i] << "\n";
-          }*/
-
-        EMAlgorithm em(collection.counts, index, collection, fl_means, opt);
-        em.run(10000, 50, true, opt.bias);
-
-        std::string call = argv_to_string(argc, argv);
-
-        H5Writer writer;
-        if (!opt.plaintext) {
-          writer.init(opt.output + "/abundance.h5", opt.bootstrap, num_processed, fld, preBias, em.post_bias_, 6,
-              index.INDEX_VERSION, call, start_time);
-          writer.write_main(em, index.target_names_, index.target_lens_);
-        }
-
-        plaintext_aux(
-            opt.output + "/run_info.json",
-            std::string(std::to_string(index.num_trans)),
-            std::string(std::to_string(opt.bootstrap)),
-            std::string(std::to_string(num_processed)),
-            KALLISTO_VERSION,
-            std::string(std::to_string(index.INDEX_VERSION)),
-            start_time,
-            call);
-
-        plaintext_writer(opt.output + "/abundance.tsv", em.target_names_,
-            em.alpha_, em.eff_lens_, index.target_lens_);
-
-        if (opt.bootstrap > 0) {
-          auto B = opt.bootstrap;
-          std::mt19937_64 rand;
-          rand.seed( opt.seed );
-
-          std::vector<size_t> seeds;
-          for (auto s = 0; s < B; ++s) {
-            seeds.push_back( rand() );
-          }
-
-          if (opt.threads > 1) {
-            auto n_threads = opt.threads;
-            if (opt.threads > opt.bootstrap) {
-              cerr
-                << "[~warn] number of threads (" << opt.threads <<
-                ") greater than number of bootstraps" << endl
-                << "[~warn] (cont'd) updating threads to number of bootstraps "
-                << opt.bootstrap << endl;
-              n_threads = opt.bootstrap;
-            }
-
-            BootstrapThreadPool pool(opt.threads, seeds, collection.counts, index,
-                collection, em.eff_lens_, opt, writer, fl_means);
-          } else {
-            for (auto b = 0; b < B; ++b) {
-              Bootstrap bs(collection.counts, index, collection, em.eff_lens_, seeds[b], fl_means, opt);
-              cerr << "[bstrp] running EM for the bootstrap: " << b + 1 << "\r";
-              auto res = bs.run_em();
-
-              if (!opt.plaintext) {
-                writer.write_bootstrap(res, b);
-              } else {
-                plaintext_writer(opt.output + "/bs_abundance_" + std::to_string(b) + ".tsv",
-                    em.target_names_, res.alpha_, em.eff_lens_, index.target_lens_);
-              }
-            }
-          }
-
-          cerr << endl;
-        }
-
-        cerr << endl;
+        timer.stop();
+        quantify(opt, index, argv_to_string(argc, argv), start_time, stats);
       }
     } else if (cmd == "quant-only") {
       if (argc==2) {
@@ -1265,8 +2041,8 @@ int main(int argc, char *argv[]) {
 
         if (!opt.plaintext) {
           // setting num_processed to 0 because quant-only is for debugging/special ops
-          writer.init(opt.output + "/abundance.h5", opt.bootstrap, 0, fld, preBias, em.post_bias_, 6,
-              index.INDEX_VERSION, call, start_time);
+          writer.init(opt.output + "/abundance.h5", (opt.bootstrap_summary) ? 0 : opt.bootstrap, 0, fld, preBias, em.post_bias_, 6,
+              index.INDEX_VERSION, call, start_time, opt.sparse_bootstrap);
           writer.write_main(em, index.target_names_, index.target_lens_);
         } else {
           plaintext_aux(
@@ -1294,6 +2070,11 @@ int main(int argc, char *argv[]) {
             seeds.push_back( rand() );
           }
 
+          BootstrapSummary bs_summary;
+          if (opt.bootstrap_summary) {
+            bs_summary.init(index.num_trans);
+          }
+
           if (opt.threads > 1) {
             auto n_threads = opt.threads;
             if (opt.threads > opt.bootstrap) {
@@ -1305,14 +2086,16 @@ int main(int argc, char *argv[]) {
             }
 
             BootstrapThreadPool pool(n_threads, seeds, collection.counts, index,
-                collection, em.eff_lens_, opt, writer, fl_means);
+                collection, em.eff_lens_, opt, writer, bs_summary, fl_means);
           } else {
             for (auto b = 0; b < B; ++b) {
               Bootstrap bs(collection.counts, index, collection, em.eff_lens_, seeds[b], fl_means, opt);
               cerr << "[bstrp] running EM for the bootstrap: " << b + 1 << "\r";
               auto res = bs.run_em();
 
-              if (!opt.plaintext) {
+              if (opt.bootstrap_summary) {
+                bs_summary.add(b, res.alpha_);
+              } else if (!opt.plaintext) {
                 writer.write_bootstrap(res, b);
               } else {
                 plaintext_writer(opt.output + "/bs_abundance_" + std::to_string(b) + ".tsv",
@@ -1320,6 +2103,10 @@ int main(int argc, char *argv[]) {
               }
             }
           }
+
+          if (opt.bootstrap_summary) {
+            write_bootstrap_summary(opt, writer, bs_summary, em.target_names_);
+          }
         }
         cerr << endl;
       }
@@ -1336,44 +2123,75 @@ int main(int argc, char *argv[]) {
       } else {
         // pseudoalign the reads
         KmerIndex index(opt);
+        RunStats stats;
+        StageTimer timer(stats, "index_load");
         index.load(opt);
-
-        MinCollector collection(index, opt);
-        int num_processed = 0;
-
-        if (!opt.batch_mode) {
-          num_processed = ProcessReads(index, opt, collection);
-          collection.write((opt.output + "/pseudoalignments"));
-        } else {
-
-          std::vector<std::vector<int>> batchCounts;
-          num_processed = ProcessBatchReads(index, opt, collection, batchCounts);
-          /*
-          for (int i = 0; i < opt.batch_ids.size(); i++) {
-            std::fill(collection.counts.begin(), collection.counts.end(),0);
-            opt.files = opt.batch_files[i];
-            num_processed += ProcessReads(index, opt, collection);
-            batchCounts.push_back(collection.counts);
-          }
-          */
-
-          writeBatchMatrix((opt.output + "/matrix"),index, opt.batch_ids,batchCounts);
-        }
-
-        std::string call = argv_to_string(argc, argv);
-
-        plaintext_aux(
-            opt.output + "/run_info.json",
-            std::string(std::to_string(index.num_trans)),
-            std::string(std::to_string(0)), // no bootstraps in pseudo
-            std::string(std::to_string(num_processed)),
-            KALLISTO_VERSION,
-            std::string(std::to_string(index.INDEX_VERSION)),
-            start_time,
-            call);
-
+        timer.stop();
+        pseudoalign(opt, index, argv_to_string(argc, argv), start_time, stats);
+      }
+    } else if (cmd == "serve") {
+      if (argc==2) {
+        usageServe();
+        return 0;
+      }
+      ParseOptionsServe(argc-1, argv+1, opt);
+      if (!CheckOptionsServe(opt)) {
         cerr << endl;
+        usageServe();
+        exit(1);
+      }
+      KmerIndex index(opt);
+      index.load(opt);
+      // every job gets a copy-on-write view of the loaded index
+      auto run = [&opt, &index](const std::vector<std::string>& args) {
+        return runServerJob(opt, index, args);
+      };
+      if (!serve(opt.server_socket, opt.threads, run)) {
+        exit(1);
+      }
+    } else if (cmd == "simulate") {
+      if (argc==2) {
+        usageSimulate();
+        return 0;
+      }
+      ParseOptionsSimulate(argc-1, argv+1, opt);
+      if (!CheckOptionsSimulate(opt)) {
+        cerr << endl;
+        usageSimulate();
+        exit(1);
+      }
+      // only the target sequences are needed
+      KmerIndex index(opt);
+      index.load(opt, false);
+      index.loadTranscriptSequences();
+      std::vector<double> tpm;
+      if (opt.abundance_file.empty()) {
+        tpm = randomAbundances(index.num_trans, opt.seed);
+      } else if (!readAbundances(opt.abundance_file, index, tpm)) {
+        exit(1);
+      }
+      cerr << "[simul] simulating " << pretty_num(opt.sim_reads)
+           << ((opt.single_end) ? " single-end reads" : " read pairs") << " ..."; cerr.flush();
+      if (!simulateReads(index, tpm, opt)) {
+        exit(1);
+      }
+      cerr << " done" << endl;
+    } else if (cmd == "submit") {
+      // the job's arguments are passed on untouched, so don't use getopt
+      int i = 2;
+      if (i < argc && strncmp(argv[i], "--socket=", 9) == 0) {
+        opt.server_socket = argv[i++] + 9;
+      } else if (i + 1 < argc && strcmp(argv[i], "--socket") == 0) {
+        opt.server_socket = argv[i+1];
+        i += 2;
+      }
+      if (opt.server_socket.empty() || i == argc) {
+        usageSubmit();
+        exit(1);
       }
+      std::vector<std::string> args(argv + i, argv + argc);
+      fflush(stdout);
+      return submitJob(opt.server_socket, args);
     } else if (cmd == "h5dump") {
 
       if (argc == 2) {
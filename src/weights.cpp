@@ -1,6 +1,8 @@
 #include "weights.h"
 
+#include <algorithm>
 #include <cmath>
+#include <thread>
 
 const double MIN_ALPHA = 1e-8;
 
@@ -97,10 +99,128 @@ inline int update_hexamer(int hex, char c, bool revcomp) {
   return hex;
 }
 
+// targets are processed in fixed size blocks, each with its own partial
+// sums, so the result is the same for any number of threads
+const int BIAS_BLOCK_SIZE = 1024;
+
+// calls f(b) for every block b in [0, num_blocks) using n_threads threads
+template <typename F>
+void parallel_for_blocks(int n_threads, int num_blocks, F f) {
+  n_threads = std::max(1, std::min(n_threads, num_blocks));
+  if (n_threads == 1) {
+    for (int b = 0; b < num_blocks; b++) {
+      f(b);
+    }
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < n_threads; t++) {
+    workers.emplace_back([&f, t, n_threads, num_blocks]() {
+      for (int b = t; b < num_blocks; b += n_threads) {
+        f(b);
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+}
+
+HexamerTable build_hexamer_table(const std::vector<double>& means,
+    const KmerIndex& index, const ProgramOptions& opt) {
+  const int num6mers = 4096;
+
+  // not thread safe, load before we start
+  index.loadTranscriptSequences();
+
+  const int num_blocks = (index.num_trans + BIAS_BLOCK_SIZE - 1) / BIAS_BLOCK_SIZE;
+  HexamerTable table;
+  table.blocks.resize(num_blocks);
+
+  parallel_for_blocks(opt.threads, num_blocks, [&](int b) {
+    auto& block = table.blocks[b];
+    block.first = b * BIAS_BLOCK_SIZE;
+    int last = std::min(index.num_trans, (b + 1) * BIAS_BLOCK_SIZE);
+    block.offsets.reserve(last - block.first + 1);
+    block.offsets.push_back(0);
+
+    std::vector<uint32_t> counts(num6mers, 0);
+    std::vector<int> seen;
+    seen.reserve(num6mers);
+    auto add = [&](int hex) {
+      if (hex < 0) {
+        return; // non-ACGT in the first hexamer
+      }
+      if (counts[hex]++ == 0) {
+        seen.push_back(hex);
+      }
+    };
+
+    for (int i = block.first; i < last; i++) {
+      if (index.target_lens_[i] >= means[i]) {
+        int seqlen = index.target_seqs_[i].size();
+        const char* cs = index.target_seqs_[i].c_str();
+
+        if (!opt.strand_specific || (opt.strand == ProgramOptions::StrandType::FR)) {
+          int hex = hexamerToInt(cs,false);
+          int fwlimit = (int) std::max(seqlen - means[i] - 6, 0.0);
+          for (int j = 0; j < fwlimit; j++) {
+            add(hex);
+            hex = update_hexamer(hex,*(cs+j+6),false);
+          }
+        }
+
+        if (!opt.strand_specific || (opt.strand == ProgramOptions::StrandType::RF)) {
+          int bwlimit = (int) std::max(means[i] - 6, 0.0);
+          int hex = hexamerToInt(cs+bwlimit,true);
+          for (int j = bwlimit; j < seqlen - 6; j++) {
+            add(hex);
+            hex = update_hexamer(hex,*(cs+j+6),true);
+          }
+        }
+
+        for (auto hex : seen) {
+          uint32_t c = counts[hex];
+          while (c > 0) {
+            uint16_t part = std::min<uint32_t>(c, UINT16_MAX);
+            block.hex.push_back(hex);
+            block.count.push_back(part);
+            c -= part;
+          }
+          counts[hex] = 0;
+        }
+        seen.clear();
+      }
+      block.offsets.push_back(block.hex.size());
+    }
+
+    block.hex.shrink_to_fit();
+    block.count.shrink_to_fit();
+  });
+
+  table.built = true;
+  return table;
+}
+
+std::vector<double> update_eff_lens(
+    const std::vector<double>& means,
+    const MinCollector& tc,
+    const KmerIndex &index,
+    const std::vector<double>& alpha,
+    const std::vector<double>& eff_lens,
+    std::vector<double>& dbias5,
+    const ProgramOptions& opt
+    ) {
+  auto hexamers = build_hexamer_table(means, index, opt);
+  return update_eff_lens(means, tc, index, hexamers, alpha, eff_lens, dbias5, opt);
+}
+
 std::vector<double> update_eff_lens(
     const std::vector<double>& means,
     const MinCollector& tc,
     const KmerIndex &index,
+    const HexamerTable& hexamers,
     const std::vector<double>& alpha,
     const std::vector<double>& eff_lens,
     std::vector<double>& dbias5,
@@ -117,102 +237,84 @@ std::vector<double> update_eff_lens(
   dbias5.clear();
   dbias5.resize(num6mers, 0.0); // clear the bias
 
-  index.loadTranscriptSequences();
-  
+  const int num_blocks = hexamers.blocks.size();
+  std::vector<std::vector<double>> partial_bias5(num_blocks);
+
+  // first pass: expected hexamer distribution given the abundances
+  parallel_for_blocks(opt.threads, num_blocks, [&](int b) {
+    const auto& block = hexamers.blocks[b];
+    auto& pbias5 = partial_bias5[b];
+    pbias5.assign(num6mers, 0.0);
+
+    for (size_t t = 0; t + 1 < block.offsets.size(); t++) {
+      int i = block.first + t;
+      if (index.target_lens_[i] < means[i]) {
+        // this should never happen.. but I'll sleep better at night with this
+        // condition -HP
+        continue;
+      }
 
-  for (int i = 0; i < index.num_trans; i++) {
-    if (index.target_lens_[i] < means[i]) {
-      // this should never happen.. but I'll sleep better at night with this
-      // condition -HP
-      continue;
-    }
+      if (alpha[i] < MIN_ALPHA) {
+        continue;
+      }
 
-    if (alpha[i] < MIN_ALPHA) {
-      continue;
-    }
+      double contrib = 0.5*alpha[i]/eff_lens[i];
+      if (opt.strand_specific) {
+        contrib = alpha[i]/eff_lens[i];
+      }
 
-    double contrib = 0.5*alpha[i]/eff_lens[i];
-    if (opt.strand_specific) {
-      contrib = alpha[i]/eff_lens[i];
-    }
-    int seqlen = index.target_seqs_[i].size();
-    const char* cs = index.target_seqs_[i].c_str();
-
-    if (!opt.strand_specific || (opt.strand == ProgramOptions::StrandType::FR)) {
-      int hex = hexamerToInt(cs,false);
-      int fwlimit = (int) std::max(seqlen - means[i] - 6, 0.0);
-      for (int j = 0; j < fwlimit; j++) {
-        dbias5[hex] += contrib;
-        hex = update_hexamer(hex,*(cs+j+6),false);
-      } 
+      for (auto e = block.offsets[t]; e < block.offsets[t+1]; e++) {
+        pbias5[block.hex[e]] += contrib * block.count[e];
+      }
     }
+  });
 
-    if (!opt.strand_specific || (opt.strand == ProgramOptions::StrandType::RF)) {
-      int bwlimit = (int) std::max(means[i] - 6, 0.0);
-      int hex = hexamerToInt(cs+bwlimit,true);
-      for (int j = bwlimit; j < seqlen - 6; j++) {
-        dbias5[hex] += contrib;
-        if (j < seqlen - 6) {
-          hex = update_hexamer(hex,*(cs+j+6),true);
-        }
-      }
+  // reduce in block order
+  for (auto& pbias5 : partial_bias5) {
+    for (int i = 0; i < num6mers; i++) {
+      dbias5[i] += pbias5[i];
     }
   }
+  partial_bias5.clear();
 
   for (int i = 0; i < num6mers; i++) {
     biasAlphaNorm += dbias5[i];
   }
 
+  // observed over expected for every hexamer
+  std::vector<double> ratio(num6mers);
+  for (int i = 0; i < num6mers; i++) {
+    ratio[i] = tc.bias5[i] / dbias5[i];
+  }
+
+  double norm = biasAlphaNorm/biasDataNorm;
+  if (!opt.strand_specific) {
+    norm *= 0.5;
+  }
+
   std::vector<double> biaslens(index.num_trans);
 
-  for (int i = 0; i < index.num_trans; i++) {
-    double efflen = 0.0;
-    if (index.target_lens_[i] >= means[i] && alpha[i] >= MIN_ALPHA) {
-
-      int seqlen = index.target_seqs_[i].size();
-      const char* cs = index.target_seqs_[i].c_str();
-
-      // forward direction
-      if (!opt.strand_specific || (opt.strand == ProgramOptions::StrandType::FR)) {
-        int hex = hexamerToInt(cs,false);
-        int fwlimit = (int) std::max(seqlen - means[i] - 6, 0.0);
-        for (int j = 0; j < fwlimit; j++) {
-          //int hex = hexamerToInt(cs+j,false);
-          //efflen += 0.5*(tc.bias5[hex]/biasDataNorm) / (dbias5[hex]/biasAlphaNorm );
-          efflen += tc.bias5[hex] / dbias5[hex];
-          hex = update_hexamer(hex,*(cs+j+6),false);
-        }
-      }
-      if (!opt.strand_specific || (opt.strand == ProgramOptions::StrandType::RF)) {
-        int bwlimit = (int) std::max(means[i] - 6 , 0.0);
-        int hex = hexamerToInt(cs+bwlimit,true);
-        for (int j = bwlimit; j < seqlen - 6; j++) {
-          efflen += tc.bias5[hex] / dbias5[hex];
-          if (j < seqlen-6) {
-            hex = update_hexamer(hex,*(cs+j+6),true);
-          }
+  // second pass: every target is independent
+  parallel_for_blocks(opt.threads, num_blocks, [&](int b) {
+    const auto& block = hexamers.blocks[b];
+
+    for (size_t t = 0; t + 1 < block.offsets.size(); t++) {
+      int i = block.first + t;
+      double efflen = 0.0;
+      if (index.target_lens_[i] >= means[i] && alpha[i] >= MIN_ALPHA) {
+        for (auto e = block.offsets[t]; e < block.offsets[t+1]; e++) {
+          efflen += block.count[e] * ratio[block.hex[e]];
         }
+        efflen *= norm;
       }
-      
-      
-      if (!opt.strand_specific) {
-        efflen *= 0.5*biasAlphaNorm/biasDataNorm;
+
+      if (efflen > means[i]) {
+        biaslens[i] = efflen;
       } else {
-        efflen *= biasAlphaNorm/biasDataNorm;
+        biaslens[i] = eff_lens[i]; // just for unexpressed sequences
       }
     }
-
-
-    if (efflen > means[i]) {
-      //efflen *= ((seqlen-mean) / ((double) (seqlen-mean-6));
-      biaslens[i] = efflen;
-    } else {
-      biaslens[i] = eff_lens[i]; // just for unexpressed sequences
-    }
-    //std::cout << index.target_names_[i] << "\t" << eff_lens[i] << "\t" << biaslens[i] << "\t" << efflen << "\n";
-  }
-
-
+  });
 
   return biaslens;
 }
@@ -247,6 +349,35 @@ WeightMap calc_weights(
   return weights;
 }
 
+WeightMapFloat calc_weights_float(
+  const std::vector<int>& counts,
+  const EcMap& ecmap,
+  const std::vector<double>& eff_lens)
+{
+  WeightMapFloat weights;
+  weights.offsets.reserve(ecmap.size() + 1);
+
+  size_t total = 0;
+  for (auto& v : ecmap) {
+    total += v.size();
+  }
+  weights.ids.reserve(total);
+  weights.weights.reserve(total);
+
+  for (size_t ec = 0; ec < ecmap.size(); ec++) {
+    weights.offsets.push_back(weights.weights.size());
+    for (auto& trans_id : ecmap[ec]) {
+      weights.ids.push_back(trans_id);
+      // compute in double, only the stored value is rounded
+      weights.weights.push_back( static_cast<float>(
+            static_cast<double>(counts[ec]) / eff_lens[trans_id]) );
+    }
+  }
+  weights.offsets.push_back(weights.weights.size());
+
+  return weights;
+}
+
 std::vector<double> trunc_gaussian_fld(int start, int stop, double mean,
     double sd) {
   size_t n = stop - start;
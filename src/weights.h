@@ -4,6 +4,7 @@
 #include "KmerIndex.h"
 #include "MinCollector.h"
 #include <cmath>
+#include <stdint.h>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -12,6 +13,17 @@ struct MinCollector;
 
 using WeightMap = std::vector<std::vector<double>>;
 
+// single precision weights, stored contiguously in ecmap order together
+// with a copy of the ec members so the EM streams through both: ec has
+// targets ids[offsets[ec]] .. ids[offsets[ec+1]-1] with the matching weights
+struct WeightMapFloat {
+  std::vector<size_t> offsets;
+  std::vector<int> ids;
+  std::vector<float> weights;
+
+  bool empty() const { return offsets.empty(); }
+};
+
 // this function takes the 'mean_fl_trunc' from MinCollector and simply gives
 // you back a 'mean fragment length' for every single transcript. this avoids
 // you having to check the length every single time
@@ -26,18 +38,53 @@ std::vector<double> calc_eff_lens(const std::vector<int>& lengths, double mean);
 std::vector<double> calc_eff_lens(const std::vector<int>& lengths,
     const std::vector<double>& means);
 
+// Sparse per-target histograms of the hexamers in the windows used by the
+// bias model (forward and reverse complement windows merged). The windows
+// only depend on the mean fragment lengths, so the table is built once per
+// EM run and reused every time the effective lengths are updated.
+struct HexamerTable {
+  // targets are stored in blocks, each in compressed sparse row format
+  struct Block {
+    int first; // first target in the block
+    std::vector<uint32_t> offsets; // one more than the number of targets
+    std::vector<uint16_t> hex;
+    std::vector<uint16_t> count; // a hexamer may repeat if count overflows
+  };
+
+  std::vector<Block> blocks;
+  bool built = false;
+};
+
+HexamerTable build_hexamer_table(const std::vector<double>& means,
+    const KmerIndex& index, const ProgramOptions& opt);
+
+// builds the hexamer table on every call, use the overload below when
+// updating repeatedly
 std::vector<double> update_eff_lens(const std::vector<double>& means,
     const MinCollector& tc,
     const KmerIndex &index, const std::vector<double>& alpha,
     const std::vector<double>& eff_lens, std::vector<double>& post_bias,
     const ProgramOptions& opt );
 
+std::vector<double> update_eff_lens(const std::vector<double>& means,
+    const MinCollector& tc,
+    const KmerIndex &index, const HexamerTable& hexamers,
+    const std::vector<double>& alpha,
+    const std::vector<double>& eff_lens, std::vector<double>& post_bias,
+    const ProgramOptions& opt );
+
 
 WeightMap calc_weights(
   const std::vector<int>& counts,
   const EcMap& ecmap,
   const std::vector<double>& eff_lens);
 
+// single precision weights, see --single-precision
+WeightMapFloat calc_weights_float(
+  const std::vector<int>& counts,
+  const EcMap& ecmap,
+  const std::vector<double>& eff_lens);
+
 
 // truncated gaussian fragment length distribution
 //
@@ -0,0 +1,236 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "BamSorter.h"
+
+static void put_i32(std::string& out, int32_t x) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((char) ((x >> (8*i)) & 0xff));
+    }
+}
+
+static int32_t get_i32(const std::string& s, size_t p) {
+    uint32_t x = 0;
+    for (int i = 0; i < 4; i++) {
+        x |= ((uint32_t) (unsigned char) s[p+i]) << (8*i);
+    }
+    return (int32_t) x;
+}
+
+// a minimal record with one M cigar op and the serial number as the name
+static std::string make_record(int ref, int pos, int serial) {
+    std::string name = std::to_string(serial);
+    std::string r;
+    put_i32(r, 0);
+    put_i32(r, ref);
+    put_i32(r, pos);
+    r.push_back((char) (name.size() + 1));
+    r.push_back((char) 255);
+    r.append("\0\0", 2); // bin, unused by the sorter
+    r.append("\1\0", 2); // one cigar op
+    r.append((ref < 0) ? "\4\0" : "\0\0", 2); // flag
+    put_i32(r, 0);
+    put_i32(r, -1);
+    put_i32(r, -1);
+    put_i32(r, 0);
+    r.append(name);
+    r.push_back('\0');
+    put_i32(r, 50 << 4); // 50M
+    std::string len;
+    put_i32(len, r.size() - 4);
+    r.replace(0, 4, len);
+    return r;
+}
+
+static std::string read_file(const std::string& fn, bool gz) {
+    std::string s;
+    if (gz) {
+        gzFile fp = gzopen(fn.c_str(), "r");
+        char buf[65536];
+        int n;
+        while ((n = gzread(fp, buf, sizeof(buf))) > 0) {
+            s.append(buf, n);
+        }
+        gzclose(fp);
+    } else {
+        std::ifstream in(fn, std::ios::binary);
+        s.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    return s;
+}
+
+static void check_sorted(const std::string& fname, const std::string& header,
+    int num_records, int num_unplaced) {
+    std::string bam = read_file(fname, true);
+    REQUIRE(bam.compare(0, header.size(), header) == 0);
+
+    size_t p = header.size();
+    int n = 0, unplaced = 0;
+    uint32_t last_ref = 0;
+    int last_pos = -1, last_serial = -1;
+    while (p < bam.size()) {
+        uint32_t ref = get_i32(bam, p + 4);
+        int pos = get_i32(bam, p + 8);
+        int serial = std::stoi(bam.substr(p + 36));
+        bool same = (ref == last_ref && pos == last_pos);
+        REQUIRE((ref > last_ref || (ref == last_ref && pos >= last_pos)));
+        // equal coordinates keep the input order
+        if (same) {
+            REQUIRE(serial > last_serial);
+        }
+        if ((int32_t) ref < 0) {
+            ++unplaced;
+        }
+        last_ref = ref;
+        last_pos = pos;
+        last_serial = serial;
+        p += 4 + get_i32(bam, p);
+        ++n;
+    }
+    REQUIRE(n == num_records);
+    REQUIRE(unplaced == num_unplaced);
+}
+
+TEST_CASE("bam sorter", "[bam_sort]")
+{
+    std::string fname {"test_bam_sort.bam"};
+    std::string header {"BAM\1fake header"};
+    std::vector<int> ref_lens {100000, 2000, 50000};
+
+    std::mt19937 gen(11);
+    std::vector<std::string> batches;
+    int n = 0, unplaced = 0;
+    for (int b = 0; b < 50; b++) {
+        std::string batch;
+        for (int i = 0; i < 200; i++, n++) {
+            int ref = (int) (gen() % 4) - 1;
+            int pos = (ref < 0) ? -1 : (int) (gen() % (ref_lens[ref] / 100)) * 10;
+            if (ref < 0) {
+                ++unplaced;
+            }
+            batch.append(make_record(ref, pos, n));
+        }
+        batches.push_back(batch);
+    }
+
+    SECTION("in memory") {
+        BamSorter sorter;
+        REQUIRE(sorter.open(fname, header, ref_lens, 2));
+        for (auto& b : batches) {
+            sorter.add(b.data(), b.size());
+        }
+        REQUIRE(sorter.close());
+        REQUIRE(sorter.numRuns() == 0);
+        check_sorted(fname, header, n, unplaced);
+    }
+
+    SECTION("spilled runs") {
+        BamSorter sorter;
+        REQUIRE(sorter.open(fname, header, ref_lens, 2, 1 << 16));
+        for (auto& b : batches) {
+            sorter.add(b.data(), b.size());
+        }
+        REQUIRE(sorter.close());
+        REQUIRE(sorter.numRuns() > 3);
+        check_sorted(fname, header, n, unplaced);
+        // temporary runs are cleaned up
+        REQUIRE(std::ifstream(fname + ".tmp.0").fail());
+    }
+
+    std::string bai = read_file(fname + ".bai", false);
+    REQUIRE(bai.compare(0, 4, "BAI\1", 4) == 0);
+    REQUIRE(get_i32(bai, 4) == (int) ref_lens.size());
+    // number of unplaced reads at the end
+    REQUIRE(get_i32(bai, bai.size() - 8) == unplaced);
+
+    std::remove(fname.c_str());
+    std::remove((fname + ".bai").c_str());
+}
+
+TEST_CASE("bam sorter, truncated runs fail the merge", "[bam_sort]")
+{
+    std::string fname {"test_bam_sort_trunc.bam"};
+    std::string header {"BAM\1"};
+    std::vector<int> ref_lens {100000};
+
+    BamSorter sorter;
+    REQUIRE(sorter.open(fname, header, ref_lens, 1, 1 << 14));
+    for (int i = 0; i < 2000; i++) {
+        std::string rec = make_record(0, (i * 7919) % 100000, i);
+        sorter.add(rec.data(), rec.size());
+    }
+    // the first run is on disk once the second one was handed off
+    REQUIRE(sorter.numRuns() > 1);
+
+    // cut the first run in half, as a full disk or a stray cleanup would
+    std::string run = read_file(fname + ".tmp.0", false);
+    {
+        std::ofstream out(fname + ".tmp.0", std::ios::binary | std::ios::trunc);
+        out.write(run.data(), run.size() / 2);
+    }
+    REQUIRE(!sorter.close());
+    REQUIRE(std::ifstream(fname).fail());
+    REQUIRE(std::ifstream(fname + ".bai").fail());
+    for (int i = 0; i < sorter.numRuns(); i++) {
+        REQUIRE(std::ifstream(fname + ".tmp." + std::to_string(i)).fail());
+    }
+}
+
+TEST_CASE("bam sorter, more runs than the fan-in merge in passes", "[bam_sort]")
+{
+    std::string fname {"test_bam_sort_fanin.bam"};
+    std::string header {"BAM\1"};
+    std::vector<int> ref_lens {100000, 100000};
+
+    BamSorter sorter;
+    REQUIRE(sorter.open(fname, header, ref_lens, 1, 1 << 12));
+    int n = 12000;
+    for (int i = 0; i < n; i++) {
+        // few distinct positions, so ties have to stay in input order
+        std::string rec = make_record(i % 2, (i * 7919) % 1000, i);
+        sorter.add(rec.data(), rec.size());
+    }
+    REQUIRE(sorter.close());
+    REQUIRE(sorter.numRuns() > 2 * BAM_SORT_MAX_FANIN);
+    check_sorted(fname, header, n, 0);
+    // the intermediate runs are gone as well
+    for (int i = 0; i < 2 * sorter.numRuns(); i++) {
+        REQUIRE(std::ifstream(fname + ".tmp." + std::to_string(i)).fail());
+    }
+    std::remove(fname.c_str());
+    std::remove((fname + ".bai").c_str());
+}
+
+TEST_CASE("bam sorter, long references use csi", "[bam_sort]")
+{
+    std::string fname {"test_bam_sort_csi.bam"};
+    std::string header {"BAM\1"};
+    std::vector<int> ref_lens {1 << 30};
+
+    std::string batch;
+    batch.append(make_record(0, 900000000, 0));
+    batch.append(make_record(0, 5, 1));
+
+    BamSorter sorter;
+    REQUIRE(sorter.open(fname, header, ref_lens, 1));
+    sorter.add(batch.data(), batch.size());
+    REQUIRE(sorter.close());
+    REQUIRE(sorter.indexFile() == fname + ".csi");
+    check_sorted(fname, header, 2, 0);
+
+    std::string csi = read_file(fname + ".csi", true);
+    REQUIRE(csi.compare(0, 4, "CSI\1", 4) == 0);
+    REQUIRE(get_i32(csi, 4) == 14); // min_shift
+    REQUIRE(get_i32(csi, 8) == 6); // depth
+
+    std::remove(fname.c_str());
+    std::remove((fname + ".csi").c_str());
+}
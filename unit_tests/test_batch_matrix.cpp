@@ -0,0 +1,70 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "KmerIndex.h"
+#include "BatchMatrixWriter.h"
+
+static std::string slurp(const std::string& fname) {
+    std::ifstream in(fname);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("batch matrix writer", "[batch_matrix]")
+{
+    ProgramOptions opt;
+    KmerIndex index(opt);
+    index.ecmap = {{0}, {1}, {0, 1}};
+
+    std::vector<std::string> ids {"a", "b", "c"};
+    BatchMatrixWriter writer;
+    REQUIRE(writer.open("test_batch_matrix", ids, true));
+    writer.write({{0, 3}, {2, 1}});
+    writer.write({});
+    // an ec added while the cells were written
+    writer.write({{1, 2}, {3, 5}});
+    index.ecmap.push_back({1, 2});
+    REQUIRE(writer.close(index));
+
+    REQUIRE(slurp("test_batch_matrix.mtx") ==
+        "%%MatrixMarket matrix coordinate integer general\n"
+        "%\n"
+        "3 4 4" + std::string(57, ' ') + "\n"
+        "1 1 3\n"
+        "1 3 1\n"
+        "3 2 2\n"
+        "3 4 5\n");
+    REQUIRE(slurp("test_batch_matrix.cells") == "a\nb\nc\n");
+    REQUIRE(slurp("test_batch_matrix.ec") == "0\t0\n1\t1\n2\t0,1\n3\t1,2\n");
+
+    // the same counts as CSR
+    hid_t file_id = H5Fopen("test_batch_matrix.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+    REQUIRE(file_id >= 0);
+    hid_t group_id = H5Gopen(file_id, "/matrix", H5P_DEFAULT);
+    std::vector<int> indices, data;
+    read_dataset(group_id, "indices", indices);
+    read_dataset(group_id, "data", data);
+    REQUIRE(indices == std::vector<int>({0, 2, 1, 3}));
+    REQUIRE(data == std::vector<int>({3, 1, 2, 5}));
+
+    std::vector<int64_t> indptr(4), shape(2);
+    hid_t dataset_id = H5Dopen(group_id, "indptr", H5P_DEFAULT);
+    H5Dread(dataset_id, H5T_NATIVE_INT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, indptr.data());
+    H5Dclose(dataset_id);
+    dataset_id = H5Dopen(group_id, "shape", H5P_DEFAULT);
+    H5Dread(dataset_id, H5T_NATIVE_INT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, shape.data());
+    H5Dclose(dataset_id);
+    REQUIRE(indptr == std::vector<int64_t>({0, 2, 2, 4}));
+    REQUIRE(shape == std::vector<int64_t>({3, 4}));
+    H5Gclose(group_id);
+    H5Fclose(file_id);
+
+    for (auto ext : {".mtx", ".cells", ".ec", ".h5"}) {
+        std::remove((std::string("test_batch_matrix") + ext).c_str());
+    }
+}
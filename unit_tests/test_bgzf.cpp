@@ -0,0 +1,76 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <zlib.h>
+
+#include "BGZFWriter.h"
+
+TEST_CASE("bgzf writer", "[bgzf]")
+{
+    std::string fname {"test_bgzf.gz"};
+
+    // several blocks worth of mildly compressible data
+    std::mt19937 gen(7);
+    std::string data;
+    for (auto i = 0; i < 300000; ++i) {
+        data.push_back("ACGT\t\n"[gen() % 6]);
+    }
+
+    BGZFWriter bgzf;
+    REQUIRE(bgzf.open(fname, 3));
+    // uneven writes, some straddling a block boundary
+    size_t pos = 0, len = 1;
+    while (pos < data.size()) {
+        size_t n = std::min(len, data.size() - pos);
+        bgzf.write(data.data() + pos, n);
+        pos += n;
+        len = (len * 7 + 3) % 100000;
+    }
+    REQUIRE(bgzf.close());
+
+    // every block is a gzip member, so zlib reads the file back as a whole
+    gzFile fp = gzopen(fname.c_str(), "r");
+    REQUIRE(fp != nullptr);
+    std::string back(data.size() + 10, 0);
+    int n = gzread(fp, &back[0], back.size());
+    gzclose(fp);
+    REQUIRE(n == (int) data.size());
+    back.resize(n);
+    REQUIRE(back == data);
+
+    // walk the blocks using the BSIZE field, ending with the empty EOF block
+    std::ifstream in(fname, std::ios::binary);
+    std::string raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t off = 0;
+    int num_blocks = 0;
+    size_t last_size = 0;
+    while (off < raw.size()) {
+        REQUIRE((unsigned char) raw[off] == 0x1f);
+        REQUIRE((unsigned char) raw[off+1] == 0x8b);
+        REQUIRE(raw[off+12] == 'B');
+        REQUIRE(raw[off+13] == 'C');
+        size_t bsize = ((unsigned char) raw[off+16] | ((unsigned char) raw[off+17] << 8)) + 1;
+        REQUIRE(bsize <= 65536);
+        last_size = bsize;
+        off += bsize;
+        ++num_blocks;
+    }
+    REQUIRE(off == raw.size());
+    REQUIRE(last_size == 28);
+    REQUIRE(num_blocks == 1 + (data.size() + BGZFWriter::BGZF_BLOCK_SIZE - 1) / BGZFWriter::BGZF_BLOCK_SIZE);
+
+    std::remove(fname.c_str());
+
+    // a full disk fails the close rather than leaving a truncated file
+    std::ifstream full("/dev/full");
+    if (full.is_open()) {
+        REQUIRE(bgzf.open("/dev/full", 2));
+        bgzf.write(data.data(), data.size());
+        REQUIRE(!bgzf.close());
+    }
+}
@@ -0,0 +1,75 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "BootstrapSummary.h"
+
+TEST_CASE("bootstrap summary", "[bootstrap_summary]")
+{
+    std::mt19937_64 gen(42);
+    std::normal_distribution<double> dist(100.0, 10.0);
+
+    const int n = 2000;
+    std::vector<std::vector<double>> reps;
+    for (auto b = 0; b < n; ++b) {
+        reps.push_back({dist(gen), 0.0, static_cast<double>(b)});
+    }
+
+    BootstrapSummary summary;
+    summary.init(3);
+    // feed out of order, as the bootstrap threads would
+    for (auto b = 0; b < n; b += 2) {
+        summary.add(b + 1, reps[b + 1]);
+        summary.add(b, reps[b]);
+    }
+    REQUIRE(summary.num_bootstrap() == n);
+
+    double mean = 0.0;
+    for (auto& r : reps) {
+        mean += r[0];
+    }
+    mean /= n;
+    double var = 0.0;
+    for (auto& r : reps) {
+        var += (r[0] - mean) * (r[0] - mean);
+    }
+    var /= (n - 1);
+
+    auto v = summary.variance();
+    REQUIRE(summary.mean_[0] == Approx(mean));
+    REQUIRE(v[0] == Approx(var));
+    REQUIRE(summary.mean_[1] == 0.0);
+    REQUIRE(v[1] == 0.0);
+
+    std::vector<double> sorted;
+    for (auto& r : reps) {
+        sorted.push_back(r[0]);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    // the P^2 sketch is approximate, allow a quarter of a standard deviation
+    auto q = summary.quantiles();
+    REQUIRE(q.size() == BootstrapSummary::quantile_probs.size());
+    for (size_t i = 0; i < q.size(); ++i) {
+        double exact = sorted[(size_t) (BootstrapSummary::quantile_probs[i] * (n - 1))];
+        REQUIRE(std::abs(q[i][0] - exact) < 2.5);
+    }
+    REQUIRE(q[1][1] == 0.0);
+    REQUIRE(q[1][2] == Approx(n / 2.0).epsilon(0.02));
+}
+
+TEST_CASE("bootstrap summary, few samples", "[bootstrap_summary]")
+{
+    BootstrapSummary summary;
+    summary.init(1);
+    summary.add(0, {3.0});
+    summary.add(1, {1.0});
+    summary.add(2, {2.0});
+
+    auto q = summary.quantiles();
+    REQUIRE(q[1][0] == Approx(2.0));
+    REQUIRE(summary.variance()[0] == Approx(1.0));
+}
@@ -0,0 +1,60 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "KmerIndex.h"
+#include "MinCollector.h"
+#include "ProcessReads.h"
+#include "EMAlgorithm.h"
+#include "weights.h"
+
+// The single precision EM stores weights and abundances as float but sums
+// in double. On the bundled data every estimated count above 1 read must
+// agree with the double precision EM to within 0.1%.
+const double SINGLE_PRECISION_REL_TOL = 1e-3;
+const double SINGLE_PRECISION_ABS_TOL = 1e-2;
+
+TEST_CASE("single precision EM", "[em]")
+{
+    ProgramOptions opt;
+    opt.transfasta = {"../unit_tests/input/10_trans_gt_500_bp.fasta"};
+    opt.files = {"../unit_tests/input/r1.fastq", "../unit_tests/input/r2.fastq"};
+    Kmer::set_k(opt.k);
+
+    KmerIndex index(opt);
+    index.BuildTranscripts(opt);
+    REQUIRE(index.num_trans == 10);
+
+    MinCollector collection(index, opt);
+    int num_processed = ProcessReads(index, opt, collection);
+    REQUIRE(num_processed > 0);
+
+    collection.compute_mean_frag_lens_trunc();
+    auto fl_means = get_frag_len_means(index.target_lens_, collection.mean_fl_trunc);
+
+    EMAlgorithm em(collection.counts, index, collection, fl_means, opt);
+    em.run(10000, 50, false, false);
+
+    ProgramOptions opt_sp = opt;
+    opt_sp.single_precision = true;
+    EMAlgorithm em_sp(collection.counts, index, collection, fl_means, opt_sp);
+    em_sp.run(10000, 50, false, false);
+
+    REQUIRE(em_sp.weight_map_.empty());
+    REQUIRE(em.alpha_.size() == em_sp.alpha_.size());
+
+    double total = 0.0;
+    for (size_t i = 0; i < em.alpha_.size(); ++i) {
+        total += em.alpha_[i];
+        double diff = std::fabs(em.alpha_[i] - em_sp.alpha_[i]);
+        if (em.alpha_[i] > 1.0) {
+            REQUIRE(diff / em.alpha_[i] < SINGLE_PRECISION_REL_TOL);
+        } else {
+            REQUIRE(diff < SINGLE_PRECISION_ABS_TOL);
+        }
+    }
+    REQUIRE(total > 0.0);
+}
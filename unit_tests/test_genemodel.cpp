@@ -0,0 +1,109 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "KmerIndex.h"
+#include "GeneModel.h"
+#include "PseudoBam.h"
+
+static uint32_t op(int len, uint32_t type) {
+    return (len << 4) | type;
+}
+
+TEST_CASE("genome projection", "[genemodel]")
+{
+    std::string fname {"test_genemodel.gtf"};
+    {
+        std::ofstream gtf(fname);
+        gtf << "#comment\n"
+            // t1: forward strand, exons [100,200) [300,350) [400,500)
+            << "chr1\tx\ttranscript\t101\t500\t.\t+\t.\tgene_id \"g1\"; transcript_id \"t1\";\n"
+            << "chr1\tx\texon\t101\t200\t.\t+\t.\tgene_id \"g1\"; transcript_id \"t1\";\n"
+            << "chr1\tx\texon\t301\t350\t.\t+\t.\tgene_id \"g1\"; transcript_id \"t1\";\n"
+            << "chr1\tx\texon\t401\t500\t.\t+\t.\tgene_id \"g1\"; transcript_id \"t1\";\n"
+            // t2: reverse strand, exons [1000,1100) [1200,1300), versioned id
+            << "chr2\tx\texon\t1201\t1300\t.\t-\t.\tgene_id \"g2\"; transcript_id \"t2\"; transcript_version \"3\";\n"
+            << "chr2\tx\texon\t1001\t1100\t.\t-\t.\tgene_id \"g2\"; transcript_id \"t2\"; transcript_version \"3\";\n"
+            // t3: length does not match the index
+            << "chr2\tx\texon\t5001\t5100\t.\t+\t.\tgene_id \"g3\"; transcript_id \"t3\";\n"
+            // not in the index
+            << "chr3\tx\texon\t1\t100\t.\t+\t.\tgene_id \"g4\"; transcript_id \"t4\";\n";
+    }
+
+    ProgramOptions opt;
+    KmerIndex index(opt);
+    index.num_trans = 4;
+    index.target_names_ = {"t1", "t2.3", "t3", "t5|extra"};
+    index.target_lens_ = {250, 200, 50, 100};
+
+    Transcriptome model;
+    REQUIRE(model.parseGTF(fname, index));
+    REQUIRE(model.chr_names == std::vector<std::string>({"chr1", "chr2"}));
+    REQUIRE(model.chr_lens == std::vector<int>({500, 5100}));
+    REQUIRE(model.num_missing == 2);
+
+    int chr, gpos;
+    bool flip;
+    std::vector<uint32_t> cigar;
+
+    // within the first exon
+    REQUIRE(model.project(0, 10, 50, 0, 0, chr, gpos, flip, cigar));
+    REQUIRE(chr == 0);
+    REQUIRE(gpos == 110);
+    REQUIRE(!flip);
+    REQUIRE(cigar == std::vector<uint32_t>({op(50, BAM_CMATCH)}));
+
+    // across all three exons, with soft clips kept in place
+    REQUIRE(model.project(0, 90, 70, 2, 3, chr, gpos, flip, cigar));
+    REQUIRE(gpos == 190);
+    REQUIRE(cigar == std::vector<uint32_t>({op(2, BAM_CSOFT_CLIP), op(10, BAM_CMATCH),
+        op(100, BAM_CREF_SKIP), op(50, BAM_CMATCH), op(50, BAM_CREF_SKIP),
+        op(10, BAM_CMATCH), op(3, BAM_CSOFT_CLIP)}));
+
+    // reverse strand: target position 0 is the end of the last exon, clips swap
+    REQUIRE(model.project(1, 0, 30, 5, 0, chr, gpos, flip, cigar));
+    REQUIRE(chr == 1);
+    REQUIRE(flip);
+    REQUIRE(gpos == 1270);
+    REQUIRE(cigar == std::vector<uint32_t>({op(30, BAM_CMATCH), op(5, BAM_CSOFT_CLIP)}));
+
+    REQUIRE(model.project(1, 90, 20, 0, 0, chr, gpos, flip, cigar));
+    REQUIRE(gpos == 1090);
+    REQUIRE(cigar == std::vector<uint32_t>({op(10, BAM_CMATCH), op(100, BAM_CREF_SKIP),
+        op(10, BAM_CMATCH)}));
+
+    // off the end of the target, or not annotated
+    REQUIRE(!model.project(0, 240, 20, 0, 0, chr, gpos, flip, cigar));
+    REQUIRE(!model.project(2, 0, 20, 0, 0, chr, gpos, flip, cigar));
+    REQUIRE(!model.project(3, 0, 20, 0, 0, chr, gpos, flip, cigar));
+
+    // chromosomes and lengths from the assembly, in its order, leaving out
+    // the targets on other chromosomes
+    std::string sizes {"test_genemodel.fai"};
+    {
+        std::ofstream fai(sizes);
+        fai << "chrM\t16569\t0\t60\t61\n"
+            << "chr2\t242193529\t16905\t60\t61\n";
+    }
+    REQUIRE(model.parseGTF(fname, index, sizes));
+    REQUIRE(model.chr_names == std::vector<std::string>({"chrM", "chr2"}));
+    REQUIRE(model.chr_lens == std::vector<int>({16569, 242193529}));
+    REQUIRE(model.num_missing == 3);
+    REQUIRE(model.project(1, 0, 30, 0, 0, chr, gpos, flip, cigar));
+    REQUIRE(chr == 1);
+    REQUIRE(!model.project(0, 10, 50, 0, 0, chr, gpos, flip, cigar));
+
+    // exons past the end of a chromosome do not belong to that assembly
+    {
+        std::ofstream fai(sizes);
+        fai << "chr1\t400\n";
+    }
+    REQUIRE(!model.parseGTF(fname, index, sizes));
+
+    std::remove(sizes.c_str());
+    std::remove(fname.c_str());
+}
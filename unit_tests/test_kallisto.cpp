@@ -0,0 +1,84 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "Kallisto.h"
+#include "KmerIndex.h"
+
+static std::string firstSequence(const std::string& fasta) {
+    std::ifstream in(fasta);
+    std::string line, seq;
+    std::getline(in, line); // header
+    while (std::getline(in, line) && line[0] != '>') {
+        seq += line;
+    }
+    return seq;
+}
+
+TEST_CASE("library interface", "[kallisto]")
+{
+    std::string fasta {"input/10_trans_gt_500_bp.fasta"};
+    ProgramOptions opt;
+    opt.transfasta.push_back(fasta);
+    Kmer::set_k(opt.k);
+    {
+        KmerIndex index(opt);
+        index.BuildTranscripts(opt);
+        index.write("test_kallisto.idx");
+    }
+
+    auto index = kallisto::Index::load("test_kallisto.idx");
+    REQUIRE(index->k() == 31);
+    REQUIRE(index->targetNames().size() == 10);
+    REQUIRE(index->targetNames()[0] == "ENST00000475579");
+    REQUIRE(index->ec(0) == std::vector<int>({0}));
+
+    // reads from the first transcript, where a fragment of 200 fits
+    std::string trans = firstSequence(fasta);
+    std::vector<std::string> reads;
+    for (size_t p = 0; p + 200 <= trans.size(); p += 10) {
+        reads.push_back(trans.substr(p, 75));
+    }
+    reads.push_back(std::string(75, 'N'));
+
+    kallisto::SessionOptions so;
+    so.paired = false;
+    so.fragment_length = 200;
+    so.fragment_sd = 20;
+    kallisto::Session session(index, so);
+    auto ecs = session.pseudoalign(reads);
+    REQUIRE(ecs.size() == reads.size());
+    REQUIRE(ecs.back() == -1);
+    for (size_t i = 0; i + 1 < ecs.size(); i++) {
+        REQUIRE(ecs[i] >= 0);
+        auto& u = session.ec(ecs[i]);
+        REQUIRE(std::find(u.begin(), u.end(), 0) != u.end());
+    }
+    REQUIRE(session.numProcessed() == reads.size());
+    REQUIRE(session.numPseudoaligned() == reads.size() - 1);
+
+    auto est = session.quantify();
+    REQUIRE(est.target_names == index->targetNames());
+    double total = 0.0;
+    for (auto x : est.est_counts) {
+        total += x;
+    }
+    REQUIRE(total == Approx(reads.size() - 1));
+    REQUIRE(est.est_counts[0] == Approx(reads.size() - 1));
+
+    // errors are thrown instead of exiting
+    REQUIRE_THROWS_AS(kallisto::Index::load("test_kallisto_missing.idx"), kallisto::Error);
+    kallisto::SessionOptions bad;
+    bad.paired = false;
+    REQUIRE_THROWS_AS(kallisto::Session(index, bad), kallisto::Error);
+    kallisto::Session paired(index);
+    REQUIRE_THROWS_AS(paired.pseudoalign({reads[0]}), kallisto::Error);
+    REQUIRE_THROWS_AS(paired.quantify(), kallisto::Error);
+
+    std::remove("test_kallisto.idx");
+}
@@ -0,0 +1,58 @@
+#include "catch.hpp"
+
+#include "PerfCounters.h"
+#include "RunStats.h"
+
+TEST_CASE("perf counts add up and subtract parts", "[perf]")
+{
+    PerfCounts a, b;
+    a.counts[PerfCounts::Cycles] = 100;
+    a.valid[PerfCounts::Cycles] = true;
+    b.counts[PerfCounts::Cycles] = 30;
+    b.counts[PerfCounts::Instructions] = 50;
+    b.valid[PerfCounts::Instructions] = true;
+
+    a += b;
+    REQUIRE(a.counts[PerfCounts::Cycles] == 130);
+    REQUIRE(a.counts[PerfCounts::Instructions] == 50);
+    REQUIRE(a.valid[PerfCounts::Cycles]);
+    REQUIRE(a.valid[PerfCounts::Instructions]);
+    REQUIRE_FALSE(a.valid[PerfCounts::LLCMisses]);
+
+    // a part larger than the whole, from counters read at different times,
+    // does not wrap around
+    b.counts[PerfCounts::Instructions] = 80;
+    a -= b;
+    REQUIRE(a.counts[PerfCounts::Cycles] == 100);
+    REQUIRE(a.counts[PerfCounts::Instructions] == 0);
+
+    REQUIRE(std::string(PerfCounts::name(PerfCounts::LLCMisses)) == "llc_misses");
+}
+
+TEST_CASE("perf counters degrade without hardware events", "[perf]")
+{
+    // containers and virtual machines often have no counters, either way the
+    // run goes on and run_info.json says what happened
+    PerfCounters perf;
+    perf.start();
+    volatile size_t sum = 0;
+    for (size_t i = 0; i < 100000; i++) {
+        sum += i;
+    }
+    perf.stop();
+
+    RunStats stats;
+    stats.addProfile("test", "item", 100000, perf);
+    if (perf.available()) {
+        REQUIRE(stats.profiles.size() == 1);
+        REQUIRE(stats.profiles[0].units == 100000);
+        REQUIRE(stats.profile_error.empty());
+    } else {
+        REQUIRE_FALSE(perf.error().empty());
+        REQUIRE(stats.profiles.empty());
+        REQUIRE(stats.profile_error == perf.error());
+        for (int e = 0; e < PerfCounts::NumEvents; e++) {
+            REQUIRE_FALSE(perf.read().valid[e]);
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SharedSegment.h"
+
+TEST_CASE("shared memory segment", "[shared_segment]")
+{
+    std::string name = SharedSegment::nameFor("test_shared_segment_missing_file");
+    SharedSegment::remove(name);
+
+    int builds = 0;
+    auto build = [&builds](char *p) {
+        ++builds;
+        strcpy(p, "kallisto");
+        return true;
+    };
+
+    SharedSegment first;
+    REQUIRE(first.open(name, 1, 16, build));
+    REQUIRE(first.created());
+    REQUIRE(std::string(first.data()) == "kallisto");
+
+    // a second user attaches to the same data
+    SharedSegment second;
+    REQUIRE(second.open(name, 1, 16, build));
+    REQUIRE(!second.created());
+    REQUIRE(builds == 1);
+    REQUIRE(second.data() != first.data());
+    REQUIRE(std::string(second.data()) == "kallisto");
+
+    // different data is not mixed up
+    SharedSegment other;
+    REQUIRE(!other.open(name, 2, 16, build));
+    REQUIRE(!other.open(name, 1, 32, build));
+    REQUIRE(other.data() == nullptr);
+
+    // a failed build leaves nothing behind
+    REQUIRE(SharedSegment::remove(name));
+    REQUIRE(!other.open(name, 1, 16, [](char*) { return false; }));
+    REQUIRE(!SharedSegment::remove(name));
+}
+
+TEST_CASE("shared memory segment opened concurrently", "[shared_segment]")
+{
+    std::string name = SharedSegment::nameFor("test_shared_segment_concurrent");
+    SharedSegment::remove(name);
+
+    // jobs started together all use the one segment, whether they find it
+    // being built or still being set up
+    std::atomic<int> builds(0);
+    auto build = [&builds](char *p) {
+        ++builds;
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        strcpy(p, "kallisto");
+        return true;
+    };
+    const int n = 4;
+    SharedSegment segs[n];
+    bool ok[n];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++) {
+        threads.emplace_back([&, i] { ok[i] = segs[i].open(name, 1, 16, build); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    REQUIRE(builds == 1);
+    for (int i = 0; i < n; i++) {
+        REQUIRE(ok[i]);
+        REQUIRE(std::string(segs[i].data()) == "kallisto");
+    }
+    REQUIRE(SharedSegment::remove(name));
+}
+
+TEST_CASE("shared memory segments of earlier versions are removed", "[shared_segment]")
+{
+    std::string fname {"test_shared_segment_versions"};
+    std::ofstream(fname) << "first";
+    std::string old_name = SharedSegment::nameFor(fname);
+    auto build = [](char *p) { return true; };
+    SharedSegment first;
+    REQUIRE(first.open(old_name, 1, 16, build));
+
+    // the file changes, its segment gets a new name with the same prefix
+    std::ofstream(fname) << "second version";
+    std::string name = SharedSegment::nameFor(fname);
+    REQUIRE(name != old_name);
+    REQUIRE(name.substr(0, 27) == old_name.substr(0, 27));
+    SharedSegment second;
+    REQUIRE(second.open(name, 1, 16, build));
+
+    REQUIRE(SharedSegment::removeFor(fname, name) == 1);
+    REQUIRE(!SharedSegment::remove(old_name));
+    REQUIRE(SharedSegment::removeFor(fname) == 1);
+    REQUIRE(!SharedSegment::remove(name));
+    std::remove(fname.c_str());
+}
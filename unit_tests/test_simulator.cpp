@@ -0,0 +1,105 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "KmerIndex.h"
+#include "Simulator.h"
+
+static std::vector<std::string> gzLines(const std::string& fname) {
+    std::vector<std::string> lines;
+    gzFile f = gzopen(fname.c_str(), "r");
+    char buf[1024];
+    while (gzgets(f, buf, sizeof(buf)) != nullptr) {
+        std::string line(buf);
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+        }
+        lines.push_back(line);
+    }
+    gzclose(f);
+    return lines;
+}
+
+TEST_CASE("simulate reads", "[simulator]")
+{
+    ProgramOptions opt;
+    KmerIndex index(opt);
+    index.num_trans = 3;
+    index.target_names_ = {"a", "b", "short"};
+    index.target_seqs_ = {
+        "ACGTTGCAAGGCTTAGCCATGACGTAGCTAGCTAGGATCCGATCGATGGCATGCAGTCGATGCTAGCTAGCATCGATCGACTGACTAGCTAGCATGCA",
+        "TTGACCGATGCATGCTAGCTAGGCTAGCATCGATCGTAGCTAGGCTAGCTAGCATCGATCGGGCTAGCTAGCATCGACTAGCTAGCATCGACTAGCTA",
+        "ACGT"};
+    index.target_lens_ = {100, 100, 4};
+
+    std::vector<double> tpm {750000.0, 250000.0, 0.0};
+
+    opt.output = "test_simulator";
+    mkdir(opt.output.c_str(), 0777);
+    opt.sim_reads = 1000;
+    opt.read_length = 30;
+    opt.fld = 60;
+    opt.sd = 5;
+    opt.error_rate = 0.0;
+    REQUIRE(simulateReads(index, tpm, opt));
+
+    auto r1 = gzLines(opt.output + "/reads_1.fastq.gz");
+    auto r2 = gzLines(opt.output + "/reads_2.fastq.gz");
+    REQUIRE(r1.size() == 4000);
+    REQUIRE(r2.size() == 4000);
+    size_t num_a = 0;
+    for (size_t i = 0; i < r1.size(); i += 4) {
+        REQUIRE(r1[i] == r2[i]);
+        REQUIRE(r1[i+1].size() == 30);
+        // without errors the mates come from the ends of a fragment of the
+        // target named in the read
+        std::string target = r1[i].substr(1, r1[i].find(':') - 1);
+        REQUIRE(target != "short");
+        const std::string& seq = index.target_seqs_[(target == "a") ? 0 : 1];
+        num_a += (target == "a");
+        bool forward = seq.find(r1[i+1]) != std::string::npos && seq.find(revcomp(r2[i+1])) != std::string::npos;
+        bool reverse = seq.find(revcomp(r1[i+1])) != std::string::npos && seq.find(r2[i+1]) != std::string::npos;
+        REQUIRE((forward || reverse));
+    }
+    REQUIRE(num_a > 650);
+    REQUIRE(num_a < 850);
+
+    std::ifstream truth(opt.output + "/truth.tsv");
+    std::string line;
+    std::getline(truth, line);
+    REQUIRE(line == "target_id\tlength\ttpm\tfragments");
+    std::getline(truth, line);
+    REQUIRE(line == "a\t100\t750000\t" + std::to_string(num_a));
+
+    // the same seed gives the same reads, errors included
+    opt.error_rate = 0.05;
+    opt.single_end = true;
+    REQUIRE(simulateReads(index, tpm, opt));
+    auto s1 = gzLines(opt.output + "/reads_1.fastq.gz");
+    REQUIRE(simulateReads(index, tpm, opt));
+    REQUIRE(gzLines(opt.output + "/reads_1.fastq.gz") == s1);
+    REQUIRE(s1.size() == 4000);
+
+    // abundances as written by quant
+    {
+        std::ofstream ab(opt.output + "/abundance.tsv");
+        ab << "target_id\tlength\teff_length\test_counts\ttpm\n"
+           << "b\t100\t41\t10\t125.5\n"
+           << "missing\t100\t41\t10\t10\n";
+    }
+    std::vector<double> read_tpm;
+    REQUIRE(readAbundances(opt.output + "/abundance.tsv", index, read_tpm));
+    REQUIRE(read_tpm == std::vector<double>({0.0, 125.5, 0.0}));
+
+    for (auto f : {"reads_1.fastq.gz", "reads_2.fastq.gz", "truth.tsv", "abundance.tsv"}) {
+        std::remove((opt.output + "/" + f).c_str());
+    }
+    rmdir(opt.output.c_str());
+}
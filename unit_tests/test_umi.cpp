@@ -0,0 +1,33 @@
+#include "catch.hpp"
+
+#include <string>
+
+#include "ProcessReads.h"
+
+static uint64_t pack(const std::string& umi) {
+    return packUmi(umi.data(), umi.size());
+}
+
+TEST_CASE("umi packing", "[umi]")
+{
+    // 2 bits per base after a leading 1
+    REQUIRE(pack("") == 1);
+    REQUIRE(pack("A") == 4);
+    REQUIRE(pack("T") == 7);
+    REQUIRE(pack("ACGT") == ((1ULL << 8) | 0x1b));
+
+    // different lengths and bases never collide
+    REQUIRE(pack("ACG") != pack("ACGA"));
+    REQUIRE(pack("A") != pack("AA"));
+    REQUIRE(pack("ACGA") != pack("ACGT"));
+
+    // 31 bases still fit, anything longer or not ACGT is hashed
+    std::string a31(31, 'T');
+    REQUIRE(pack(a31) == (1ULL << 63) - 1);
+    REQUIRE((pack(a31) >> 63) == 0);
+    REQUIRE((pack(std::string(32, 'A')) >> 63) == 1);
+    REQUIRE((pack("ACGN") >> 63) == 1);
+    REQUIRE(pack("ACGN") == pack("ACGN"));
+    REQUIRE(pack("ACGN") != pack("ACNG"));
+    REQUIRE(pack(std::string(32, 'A')) != pack(std::string(33, 'A')));
+}